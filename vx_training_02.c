@@ -12,6 +12,8 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
+#include "vx_training_startup.h"
+
 #include <stdio.h>
 #include <VX/vx.h>
 
@@ -26,6 +28,8 @@ int
 main (int argc, char *argv[])
 {
   int ret = -1;
+  startup_profiler startup;
+  startup_begin (&startup);
 
   const char *filename = "lena.png";
   if (argc >= 2) {
@@ -40,6 +44,8 @@ main (int argc, char *argv[])
     goto free_context;
   }
 
+  startup_mark (&startup, "Context creation");
+
   vx_bool reentrant = vx_false_e;
   vxRegisterLogCallback(context, context_log_callback, reentrant);
 
@@ -52,6 +58,8 @@ main (int argc, char *argv[])
     goto free_context;
   }
 
+  startup_mark (&startup, "Image load");
+
   vx_image image = vxCreateImage(context, width, height, VX_DF_IMAGE_RGB);
 
   status = vxGetStatus ((vx_reference)image);
@@ -60,6 +68,8 @@ main (int argc, char *argv[])
     goto free_img;
   }
 
+  startup_mark (&startup, "Image creation");
+
   const vx_rectangle_t rect = { 0, 0, width, height };
   vx_uint32 plane = 0;
   vx_map_id map_id = 0;
@@ -88,6 +98,9 @@ main (int argc, char *argv[])
     goto free_img;
   }
   
+  startup_mark (&startup, "Image write");
+  startup_report (&startup, "Total");
+
   ret = 0;
 
  free_img:
@@ -12,6 +12,8 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
+#include "vx_training_startup.h"
+
 #include <stdio.h>
 #include <VX/vx.h>
 
@@ -54,6 +56,8 @@ int
 main (int argc, char *argv[])
 {
   int ret = -1;
+  startup_profiler startup;
+  startup_begin (&startup);
 
   const char *filename = "lena.png";
   if (argc >= 2) {
@@ -68,6 +72,8 @@ main (int argc, char *argv[])
     goto free_context;
   }
 
+  startup_mark (&startup, "Context creation");
+
   vx_bool reentrant = vx_false_e;
   vxRegisterLogCallback(context, context_log_callback, reentrant);
 
@@ -80,6 +86,8 @@ main (int argc, char *argv[])
     goto free_context;
   }
   
+  startup_mark (&startup, "Image load");
+
   vx_image in_image = vxCreateImage(context, width, height, VX_DF_IMAGE_RGB);
 
   status = vxGetStatus ((vx_reference)in_image);
@@ -101,6 +109,8 @@ main (int argc, char *argv[])
     goto free_out_img;
   }
 
+  startup_mark (&startup, "Image creation");
+
   vx_graph graph = vxCreateGraph (context);
 
   status = vxGetStatus ((vx_reference)graph);
@@ -116,6 +126,9 @@ main (int argc, char *argv[])
     fprintf (stderr, "vx-training: Unable to create processing node: %d\n", status);
     goto free_node;
   }
+
+  startup_mark (&startup, "Graph and node creation");
+  startup_report (&startup, "Total");
     
   ret = 0;
 
@@ -13,10 +13,15 @@
 #include "stb_image.h"
 
 #define STB_IMAGE_WRITE_IMPLEMENTATION
-#include "stb_image_write.h"
+#include "vx_training_png_writer.h"
+#include "vx_training_memory.h"
+#include "vx_training_raw.h"
+#include "vx_training_startup.h"
 
 #include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
 #include <VX/vx.h>
 
 static int
@@ -47,15 +52,23 @@ populate_image (vx_image image, const unsigned char *img_data)
   return ret;
 }
 
+/* Hands the image to the writer, the PNG is encoded and written in
+ * the background. Paths ending in .raw are stored right away as raw
+ * images instead, there is nothing to encode.
+ */
 static int
-dump_image (vx_image image, const char *path)
+dump_image (png_writer *writer, vx_image image, const char *path)
 {
   int ret = -1;
 
+  if (raw_path (path)) {
+    return raw_write_image (image, path);
+  }
+
   int width = 0;
   int height = 0;
   vxQueryImage (image, VX_IMAGE_WIDTH, &width, sizeof (width));
-  vxQueryImage (image, VX_IMAGE_WIDTH, &height, sizeof (height));
+  vxQueryImage (image, VX_IMAGE_HEIGHT, &height, sizeof (height));
 
   const vx_rectangle_t rect = { 0, 0, width, height };
   vx_uint32 plane = 0;
@@ -71,8 +84,8 @@ dump_image (vx_image image, const char *path)
     goto out;
   }
 
-  if (0 == stbi_write_png (path, width, height, addr.stride_x, ptr, addr.stride_y)) {
-    fprintf (stderr, "vx-training: Unable to write image to %s\n", path);
+  if (0 != png_writer_write (writer, path, width, height, addr.stride_x, ptr, addr.stride_y)) {
+    fprintf (stderr, "vx-training: Unable to queue image for %s\n", path);
     goto unmap;
   }
 
@@ -96,17 +109,58 @@ int
 main (int argc, char *argv[])
 {
   int ret = -1;
+  startup_profiler startup;
+  startup_begin (&startup);
+  memory_accounting memory;
+  memory_begin (&memory);
+  int level = 8;
+  int writers = 2;
+  int capacity = 4;
+
+  int opt = 0;
+  while (-1 != (opt = getopt (argc, argv, "l:n:q:"))) {
+    switch (opt) {
+    case 'l':
+      level = atoi (optarg);
+      break;
+    case 'n':
+      writers = atoi (optarg);
+      break;
+    case 'q':
+      capacity = atoi (optarg);
+      break;
+    default:
+      fprintf (stderr, "Usage: %s [-l level] [-n threads] [-q images] [image] [output]\n", argv[0]);
+      fprintf (stderr, "\t-l: PNG compression level, from 0 to 9 where 1 is the fastest (default 8)\n");
+      fprintf (stderr, "\t-n: threads writing images (default 2)\n");
+      fprintf (stderr, "\t-q: images queued for writing before dumping waits (default 4)\n");
+      goto out;
+    }
+  }
+
+  if (level < 0 || level > 9 || writers < 1 || capacity < 1) {
+    fprintf (stderr, "vx-training: Invalid PNG writer options\n");
+    goto out;
+  }
 
   const char *filename = "lena.png";
-  if (argc >= 2) {
-    filename = argv[1];
+  if (argc > optind) {
+    filename = argv[optind];
   }
 
   const char *outname = "out.png";
-  if (argc >= 3) {
-    outname = argv[2];
+  if (argc > optind + 1) {
+    outname = argv[optind + 1];
+  }
+
+  png_writer *writer = png_writer_new (writers, capacity, level);
+  if (NULL == writer) {
+    fprintf (stderr, "vx-training: Unable to create PNG writer\n");
+    goto out;
   }
   
+  startup_mark (&startup, "PNG writer creation");
+
   vx_context context = vxCreateContext ();
 
   vx_status status = vxGetStatus ((vx_reference)context);
@@ -115,19 +169,37 @@ main (int argc, char *argv[])
     goto free_context;
   }
 
+  startup_mark (&startup, "Context creation");
+
   vx_bool reentrant = vx_false_e;
   vxRegisterLogCallback(context, context_log_callback, reentrant);
 
   int width = 0;
   int height = 0;
   int channels = 0;
-  unsigned char *img_data = stbi_load (filename, &width, &height, &channels, 3);
-  if (NULL == img_data) {
-    fprintf (stderr, "vx-training: Unable to load image \"%s\"\n", filename);
-    goto free_context;
+  unsigned char *img_data = NULL;
+  raw_frame raw = { 0 };
+  vx_image in_image = NULL;
+
+  if (raw_probe (filename)) {
+    /* Wrapped where it is mapped, nothing to decode or copy */
+    if (0 != raw_open (filename, &raw) || VX_DF_IMAGE_RGB != raw.format) {
+      fprintf (stderr, "vx-training: Unable to load RGB raw image \"%s\"\n", filename);
+      goto free_img_data;
+    }
+    width = raw.width;
+    height = raw.height;
+    in_image = raw_create_image (context, &raw);
+  } else {
+    img_data = stbi_load (filename, &width, &height, &channels, 3);
+    if (NULL == img_data) {
+      fprintf (stderr, "vx-training: Unable to load image \"%s\"\n", filename);
+      goto free_context;
+    }
+    in_image = vxCreateImage(context, width, height, VX_DF_IMAGE_RGB);
   }
-  
-  vx_image in_image = vxCreateImage(context, width, height, VX_DF_IMAGE_RGB);
+
+  startup_mark (&startup, "Image load");
 
   status = vxGetStatus ((vx_reference)in_image);
   if (VX_SUCCESS != status) {
@@ -135,7 +207,7 @@ main (int argc, char *argv[])
     goto free_in_img;
   }
 
-  if (0 != populate_image (in_image, img_data)) {
+  if (NULL != img_data && 0 != populate_image (in_image, img_data)) {
     fprintf (stderr, "vx-training: Unable to populate image\n");
     goto free_in_img;
   }
@@ -148,6 +220,8 @@ main (int argc, char *argv[])
     goto free_out_img;
   }
 
+  startup_mark (&startup, "Image creation");
+
   vx_graph graph = vxCreateGraph (context);
 
   status = vxGetStatus ((vx_reference)graph);
@@ -218,24 +292,53 @@ main (int argc, char *argv[])
     }
   }
 
+  startup_mark (&startup, "Graph and node creation");
+
   status = vxVerifyGraph (graph);
   if (VX_SUCCESS != status) {
     fprintf (stderr, "vx-training: Graph validation failed: %d\n", status);
     goto free_node;
   }
 
+  startup_mark (&startup, "Graph verification");
+
+  /* Sizes are final once the graph is verified */
+  if (NULL != img_data) {
+    memory_add_host (&memory, "host", "decoded image", (size_t)width*height*3);
+  }
+  memory_add_image (&memory, "graph", "in_image", in_image);
+  for (int i = 0; i < sizeof (intermediates)/sizeof (vx_image); i++) {
+    memory_add_virtual_image (&memory, "graph", "intermediate", intermediates[i]);
+  }
+  memory_add_matrix (&memory, "graph", "matrix", matrix);
+  memory_add_image (&memory, "graph", "out_image", out_image);
+  memory_setup_done (&memory);
+
   status = vxProcessGraph (graph);
   if (VX_SUCCESS != status) {
     fprintf (stderr, "vx-training: Error processing the graph: %d\n", status);
     goto free_node;
   }
 
-  if (0 != dump_image (out_image, outname)) {
+  startup_mark (&startup, "First frame");
+  startup_report (&startup, "Time to first frame");
+  memory_sample (&memory);
+
+  if (0 != dump_image (writer, out_image, outname)) {
     fprintf (stderr, "vx-training: Error writing output image to \"%s\"\n", outname);
     goto free_node;
   }
 
-  dump_image (in_image, "test.png");
+  dump_image (writer, in_image, "test.png");
+
+  if (0 != png_writer_finish (writer)) {
+    fprintf (stderr, "vx-training: Error writing images\n");
+    goto free_node;
+  }
+  /* Again once the images are written, after the writer buffers grew */
+  memory_sample (&memory);
+  png_writer_report (writer);
+  memory_report (&memory);
   
   ret = 0;
 
@@ -260,10 +363,13 @@ main (int argc, char *argv[])
 
  free_img_data:
   free (img_data);
+  raw_close (&raw);
   
  free_context:
   vxReleaseContext (&context);
 
+  png_writer_free (writer);
+
  out:
   return ret;
 }
@@ -15,32 +15,30 @@
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
 
+#include "vx_training_bench.h"
+#include "vx_training_graph_cache.h"
+#include "vx_training_handles.h"
+#include "vx_training_kernels.h"
+#include "vx_training_startup.h"
+
+#include <chrono>
 #include <cmath>
 #include <iostream>
 #include <memory>
 #include <opencv2/opencv.hpp>
+#include <string>
+#include <unistd.h>
 #include <vector>
 #include <VX/vx.h>
 
-template<typename T>
-static std::shared_ptr<T>
-smart_ref (T *ptr)
-{
-  return std::shared_ptr<T> (ptr, [](T *ptr) {
-    vxReleaseReference ((vx_reference *)&ptr);
-  });
-}
-
 static int
 populate_image (vx_image image, const unsigned char *img_data)
 {
   int ret = -1;
 
-  vx_uint32 width = 0;
-  vx_uint32 height = 0;
+  vx_uint32 width = vx::query<vx_uint32> (image, VX_IMAGE_WIDTH);
+  vx_uint32 height = vx::query<vx_uint32> (image, VX_IMAGE_HEIGHT);
   vx_int32 channels = 3;
-  vxQueryImage (image, VX_IMAGE_WIDTH, &width, sizeof (width));
-  vxQueryImage (image, VX_IMAGE_WIDTH, &height, sizeof (height));
 
   vx_imagepatch_addressing_t layout = { width, height, channels,
     static_cast<vx_int32>(width*channels), 0, 0, 0, 0 };
@@ -59,15 +57,30 @@ populate_image (vx_image image, const unsigned char *img_data)
   return ret;
 }
 
+static vx_image
+create_image_from_data (vx_context context, vx_uint32 width, vx_uint32 height,
+    unsigned char *img_data)
+{
+  vx_int32 channels = 3;
+
+  /* The image takes the host buffer as its backing store, no data is
+   * copied. The buffer must outlive the image.
+   */
+  vx_imagepatch_addressing_t layout = { width, height, channels,
+    static_cast<vx_int32>(width*channels), VX_SCALE_UNITY, VX_SCALE_UNITY, 1, 1 };
+  void *ptrs[] = { img_data };
+
+  return vxCreateImageFromHandle (context, VX_DF_IMAGE_RGB, &layout, ptrs,
+      VX_MEMORY_TYPE_HOST);
+}
+
 static int
 show_image (vx_image image)
 {
   int ret = -1;
 
-  vx_uint32 width = 0;
-  vx_uint32 height = 0;
-  vxQueryImage (image, VX_IMAGE_WIDTH, &width, sizeof (width));
-  vxQueryImage (image, VX_IMAGE_WIDTH, &height, sizeof (height));
+  vx_uint32 width = vx::query<vx_uint32> (image, VX_IMAGE_WIDTH);
+  vx_uint32 height = vx::query<vx_uint32> (image, VX_IMAGE_HEIGHT);
 
   const vx_rectangle_t rect = { 0, 0, width, height };
   vx_uint32 plane = 0;
@@ -102,17 +115,48 @@ context_log_callback(vx_context context, vx_reference ref, vx_status status,
 int
 main (int argc, char *argv[])
 {
+  startup_profiler startup;
+  startup_begin (&startup);
+  bool zero_copy = false;
+  bool user_warp = false;
+  const char *cache_dir = NULL;
+  benchmark bench;
+  int opt = 0;
+  while (-1 != (opt = getopt (argc, argv, "zkc:" BENCHMARK_OPTIONS))) {
+    switch (opt) {
+    case 'z':
+      zero_copy = true;
+      break;
+    case 'k':
+      user_warp = true;
+      break;
+    case 'c':
+      cache_dir = optarg;
+      break;
+    default:
+      if (bench.parse_option (opt, optarg)) {
+        break;
+      }
+      std::cerr << "Usage: " << argv[0] << " [-z] [-k] [-c dir] [-b frames|-s seconds] [-w frames] [image] [output]" << std::endl;
+      std::cerr << "\t-z: wrap the decoded image instead of copying it" << std::endl;
+      std::cerr << "\t-k: use the multi-threaded SIMD warp affine user kernel" << std::endl;
+      std::cerr << "\t-c: import the verified graph from the given directory, or export it there" << std::endl;
+      std::cerr << BENCHMARK_USAGE;
+      return -1;
+    }
+  }
+
   const char *filename = "lena.png";
-  if (argc >= 2) {
-    filename = argv[1];
+  if (argc > optind) {
+    filename = argv[optind];
   }
 
   const char *outname = "out.png";
-  if (argc >= 3) {
-    outname = argv[2];
+  if (argc > optind + 1) {
+    outname = argv[optind + 1];
   }
   
-  auto context = smart_ref (vxCreateContext ());
+  auto context = vx::wrap (vxCreateContext ());
 
   vx_status status = vxGetStatus ((vx_reference)context.get ());
   if (VX_SUCCESS != status) {
@@ -120,9 +164,19 @@ main (int argc, char *argv[])
     return -1;
   }
 
+  startup_mark (&startup, "Context creation");
+
   vx_bool reentrant = vx_false_e;
   vxRegisterLogCallback(context.get (), context_log_callback, reentrant);
 
+  if (user_warp) {
+    status = register_warp_affine (context.get ());
+    if (VX_SUCCESS != status) {
+      std::cerr << "vx-training: Unable to register the warp affine kernel: " << status << std::endl;
+      return -1;
+    }
+  }
+
   int width = 0;
   int height = 0;
   int channels = 0;
@@ -132,7 +186,11 @@ main (int argc, char *argv[])
     return -1;
   }
   
-  auto in_image = smart_ref(vxCreateImage(context.get (), width, height, VX_DF_IMAGE_RGB));
+  startup_mark (&startup, "Image load");
+
+  auto in_image = vx::wrap(zero_copy ?
+      create_image_from_data (context.get (), width, height, img_data.get ()) :
+      vxCreateImage(context.get (), width, height, VX_DF_IMAGE_RGB));
 
   status = vxGetStatus ((vx_reference)in_image.get ());
   if (VX_SUCCESS != status) {
@@ -140,12 +198,12 @@ main (int argc, char *argv[])
     return -1;
   }
 
-  if (0 != populate_image (in_image.get (), img_data.get ())) {
+  if (!zero_copy && 0 != populate_image (in_image.get (), img_data.get ())) {
     std::cerr << "vx-training: Unable to populate image" << std::endl;
     return -1;
   }
 
-  auto out_image = smart_ref(vxCreateImage(context.get (), width, height, VX_DF_IMAGE_U8));
+  auto out_image = vx::wrap(vxCreateImage(context.get (), width, height, VX_DF_IMAGE_U8));
 
   status = vxGetStatus ((vx_reference)out_image.get ());
   if (VX_SUCCESS != status) {
@@ -153,48 +211,83 @@ main (int argc, char *argv[])
     return -1;
   }
 
-  auto graph = smart_ref (vxCreateGraph (context.get ()));
+  auto matrix = vx::wrap (vxCreateMatrix(context.get (), VX_TYPE_FLOAT32, 2, 3));
+  vx_enum interpolation = VX_INTERPOLATION_BILINEAR;
 
-  status = vxGetStatus ((vx_reference)graph.get ());
-  if (VX_SUCCESS != status) {
-    std::cerr << "vx-training: Unable to create graph: " << status << std::endl;
-    return -1;
-  }
+  startup_mark (&startup, "Image creation");
 
-  auto intermediate = smart_ref (vxCreateVirtualImage(graph.get (), width, height, VX_DF_IMAGE_U8));
+  /* Bound to the graph, in this order, when it is cached */
+  std::vector<vx_reference> graph_objects = {
+    (vx_reference)in_image.get (), (vx_reference)out_image.get (), (vx_reference)matrix.get ()
+  };
 
-  status = vxGetStatus ((vx_reference)intermediate.get ());
-  if (VX_SUCCESS != status) {
-    std::cerr << "vx-training: Unable to create virtual image: " << status << std::endl;
-    return -1;
+  graph_cache cache (NULL != cache_dir ? cache_dir : "");
+  vx::Graph graph;
+  vx::Image intermediate;
+  std::vector<vx::Node> nodes;
+  if (NULL != cache_dir) {
+    cache.describe ("nodes: channel_extract(R), warp_affine(bilinear)");
+    cache.describe (std::string ("warp: ") + (user_warp ? "user kernel" : "stock"));
+    cache.describe ("input: " + std::to_string (width) + "x" + std::to_string (height) + " RGB");
+    cache.describe ("output: " + std::to_string (width) + "x" + std::to_string (height) + " U8");
+    cache.describe ("matrix: 2x3 F32");
+    graph = vx::wrap (cache.load (context.get (), graph_objects));
   }
 
-  auto matrix = smart_ref (vxCreateMatrix(context.get (), VX_TYPE_FLOAT32, 2, 3));
-  vx_enum interpolation = VX_INTERPOLATION_BILINEAR;
-  
-  std::vector<std::shared_ptr<_vx_node>> nodes = {
-    smart_ref (vxChannelExtractNode (graph.get (), in_image.get (), VX_CHANNEL_R, intermediate.get ())),
-    smart_ref (vxWarpAffineNode (graph.get (), intermediate.get (), matrix.get (), interpolation, out_image.get ()))
-  };
+  if (!cache.hit ()) {
+    graph = vx::wrap (vxCreateGraph (context.get ()));
 
-  for (auto &node: nodes) {
-    status = vxGetStatus ((vx_reference)node.get ());
+    status = vxGetStatus ((vx_reference)graph.get ());
     if (VX_SUCCESS != status) {
-      std::cerr << "vx-training: Unable to create processing node: " << status << std::endl;
+      std::cerr << "vx-training: Unable to create graph: " << status << std::endl;
       return -1;
     }
-  }
 
-  status = vxVerifyGraph (graph.get ());
-  if (VX_SUCCESS != status) {
-    std::cerr << "vx-training: Graph validation failed: " << status << std::endl;
-    return -1;
+    intermediate = vx::wrap (vxCreateVirtualImage(graph.get (), width, height, VX_DF_IMAGE_U8));
+
+    status = vxGetStatus ((vx_reference)intermediate.get ());
+    if (VX_SUCCESS != status) {
+      std::cerr << "vx-training: Unable to create virtual image: " << status << std::endl;
+      return -1;
+    }
+
+    nodes = vx::wrap_all ({
+      vxChannelExtractNode (graph.get (), in_image.get (), VX_CHANNEL_R, intermediate.get ()),
+      user_warp ?
+          warp_affine_node (graph.get (), intermediate.get (), matrix.get (), interpolation, out_image.get ()) :
+          vxWarpAffineNode (graph.get (), intermediate.get (), matrix.get (), interpolation, out_image.get ())
+    });
+
+    for (auto &node: nodes) {
+      status = vxGetStatus ((vx_reference)node.get ());
+      if (VX_SUCCESS != status) {
+        std::cerr << "vx-training: Unable to create processing node: " << status << std::endl;
+        return -1;
+      }
+    }
+
+    startup_mark (&startup, "Graph and node creation");
+
+    status = vxVerifyGraph (graph.get ());
+    if (VX_SUCCESS != status) {
+      std::cerr << "vx-training: Graph validation failed: " << status << std::endl;
+      return -1;
+    }
+
+    startup_mark (&startup, "Graph verification");
+  } else {
+    startup_mark (&startup, "Graph import");
   }
+  double export_ms = 0;
+  bool first_frame = true;
 
-  cv::namedWindow ("Processed image", cv::WINDOW_AUTOSIZE);
+  if (!bench.enabled ()) {
+    cv::namedWindow ("Processed image", cv::WINDOW_AUTOSIZE);
+  }
 
   vx_float32 angle = 0.0;
-  while (-1 == cv::waitKey(30)) {
+  bench.begin ();
+  while (bench.enabled () ? !bench.done () : -1 == cv::waitKey(30)) {
     /*
       Images in OpenVX have the origin of the coordinate system in the
       upper left corner. Images will rotate around the origin. To rotate
@@ -226,6 +319,7 @@ main (int argc, char *argv[])
       {-sin (rad), cos (rad)},
       {-cos (rad)*width/2 + sin (rad)*height/2 + width/2, -cos (rad)*height/2 - sin (rad)*width/2 + height/2},
     };
+    auto start = std::chrono::steady_clock::now ();
     vxCopyMatrix(matrix.get (), mat, VX_WRITE_ONLY, VX_MEMORY_TYPE_HOST);
 
     status = vxProcessGraph (graph.get ());
@@ -233,6 +327,27 @@ main (int argc, char *argv[])
       std::cerr << "vx-training: Error processing the graph: " << status << std::endl;
       return -1;
     }
+    bench.add_frame (std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now () - start).count ());
+
+    if (first_frame) {
+      first_frame = false;
+      startup_mark (&startup, "First frame");
+      startup_report (&startup, "Time to first frame");
+
+      /* Exported once the first frame is out, so it doesn't delay it */
+      if (NULL != cache_dir && !cache.hit ()) {
+        auto export_start = std::chrono::steady_clock::now ();
+        cache.store (context.get (), graph.get (), graph_objects);
+        export_ms = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now () - export_start).count ();
+      }
+    }
+
+    if (bench.enabled ()) {
+      /* Null sink, the output is discarded */
+      continue;
+    }
     
     if (0 != show_image (out_image.get ())) {
       std::cerr << "vx-training: Error displayingoutput image" << std::endl;
@@ -240,7 +355,21 @@ main (int argc, char *argv[])
     }
   }
 
-  cv::destroyAllWindows ();
+  if (NULL != cache_dir) {
+    std::cout << "Graph cache:" << std::endl;
+    std::cout << "\tStart: " << (cache.hit () ? "warm, imported " : "cold, exported ")
+              << cache.path (context.get ()) << std::endl;
+    if (!cache.hit ()) {
+      std::cout << "\tExport: " << export_ms << "ms" << std::endl;
+    }
+    std::cout << "\t---" << std::endl;
+  }
+
+  if (bench.enabled ()) {
+    bench.report ();
+  } else {
+    cv::destroyAllWindows ();
+  }
 
   return 0;
 }
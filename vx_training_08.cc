@@ -15,32 +15,31 @@
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
 
+#include "vx_training_bench.h"
+#include "vx_training_handles.h"
+#include "vx_training_histogram.h"
+#include "vx_training_kernels.h"
+#include "vx_training_perf_export.h"
+#include "vx_training_startup.h"
+
+#include <chrono>
 #include <cmath>
+#include <cstdlib>
 #include <iostream>
 #include <memory>
 #include <opencv2/opencv.hpp>
+#include <unistd.h>
 #include <vector>
 #include <VX/vx.h>
 
-template<typename T>
-static std::shared_ptr<T>
-smart_ref (T *ptr)
-{
-  return std::shared_ptr<T> (ptr, [](T *ptr) {
-    vxReleaseReference ((vx_reference *)&ptr);
-  });
-}
-
 static int
 populate_image (vx_image image, const unsigned char *img_data)
 {
   int ret = -1;
 
-  vx_uint32 width = 0;
-  vx_uint32 height = 0;
+  vx_uint32 width = vx::query<vx_uint32> (image, VX_IMAGE_WIDTH);
+  vx_uint32 height = vx::query<vx_uint32> (image, VX_IMAGE_HEIGHT);
   vx_int32 channels = 3;
-  vxQueryImage (image, VX_IMAGE_WIDTH, &width, sizeof (width));
-  vxQueryImage (image, VX_IMAGE_WIDTH, &height, sizeof (height));
 
   vx_imagepatch_addressing_t layout = { width, height, channels,
     static_cast<vx_int32>(width*channels), 0, 0, 0, 0 };
@@ -59,15 +58,30 @@ populate_image (vx_image image, const unsigned char *img_data)
   return ret;
 }
 
+static vx_image
+create_image_from_data (vx_context context, vx_uint32 width, vx_uint32 height,
+    unsigned char *img_data)
+{
+  vx_int32 channels = 3;
+
+  /* The image takes the host buffer as its backing store, no data is
+   * copied. The buffer must outlive the image.
+   */
+  vx_imagepatch_addressing_t layout = { width, height, channels,
+    static_cast<vx_int32>(width*channels), VX_SCALE_UNITY, VX_SCALE_UNITY, 1, 1 };
+  void *ptrs[] = { img_data };
+
+  return vxCreateImageFromHandle (context, VX_DF_IMAGE_RGB, &layout, ptrs,
+      VX_MEMORY_TYPE_HOST);
+}
+
 static int
 show_image (vx_image image)
 {
   int ret = -1;
 
-  vx_uint32 width = 0;
-  vx_uint32 height = 0;
-  vxQueryImage (image, VX_IMAGE_WIDTH, &width, sizeof (width));
-  vxQueryImage (image, VX_IMAGE_WIDTH, &height, sizeof (height));
+  vx_uint32 width = vx::query<vx_uint32> (image, VX_IMAGE_WIDTH);
+  vx_uint32 height = vx::query<vx_uint32> (image, VX_IMAGE_HEIGHT);
 
   const vx_rectangle_t rect = { 0, 0, width, height };
   vx_uint32 plane = 0;
@@ -99,6 +113,19 @@ context_log_callback(vx_context context, vx_reference ref, vx_status status,
   std::cout << "vx-training [dbg]: " << string << std::endl;
 }
 
+static void
+sample_performance (vx_graph graph, const std::vector<vx::Node> &nodes,
+    latency_stats &graph_stats, std::vector<latency_stats> &node_stats)
+{
+  vx_perf_t perf = vx::query<vx_perf_t> (graph, VX_GRAPH_PERFORMANCE);
+  graph_stats.sample (perf);
+
+  for (size_t i = 0; i < nodes.size (); i++) {
+    perf = vx::query<vx_perf_t> (nodes[i].get (), VX_NODE_PERFORMANCE);
+    node_stats[i].sample (perf);
+  }
+}
+
 static void
 print_performance (const vx_perf_t &perf) {
   std::cout << "\tLast measurement: " << perf.tmp/1000000.0 << "ms" << std::endl;
@@ -114,17 +141,62 @@ print_performance (const vx_perf_t &perf) {
 int
 main (int argc, char *argv[])
 {
+  startup_profiler startup;
+  startup_begin (&startup);
+  bool zero_copy = false;
+  bool user_warp = false;
+  int window = 0;
+  const char *json_path = NULL;
+  const char *csv_path = NULL;
+  benchmark bench;
+  int opt = 0;
+  while (-1 != (opt = getopt (argc, argv, "zp:j:c:k" BENCHMARK_OPTIONS))) {
+    switch (opt) {
+    case 'z':
+      zero_copy = true;
+      break;
+    case 'k':
+      user_warp = true;
+      break;
+    case 'p':
+      window = atoi (optarg);
+      if (window < 1) {
+        std::cerr << "vx-training: The latency window must be at least 1 frame" << std::endl;
+        return -1;
+      }
+      break;
+    case 'j':
+      json_path = optarg;
+      break;
+    case 'c':
+      csv_path = optarg;
+      break;
+    default:
+      if (bench.parse_option (opt, optarg)) {
+        break;
+      }
+      std::cerr << "Usage: " << argv[0] << " [-z] [-k] [-p frames] [-j file] [-c file] [-b frames|-s seconds] [-w frames] [image] [output]" << std::endl;
+      std::cerr << "\t-z: wrap the decoded image instead of copying it" << std::endl;
+      std::cerr << "\t-k: use the multi-threaded SIMD warp affine user kernel" << std::endl;
+      std::cerr << "\t-p: print latency percentiles of the last given amount of frames, every as many frames" << std::endl;
+      std::cerr << "\t-j: write the performance report as JSON to the given file" << std::endl;
+      std::cerr << "\t-c: append the performance report as CSV rows to the given file" << std::endl;
+      std::cerr << BENCHMARK_USAGE;
+      return -1;
+    }
+  }
+
   const char *filename = "lena.png";
-  if (argc >= 2) {
-    filename = argv[1];
+  if (argc > optind) {
+    filename = argv[optind];
   }
 
   const char *outname = "out.png";
-  if (argc >= 3) {
-    outname = argv[2];
+  if (argc > optind + 1) {
+    outname = argv[optind + 1];
   }
   
-  auto context = smart_ref (vxCreateContext ());
+  auto context = vx::wrap (vxCreateContext ());
 
   vx_status status = vxGetStatus ((vx_reference)context.get ());
   if (VX_SUCCESS != status) {
@@ -134,9 +206,19 @@ main (int argc, char *argv[])
 
   vxDirective ((vx_reference)context.get (), VX_DIRECTIVE_ENABLE_PERFORMANCE);
 
+  startup_mark (&startup, "Context creation");
+
   vx_bool reentrant = vx_false_e;
   vxRegisterLogCallback(context.get (), context_log_callback, reentrant);
 
+  if (user_warp) {
+    status = register_warp_affine (context.get ());
+    if (VX_SUCCESS != status) {
+      std::cerr << "vx-training: Unable to register the warp affine kernel: " << status << std::endl;
+      return -1;
+    }
+  }
+
   int width = 0;
   int height = 0;
   int channels = 0;
@@ -146,7 +228,11 @@ main (int argc, char *argv[])
     return -1;
   }
   
-  auto in_image = smart_ref(vxCreateImage(context.get (), width, height, VX_DF_IMAGE_RGB));
+  startup_mark (&startup, "Image load");
+
+  auto in_image = vx::wrap(zero_copy ?
+      create_image_from_data (context.get (), width, height, img_data.get ()) :
+      vxCreateImage(context.get (), width, height, VX_DF_IMAGE_RGB));
 
   status = vxGetStatus ((vx_reference)in_image.get ());
   if (VX_SUCCESS != status) {
@@ -154,12 +240,12 @@ main (int argc, char *argv[])
     return -1;
   }
 
-  if (0 != populate_image (in_image.get (), img_data.get ())) {
+  if (!zero_copy && 0 != populate_image (in_image.get (), img_data.get ())) {
     std::cerr << "vx-training: Unable to populate image" << std::endl;
     return -1;
   }
 
-  auto out_image = smart_ref(vxCreateImage(context.get (), width, height, VX_DF_IMAGE_U8));
+  auto out_image = vx::wrap(vxCreateImage(context.get (), width, height, VX_DF_IMAGE_U8));
 
   status = vxGetStatus ((vx_reference)out_image.get ());
   if (VX_SUCCESS != status) {
@@ -167,7 +253,9 @@ main (int argc, char *argv[])
     return -1;
   }
 
-  auto graph = smart_ref (vxCreateGraph (context.get ()));
+  startup_mark (&startup, "Image creation");
+
+  auto graph = vx::wrap (vxCreateGraph (context.get ()));
 
   status = vxGetStatus ((vx_reference)graph.get ());
   if (VX_SUCCESS != status) {
@@ -175,7 +263,7 @@ main (int argc, char *argv[])
     return -1;
   }
 
-  auto intermediate = smart_ref (vxCreateVirtualImage(graph.get (), width, height, VX_DF_IMAGE_U8));
+  auto intermediate = vx::wrap (vxCreateVirtualImage(graph.get (), width, height, VX_DF_IMAGE_U8));
 
   status = vxGetStatus ((vx_reference)intermediate.get ());
   if (VX_SUCCESS != status) {
@@ -183,21 +271,34 @@ main (int argc, char *argv[])
     return -1;
   }
 
-  auto matrix = smart_ref (vxCreateMatrix(context.get (), VX_TYPE_FLOAT32, 2, 3));
+  auto matrix = vx::wrap (vxCreateMatrix(context.get (), VX_TYPE_FLOAT32, 2, 3));
   vx_enum interpolation = VX_INTERPOLATION_BILINEAR;
   
-  std::vector<std::shared_ptr<_vx_node>> nodes = {
-    smart_ref (vxChannelExtractNode (graph.get (), in_image.get (), VX_CHANNEL_R, intermediate.get ())),
-    smart_ref (vxWarpAffineNode (graph.get (), intermediate.get (), matrix.get (), interpolation, out_image.get ()))
-  };
+  std::vector<vx::Node> nodes = vx::wrap_all ({
+    vxChannelExtractNode (graph.get (), in_image.get (), VX_CHANNEL_R, intermediate.get ()),
+    user_warp ?
+        warp_affine_node (graph.get (), intermediate.get (), matrix.get (), interpolation, out_image.get ()) :
+        vxWarpAffineNode (graph.get (), intermediate.get (), matrix.get (), interpolation, out_image.get ())
+  });
 
-  for (auto &node: nodes) {
-    status = vxGetStatus ((vx_reference)node.get ());
+  /* Nodes can't be queried for their kernel, keep track of it along
+   * with a name to identify them in the reports.
+   */
+  const vx_enum node_kernels[] = { VX_KERNEL_CHANNEL_EXTRACT, user_warp ?
+    user_kernel_enum (context.get (), WARP_AFFINE_NAME) : VX_KERNEL_WARP_AFFINE };
+  const char *node_names[] = { "channel_extract", "warp_affine" };
+
+  for (size_t i = 0; i < nodes.size (); i++) {
+    status = vxGetStatus ((vx_reference)nodes[i].get ());
     if (VX_SUCCESS != status) {
       std::cerr << "vx-training: Unable to create processing node: " << status << std::endl;
       return -1;
     }
+    vxSetReferenceName ((vx_reference)nodes[i].get (), node_names[i]);
   }
+  vxSetReferenceName ((vx_reference)graph.get (), "vx_training_08");
+
+  startup_mark (&startup, "Graph and node creation");
 
   status = vxVerifyGraph (graph.get ());
   if (VX_SUCCESS != status) {
@@ -205,10 +306,19 @@ main (int argc, char *argv[])
     return -1;
   }
 
-  cv::namedWindow ("Processed image", cv::WINDOW_AUTOSIZE);
+  startup_mark (&startup, "Graph verification");
+
+  if (!bench.enabled ()) {
+    cv::namedWindow ("Processed image", cv::WINDOW_AUTOSIZE);
+  }
+
+  latency_stats graph_stats (window);
+  std::vector<latency_stats> node_stats (nodes.size (), latency_stats (window));
 
   vx_float32 angle = 0.0;
-  while (-1 == cv::waitKey(30)) {
+  int frames = 0;
+  bench.begin ();
+  while (bench.enabled () ? !bench.done () : -1 == cv::waitKey(30)) {
     /*
       Images in OpenVX have the origin of the coordinate system in the
       upper left corner. Images will rotate around the origin. To rotate
@@ -240,6 +350,7 @@ main (int argc, char *argv[])
       {-sin (rad), cos (rad)},
       {-cos (rad)*width/2 + sin (rad)*height/2 + width/2, -cos (rad)*height/2 - sin (rad)*width/2 + height/2},
     };
+    auto start = std::chrono::steady_clock::now ();
     vxCopyMatrix(matrix.get (), mat, VX_WRITE_ONLY, VX_MEMORY_TYPE_HOST);
 
     status = vxProcessGraph (graph.get ());
@@ -247,6 +358,31 @@ main (int argc, char *argv[])
       std::cerr << "vx-training: Error processing the graph: " << status << std::endl;
       return -1;
     }
+    bench.add_frame (std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now () - start).count ());
+
+    sample_performance (graph.get (), nodes, graph_stats, node_stats);
+    frames++;
+
+    if (1 == frames) {
+      startup_mark (&startup, "First frame");
+      startup_report (&startup, "Time to first frame");
+    }
+
+    if (window > 0 && 0 == frames % window) {
+      std::cout << "Graph latency (last " << window << " frames):" << std::endl;
+      graph_stats.print_window ();
+      for (size_t i = 0; i < nodes.size (); i++) {
+        std::cout << "Node " << node_names[i] << " latency (last " << window << " frames):" << std::endl;
+        node_stats[i].print_window ();
+      }
+      std::cout << "\t---" << std::endl;
+    }
+
+    if (bench.enabled ()) {
+      /* Null sink, the output is discarded */
+      continue;
+    }
     
     if (0 != show_image (out_image.get ())) {
       std::cerr << "vx-training: Error displayingoutput image" << std::endl;
@@ -254,22 +390,60 @@ main (int argc, char *argv[])
     }
   }
   
-  vx_perf_t perf;
-  vxQueryGraph(graph.get (), VX_GRAPH_PERFORMANCE, &perf, sizeof(perf));
+  vx_perf_t perf = vx::query<vx_perf_t> (graph.get (), VX_GRAPH_PERFORMANCE);
 
   std::cout << "Graph performance:" << std::endl;
   print_performance(perf);
   std::cout << "\t---" << std::endl;
+
+  std::cout << "Graph latency distribution:" << std::endl;
+  graph_stats.print ();
+  std::cout << "\t---" << std::endl;
   
-  for (auto &node: nodes) {
-    vx_perf_t perf;
-    vxQueryNode(node.get (), VX_NODE_PERFORMANCE, &perf, sizeof(perf));
-    std::cout << "Node performance:" << std::endl;
+  for (size_t i = 0; i < nodes.size (); i++) {
+    vx_perf_t perf = vx::query<vx_perf_t> (nodes[i].get (), VX_NODE_PERFORMANCE);
+    std::cout << "Node " << node_names[i] << " performance:" << std::endl;
     print_performance (perf);
     std::cout << "\t---" << std::endl;
+
+    std::cout << "Node " << node_names[i] << " latency distribution:" << std::endl;
+    node_stats[i].print ();
+    std::cout << "\t---" << std::endl;
+  }
+
+  if (json_path || csv_path) {
+    perf_exporter exporter ("vx_training_08");
+    exporter.set ("width", width);
+    exporter.set ("height", height);
+    exporter.set ("input_format", perf_exporter::format_name (VX_DF_IMAGE_RGB));
+    exporter.set ("output_format", perf_exporter::format_name (VX_DF_IMAGE_U8));
+    exporter.set ("interpolation", perf_exporter::interpolation_name (interpolation));
+    exporter.set ("queue_depth", 0);
+    exporter.set ("zero_copy", zero_copy);
+    exporter.set ("user_warp", user_warp);
+    exporter.set ("simd", user_warp ? simd_name (kernels_simd ()) : "");
+
+    exporter.add_graph (graph.get (), &graph_stats);
+    for (size_t i = 0; i < nodes.size (); i++) {
+      exporter.add_node (nodes[i].get (), node_kernels[i], &node_stats[i]);
+    }
+
+    if (json_path && !exporter.write_json (json_path)) {
+      std::cerr << "vx-training: Unable to write performance report to " << json_path << std::endl;
+      return -1;
+    }
+
+    if (csv_path && !exporter.write_csv (csv_path)) {
+      std::cerr << "vx-training: Unable to write performance report to " << csv_path << std::endl;
+      return -1;
+    }
+  }
+
+  if (bench.enabled ()) {
+    bench.report ();
+  } else {
+    cv::destroyAllWindows ();
   }
-  
-  cv::destroyAllWindows ();
 
   return 0;
 }
@@ -9,37 +9,141 @@
  * back to RidgeRun without any encumbrance.
  */
 
+/* Images are decoded by the input source */
 #define STB_IMAGE_IMPLEMENTATION
-#include "stb_image.h"
 
+#include "vx_training_bench.h"
+#include "vx_training_handles.h"
+#include "vx_training_histogram.h"
+#include "vx_training_perf_export.h"
+#include "vx_training_source.h"
+#include "vx_training_startup.h"
+#include "vx_training_trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cmath>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
 #include <iostream>
-#include <memory>
+#include <map>
+#include <mutex>
 #include <opencv2/opencv.hpp>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <utility>
 #include <vector>
 #include <VX/vx_khr_pipelining.h>
 #include <VX/vx.h>
 
 
+/* Lock-free ring buffer for exactly one producer and one consumer
+ * thread. Push and pop never block, they fail if the queue is full or
+ * empty respectively.
+ */
 template<typename T>
-static std::shared_ptr<T>
-smart_ref (T *ptr)
+class spsc_queue
 {
-  return std::shared_ptr<T> (ptr, [](T *ptr) {
-    vxReleaseReference ((vx_reference *)&ptr);
-  });
-}
+public:
+  explicit spsc_queue (size_t capacity) : buffer (capacity + 1), head (0), tail (0) {}
+
+  bool
+  push (const T &value)
+  {
+    size_t t = tail.load (std::memory_order_relaxed);
+    size_t next = (t + 1) % buffer.size ();
+    if (next == head.load (std::memory_order_acquire)) {
+      return false;
+    }
+
+    buffer[t] = value;
+    tail.store (next, std::memory_order_release);
+    return true;
+  }
+
+  bool
+  pop (T &value)
+  {
+    size_t h = head.load (std::memory_order_relaxed);
+    if (h == tail.load (std::memory_order_acquire)) {
+      return false;
+    }
+
+    value = buffer[h];
+    head.store ((h + 1) % buffer.size (), std::memory_order_release);
+    return true;
+  }
+
+private:
+  std::vector<T> buffer;
+  /* Keep the indices in different cache lines to avoid false sharing */
+  alignas(64) std::atomic<size_t> head;
+  alignas(64) std::atomic<size_t> tail;
+};
+
+/* Tells a thread there may be work for it. Take seen() before looking
+ * for work, and wait() with it if there was none: notifications in
+ * between are not lost. When not blocking, wait() just yields and the
+ * thread keeps polling.
+ */
+class wakeup
+{
+public:
+  explicit wakeup (bool blocking) : blocking (blocking), count (0) {}
+
+  unsigned long
+  seen ()
+  {
+    std::lock_guard<std::mutex> lock (mutex);
+    return count;
+  }
+
+  void
+  notify ()
+  {
+    if (!blocking) {
+      return;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock (mutex);
+      count++;
+    }
+    cond.notify_all ();
+  }
+
+  void
+  wait (unsigned long seen)
+  {
+    if (!blocking) {
+      std::this_thread::yield ();
+      return;
+    }
+
+    std::unique_lock<std::mutex> lock (mutex);
+    cond.wait (lock, [&] () { return count != seen; });
+  }
+
+private:
+  const bool blocking;
+  unsigned long count;
+  std::mutex mutex;
+  std::condition_variable cond;
+};
 
 static int
 populate_image (vx_image image, const unsigned char *img_data)
 {
+  trace_scope trace ("populate_image");
   int ret = -1;
 
-  vx_uint32 width = 0;
-  vx_uint32 height = 0;
-  vx_int32 channels = 3;
-  vxQueryImage (image, VX_IMAGE_WIDTH, &width, sizeof (width));
-  vxQueryImage (image, VX_IMAGE_HEIGHT, &height, sizeof (height));
+  vx_uint32 width = vx::query<vx_uint32> (image, VX_IMAGE_WIDTH);
+  vx_uint32 height = vx::query<vx_uint32> (image, VX_IMAGE_HEIGHT);
+  vx_df_image format = vx::query<vx_df_image> (image, VX_IMAGE_FORMAT);
+  vx_int32 channels = VX_DF_IMAGE_U8 == format ? 1 : 3;
 
   vx_imagepatch_addressing_t layout = { width, height, channels,
     static_cast<vx_int32>(width*channels), 0, 0, 0, 0 };
@@ -58,15 +162,31 @@ populate_image (vx_image image, const unsigned char *img_data)
   return ret;
 }
 
+static vx_image
+create_image_from_data (vx_context context, vx_uint32 width, vx_uint32 height,
+    vx_df_image format, unsigned char *img_data)
+{
+  vx_int32 channels = VX_DF_IMAGE_U8 == format ? 1 : 3;
+
+  /* The image takes the host buffer as its backing store, no data is
+   * copied. The buffer must outlive the image.
+   */
+  vx_imagepatch_addressing_t layout = { width, height, channels,
+    static_cast<vx_int32>(width*channels), VX_SCALE_UNITY, VX_SCALE_UNITY, 1, 1 };
+  void *ptrs[] = { img_data };
+
+  return vxCreateImageFromHandle (context, format, &layout, ptrs,
+      VX_MEMORY_TYPE_HOST);
+}
+
 static int
 show_image (vx_image image)
 {
+  trace_scope trace ("show_image");
   int ret = -1;
 
-  vx_uint32 width = 0;
-  vx_uint32 height = 0;
-  vxQueryImage (image, VX_IMAGE_WIDTH, &width, sizeof (width));
-  vxQueryImage (image, VX_IMAGE_HEIGHT, &height, sizeof (height));
+  vx_uint32 width = vx::query<vx_uint32> (image, VX_IMAGE_WIDTH);
+  vx_uint32 height = vx::query<vx_uint32> (image, VX_IMAGE_HEIGHT);
 
   const vx_rectangle_t rect = { 0, 0, width, height };
   vx_uint32 plane = 0;
@@ -99,23 +219,140 @@ context_log_callback(vx_context context, vx_reference ref, vx_status status,
 }
 
 static vx_status
-enqueue_input(vx_graph graph, vx_image image, unsigned char *data)
+prepare_input(vx_image image, unsigned char *data, bool zero_copy)
 {
-  vx_uint32 parameter_in = 0;
+  if (zero_copy) {
+    trace_scope trace ("swap_image_handle");
+    /* Point the image to the new frame instead of copying it */
+    void *ptrs[] = { data };
+    vx_status status = vxSwapImageHandle (image, ptrs, NULL, 1);
+    if (VX_SUCCESS != status) {
+      std::cerr << "vx-training: Unable to swap image handle: " << status << std::endl;
+    }
+    return status;
+  }
 
   if (0 != populate_image (image, data)) {
     return VX_FAILURE;
   }
 
+  return VX_SUCCESS;
+}
+
+static vx_status
+enqueue_prepared_input(vx_graph graph, vx_image image)
+{
+  trace_scope trace ("enqueue_input");
+  vx_uint32 parameter_in = 0;
+
   return vxGraphParameterEnqueueReadyRef(graph, parameter_in,
       (vx_reference*)&image, 1);
 }
 
+/* Frames the graph may still be reading, by input image. With
+ * zero-copy an input points to its frame until the graph is done with
+ * it, so the frame is only released once the input is dequeued. The
+ * map holds every input from the start, so the threaded pipeline only
+ * ever updates values, each from one stage at a time.
+ */
+typedef std::map<vx_image, unsigned char *> held_frames;
+
+/* Fills the input with the next frame of the source. Returns 0 on
+ * success, 1 at the end of the stream and -1 on error.
+ */
+static int
+acquire_input(frame_source &source, vx_image image, bool zero_copy, held_frames &held)
+{
+  unsigned char *data = source.acquire ();
+  if (NULL == data) {
+    return 1;
+  }
+
+  vx_status status = prepare_input (image, data, zero_copy);
+  if (VX_SUCCESS != status || !zero_copy) {
+    /* Copied, or never handed to the graph */
+    source.release (data);
+    return VX_SUCCESS == status ? 0 : -1;
+  }
+
+  held[image] = data;
+  return 0;
+}
+
+static void
+release_input(frame_source &source, vx_image image, held_frames &held)
+{
+  auto frame = held.find (image);
+  if (held.end () != frame) {
+    source.release (frame->second);
+    frame->second = NULL;
+  }
+}
+
+static void
+release_inputs(frame_source &source, held_frames &held)
+{
+  for (auto &frame: held) {
+    source.release (frame.second);
+    frame.second = NULL;
+  }
+}
+
+static vx_status
+enqueue_matrix(vx_graph graph, vx_matrix matrix)
+{
+  vx_uint32 parameter_matrix = 2;
+
+  return vxGraphParameterEnqueueReadyRef(graph, parameter_matrix,
+      (vx_reference*)&matrix, 1);
+}
+
+static vx_status
+dequeue_matrix(vx_graph graph, vx_matrix *matrix)
+{
+  vx_uint32 num_refs;
+  vx_uint32 parameter_matrix = 2;
+
+  *matrix = NULL;
+
+  return vxGraphParameterDequeueDoneRef(graph, parameter_matrix,
+      (vx_reference*)matrix, 1, &num_refs);
+}
+
+/* Enqueues the input along with the matrix to warp it with. Returns 0
+ * if the input was enqueued, 1 at the end of the stream and -1 on
+ * error.
+ */
+static int
+enqueue_input(vx_graph graph, vx_image image, vx_matrix matrix, frame_source &source,
+    bool zero_copy, held_frames &held)
+{
+  int ret = acquire_input (source, image, zero_copy, held);
+  if (0 != ret) {
+    return ret;
+  }
+
+  vx_status status = enqueue_matrix (graph, matrix);
+  if (VX_SUCCESS != status) {
+    std::cerr << "vx-training: Unable to enqueue matrix: " << status << std::endl;
+    return -1;
+  }
+
+  status = enqueue_prepared_input (graph, image);
+  if (VX_SUCCESS != status) {
+    std::cerr << "vx-training: Unable to enqueue input buffer: " << status << std::endl;
+    return -1;
+  }
+
+  return 0;
+}
+
 static vx_status
 dequeue_input(vx_graph graph, vx_image *image)
 {
+  trace_scope trace ("dequeue_input");
   vx_uint32 num_refs;
-  vx_uint32 parameter_in = 1;
+  vx_uint32 parameter_in = 0;
 
   *image = NULL;
 
@@ -126,6 +363,7 @@ dequeue_input(vx_graph graph, vx_image *image)
 static vx_status
 enqueue_output(vx_graph graph, vx_image image)
 {
+  trace_scope trace ("enqueue_output");
   vx_uint32 parameter_out = 1;
 
   return vxGraphParameterEnqueueReadyRef(graph, parameter_out,
@@ -146,258 +384,1121 @@ is_output_available(vx_graph graph)
 static vx_status
 dequeue_output(vx_graph graph, vx_image *image)
 {
+  trace_scope trace ("dequeue_output");
   vx_uint32 num_refs;
   vx_uint32 parameter_out = 1;
-  vx_status status;
 
   *image = NULL;
 
   /* Get output reference and consume new data,
    * waits until a reference is available
    */
-  status = vxGraphParameterDequeueDoneRef(graph, parameter_out,
+  return vxGraphParameterDequeueDoneRef(graph, parameter_out,
       (vx_reference*)image, 1, &num_refs);
-  if (status) {
-    return status;
-  }
+}
+
+/* Application values of the graph events */
+enum {
+  EVENT_INPUT_CONSUMED,
+  EVENT_MATRIX_CONSUMED,
+  EVENT_GRAPH_COMPLETED,
+};
 
-  if(NULL != *image) {
-    status = show_image (*image);
+static bool
+is_done (vx_graph graph, vx_uint32 parameter)
+{
+  vx_uint32 num_refs = 0;
+  vxGraphParameterCheckDoneRef (graph, parameter, &num_refs);
+
+  return num_refs > 0;
+}
+
+/* Sleeps on the event queue of the context until the parameter has a
+ * reference done, so the dequeue that follows doesn't block. Events are
+ * only hints, a stale one just causes another check.
+ */
+static vx_status
+wait_done (vx_graph graph, vx_uint32 parameter)
+{
+  trace_scope trace ("wait_event");
+  vx_context context = vxGetContext ((vx_reference)graph);
+
+  while (!is_done (graph, parameter)) {
+    vx_event_t event;
+    vx_status status = vxWaitEvent (context, &event, vx_false_e);
+    if (VX_SUCCESS != status) {
+      std::cerr << "vx-training: Unable to wait for graph events: " << status << std::endl;
+      return status;
+    }
   }
 
-  return status;
+  return VX_SUCCESS;
 }
 
-int
-main (int argc, char *argv[])
+static double
+elapsed_ms (const std::chrono::steady_clock::time_point &start)
 {
-  const char *filename = "lena.png";
-  if (argc >= 2) {
-    filename = argv[1];
+  return std::chrono::duration<double, std::milli>(
+      std::chrono::steady_clock::now () - start).count ();
+}
+
+static void
+update_matrix (vx_matrix matrix, vx_float32 angle, int width, int height)
+{
+  /*
+    Images in OpenVX have the origin of the coordinate system in the
+    upper left corner. Images will rotate around the origin. To rotate
+    around the center we need to translate the image so that the origin
+    matches the center, rotate, and translate back. In linear algebra,
+    this is achieved by multiplying transformation matrices, were 
+    they are applied from right to left.
+
+        [1 0 w/2] [ cos(a) -sin(a) 0 ] [1 0 -w/2]
+    R = [0 1 h/2] [ sin(a)  sin(a) 0 ] [0 1 -h/2]
+        [0 0   1] [      0       0 1 ] [0 0    1]
+
+        [ cos(a) -sin(a) -cos(a)*w/2 + sin(a)*h/2 + w/2 ]
+    R = [ sin(a)  sin(a) -cos(a)*h/2 - sin(a)*h/2 + h/2 ]
+        [      0       0                              1 ]
+  */
+  vx_float32 rad = angle*M_PI/180.0;
+  /* Rotation only matrix */
+  //vx_float32 mat[3][2] = {
+  //  {cos (rad), sin (rad)},
+  //  {-sin (rad), cos (rad)},
+  //  {0, 0},
+  //};
+
+  /* Translate + rotate + translate back */
+  vx_float32 mat[3][2] = {
+    {cos (rad), sin (rad)},
+    {-sin (rad), cos (rad)},
+    {-cos (rad)*width/2 + sin (rad)*height/2 + width/2, -cos (rad)*height/2 - sin (rad)*width/2 + height/2},
+  };
+  vxCopyMatrix(matrix, mat, VX_WRITE_ONLY, VX_MEMORY_TYPE_HOST);
+}
+
+/* Everything that depends on the queue depth, so the pipeline can be
+ * torn down and rebuilt with a different depth at runtime.
+ */
+struct pipeline {
+  vx::Graph graph;
+  vx::Image intermediate;
+  std::vector<vx::Node> nodes;
+  /* Nodes can't be queried for their kernel, keep track of it along
+   * with a name to identify them in the reports.
+   */
+  std::vector<vx_enum> node_kernels;
+  std::vector<std::string> node_names;
+  vx_enum interpolation;
+  /* Format of the inputs, U8 if the source already extracts the
+   * channel
+   */
+  vx_df_image input_format;
+  std::vector<vx::Image> in_images;
+  std::vector<vx::Image> out_images;
+  /* One warp matrix per frame in flight, enqueued along with the
+   * input, so a new angle never touches a frame being processed
+   */
+  std::vector<vx::Matrix> matrices;
+  /* Wait on graph events instead of blocking in the dequeues or
+   * polling the queues
+   */
+  bool events;
+  latency_stats graph_latency;
+  std::vector<latency_stats> node_latency;
+  /* Startup the graph and the first output are accounted to, if any */
+  startup_profiler *startup = NULL;
+};
+
+/* Samples the graph and node measurements every time an output is
+ * dequeued. If several executions complete between two dequeues only
+ * the last one of each is seen.
+ */
+static void
+sample_performance (pipeline &pipe)
+{
+  vx_perf_t perf = vx::query<vx_perf_t> (pipe.graph.get (), VX_GRAPH_PERFORMANCE);
+  pipe.graph_latency.sample (perf);
+
+  for (size_t i = 0; i < pipe.nodes.size (); i++) {
+    perf = vx::query<vx_perf_t> (pipe.nodes[i].get (), VX_NODE_PERFORMANCE);
+    pipe.node_latency[i].sample (perf);
   }
+}
 
-  const char *outname = "out.png";
-  if (argc >= 3) {
-    outname = argv[2];
+static void
+mark_pipeline_startup (pipeline &pipe, const char *phase)
+{
+  if (NULL != pipe.startup) {
+    startup_mark (pipe.startup, phase);
   }
-  
-  auto context = smart_ref (vxCreateContext ());
+}
 
-  vx_status status = vxGetStatus ((vx_reference)context.get ());
-  if (VX_SUCCESS != status) {
-    std::cerr << "vx-training: Unable to create context:" << status << std::endl;
-    return -1;
+/* Reports the startup once the first output is dequeued */
+static void
+first_output_done (pipeline &pipe)
+{
+  if (NULL != pipe.startup) {
+    startup_mark (pipe.startup, "First frame");
+    startup_report (pipe.startup, "Time to first frame");
+    pipe.startup = NULL;
   }
+}
 
-  vx_bool reentrant = vx_false_e;
-  vxRegisterLogCallback(context.get (), context_log_callback, reentrant);
+/* Average time, in milliseconds, spent per frame in each stage */
+struct stage_times {
+  double ingest = 0;
+  double graph = 0;
+  double display = 0;
+};
 
-  int width = 0;
-  int height = 0;
-  int channels = 0;
-  auto img_data = std::shared_ptr<unsigned char>(stbi_load (filename, &width, &height, &channels, 3), free);
-  if (NULL == img_data) {
-    std::cerr << "vx-training: Unable to load image " << filename << std::endl;
-    return -1;
-  }
+/* With channel_ingest set, the frames come with only the channel the
+ * graph extracts. The channel extract at the head of the graph is
+ * dropped and the inputs are U8 images the warp reads directly. With
+ * events set, the graph reports its consumed inputs and matrices and
+ * its completions on the event queue of the context, which must have
+ * events enabled.
+ */
+static int
+create_pipeline (vx_context context, unsigned char *img_data,
+    int width, int height, int depth, bool zero_copy, bool channel_ingest,
+    bool events, pipeline &pipe)
+{
+  pipe.input_format = channel_ingest ? VX_DF_IMAGE_U8 : VX_DF_IMAGE_RGB;
+  pipe.events = events;
 
-  int num_images = 2;
-  std::vector <std::shared_ptr<_vx_image>> in_images;
-  for (int i= 0; i < num_images; i++) {
-    auto in_image = smart_ref(vxCreateImage(context.get (), width, height, VX_DF_IMAGE_RGB));
-    status = vxGetStatus ((vx_reference)in_image.get ());
+  for (int i= 0; i < depth; i++) {
+    auto in_image = vx::wrap(zero_copy ?
+        create_image_from_data (context, width, height, pipe.input_format, img_data) :
+        vxCreateImage(context, width, height, pipe.input_format));
+    vx_status status = vxGetStatus ((vx_reference)in_image.get ());
     if (VX_SUCCESS != status) {
       std::cerr << "vx-training: Unable to create input image: " << status << std::endl;
       return -1;
     }
     
-    in_images.push_back (in_image);
+    pipe.in_images.push_back (std::move (in_image));
   }
 
-  std::vector <std::shared_ptr<_vx_image>> out_images;
-  for (int i= 0; i < num_images; i++) {
-    auto out_image = smart_ref(vxCreateImage(context.get (), width, height, VX_DF_IMAGE_U8));
-    status = vxGetStatus ((vx_reference)out_image.get ());
+  pipe.out_images = vx::create_images (context, depth, width, height, VX_DF_IMAGE_U8);
+  for (auto &out_image: pipe.out_images) {
+    vx_status status = out_image.status ();
     if (VX_SUCCESS != status) {
-      std::cerr << "vx-training: Unable to create input image: " << status << std::endl;
+      std::cerr << "vx-training: Unable to create output image: " << status << std::endl;
       return -1;
     }
-    
-    out_images.push_back (out_image);
   }
+
+  pipe.matrices = vx::create_matrices (context, depth, VX_TYPE_FLOAT32, 2, 3);
+  for (auto &matrix: pipe.matrices) {
+    vx_status status = matrix.status ();
+    if (VX_SUCCESS != status) {
+      std::cerr << "vx-training: Unable to create matrix: " << status << std::endl;
+      return -1;
+    }
+  }
+  vx_matrix matrix = pipe.matrices[0].get ();
   
-  auto graph = smart_ref (vxCreateGraph (context.get ()));
+  pipe.graph = vx::wrap (vxCreateGraph (context));
 
-  status = vxGetStatus ((vx_reference)graph.get ());
+  vx_status status = vxGetStatus ((vx_reference)pipe.graph.get ());
   if (VX_SUCCESS != status) {
     std::cerr << "vx-training: Unable to create graph: " << status << std::endl;
     return -1;
   }
 
-  auto intermediate = smart_ref (vxCreateVirtualImage(graph.get (), width, height, VX_DF_IMAGE_U8));
+  vx_enum interpolation = VX_INTERPOLATION_BILINEAR;
+  pipe.interpolation = interpolation;
 
-  status = vxGetStatus ((vx_reference)intermediate.get ());
-  if (VX_SUCCESS != status) {
-    std::cerr << "vx-training: Unable to create virtual image: " << status << std::endl;
-    return -1;
-  }
+  if (channel_ingest) {
+    pipe.nodes = vx::wrap_all ({
+      // Input and output images are both parameters of the warp
+      vxWarpAffineNode (pipe.graph.get (), pipe.in_images[0].get (), matrix, interpolation, pipe.out_images[0].get ())
+    });
 
-  auto matrix = smart_ref (vxCreateMatrix(context.get (), VX_TYPE_FLOAT32, 2, 3));
-  vx_enum interpolation = VX_INTERPOLATION_BILINEAR;
-  
-  std::vector<std::shared_ptr<_vx_node>> nodes = {
-    // Input image will now be a parameter
-    smart_ref (vxChannelExtractNode (graph.get (), in_images[0].get (), VX_CHANNEL_R, intermediate.get ())),
-    // Ouput image will now be a parameters
-    smart_ref (vxWarpAffineNode (graph.get (), intermediate.get (), matrix.get (), interpolation, out_images[0].get ()))
-  };
+    pipe.node_kernels = { VX_KERNEL_WARP_AFFINE };
+    pipe.node_names = { "warp_affine" };
+  } else {
+    pipe.intermediate = vx::wrap (vxCreateVirtualImage(pipe.graph.get (), width, height, VX_DF_IMAGE_U8));
+
+    status = vxGetStatus ((vx_reference)pipe.intermediate.get ());
+    if (VX_SUCCESS != status) {
+      std::cerr << "vx-training: Unable to create virtual image: " << status << std::endl;
+      return -1;
+    }
+
+    pipe.nodes = vx::wrap_all ({
+      // Input image will now be a parameter
+      vxChannelExtractNode (pipe.graph.get (), pipe.in_images[0].get (), VX_CHANNEL_R, pipe.intermediate.get ()),
+      // Ouput image will now be a parameters
+      vxWarpAffineNode (pipe.graph.get (), pipe.intermediate.get (), matrix, interpolation, pipe.out_images[0].get ())
+    });
 
-  for (auto &node: nodes) {
-    status = vxGetStatus ((vx_reference)node.get ());
+    pipe.node_kernels = { VX_KERNEL_CHANNEL_EXTRACT, VX_KERNEL_WARP_AFFINE };
+    pipe.node_names = { "channel_extract", "warp_affine" };
+  }
+
+  for (size_t i = 0; i < pipe.nodes.size (); i++) {
+    status = vxGetStatus ((vx_reference)pipe.nodes[i].get ());
     
     if (VX_SUCCESS != status) {
       std::cerr << "vx-training: Unable to create processing node: " << status << std::endl;
       return -1;
     }
+    vxSetReferenceName ((vx_reference)pipe.nodes[i].get (), pipe.node_names[i].c_str ());
+    if (tracer::get ()) {
+      tracer::get ()->trace_node (pipe.nodes[i].get (), pipe.node_names[i]);
+    }
   }
+  vxSetReferenceName ((vx_reference)pipe.graph.get (), "vx_training_09");
+  pipe.node_latency.resize (pipe.nodes.size ());
 
-  vx_parameter parameter = vxGetParameterByIndex(nodes[0].get(), 0);
-  vxAddParameterToGraph(graph.get (), parameter);
+  vx_parameter parameter = vxGetParameterByIndex(pipe.nodes[0].get(), 0);
+  vxAddParameterToGraph(pipe.graph.get (), parameter);
   vxReleaseParameter(&parameter);
 
-  parameter = vxGetParameterByIndex(nodes[1].get(), 3);
-  vxAddParameterToGraph(graph.get (), parameter);
+  parameter = vxGetParameterByIndex(pipe.nodes.back ().get(), 3);
+  vxAddParameterToGraph(pipe.graph.get (), parameter);
   vxReleaseParameter(&parameter);
 
-  vx_image in_refs[] = {
-    in_images[0].get (),
-    in_images[1].get (),
-  };
+  // The matrix is a parameter too, so every frame carries its own
+  parameter = vxGetParameterByIndex(pipe.nodes.back ().get(), 1);
+  vxAddParameterToGraph(pipe.graph.get (), parameter);
+  vxReleaseParameter(&parameter);
 
-  vx_image out_refs[] = {
-    out_images[0].get (),
-    out_images[1].get (),
-  };
+  std::vector<vx_image> in_refs;
+  for (auto &img: pipe.in_images) {
+    in_refs.push_back (img.get ());
+  }
+
+  std::vector<vx_image> out_refs;
+  for (auto &img: pipe.out_images) {
+    out_refs.push_back (img.get ());
+  }
+
+  std::vector<vx_matrix> matrix_refs;
+  for (auto &matrix: pipe.matrices) {
+    matrix_refs.push_back (matrix.get ());
+  }
   
-  std::vector<vx_graph_parameter_queue_params_t> queue_params_list(2);
+  std::vector<vx_graph_parameter_queue_params_t> queue_params_list(3);
   queue_params_list[0].graph_parameter_index = 0;
-  queue_params_list[0].refs_list_size = in_images.size();
-  queue_params_list[0].refs_list = (vx_reference*)&in_refs[0];
+  queue_params_list[0].refs_list_size = in_refs.size();
+  queue_params_list[0].refs_list = (vx_reference*)in_refs.data ();
   queue_params_list[1].graph_parameter_index = 1;
-  queue_params_list[1].refs_list_size = out_images.size();
-  queue_params_list[1].refs_list = (vx_reference*)&out_refs[0];
+  queue_params_list[1].refs_list_size = out_refs.size();
+  queue_params_list[1].refs_list = (vx_reference*)out_refs.data ();
+  queue_params_list[2].graph_parameter_index = 2;
+  queue_params_list[2].refs_list_size = matrix_refs.size();
+  queue_params_list[2].refs_list = (vx_reference*)matrix_refs.data ();
 
-  vxSetGraphScheduleConfig(graph.get (), VX_GRAPH_SCHEDULE_MODE_QUEUE_AUTO,
+  vxSetGraphScheduleConfig(pipe.graph.get (), VX_GRAPH_SCHEDULE_MODE_QUEUE_AUTO,
       queue_params_list.size(), queue_params_list.data());
+
+  /* Events must be registered before the graph is verified */
+  if (events) {
+    vx_reference graph_ref = (vx_reference)pipe.graph.get ();
+    status = vxRegisterEvent (graph_ref, VX_EVENT_GRAPH_PARAMETER_CONSUMED, 0, EVENT_INPUT_CONSUMED);
+    if (VX_SUCCESS == status) {
+      status = vxRegisterEvent (graph_ref, VX_EVENT_GRAPH_PARAMETER_CONSUMED, 2, EVENT_MATRIX_CONSUMED);
+    }
+    if (VX_SUCCESS == status) {
+      status = vxRegisterEvent (graph_ref, VX_EVENT_GRAPH_COMPLETED, 0, EVENT_GRAPH_COMPLETED);
+    }
+    if (VX_SUCCESS != status) {
+      std::cerr << "vx-training: Unable to register graph events: " << status << std::endl;
+      return -1;
+    }
+  }
   
-  status = vxVerifyGraph (graph.get ());
+  mark_pipeline_startup (pipe, "Graph and node creation");
+
+  status = vxVerifyGraph (pipe.graph.get ());
   if (VX_SUCCESS != status) {
     std::cerr << "vx-training: Graph validation failed: " << status << std::endl;
     return -1;
   }
 
-  for (auto &img: in_images) {
-    vx_status status = enqueue_input (graph.get (), img.get (), img_data.get ()); 
-    if (VX_SUCCESS != status) {
-      std::cerr << "vx-training: Unable to enqueue input buffer: " << status << std::endl;
+  mark_pipeline_startup (pipe, "Graph verification");
+
+  return 0;
+}
+
+/* Runs the pipeline for the given amount of frames, or until a key is
+ * pressed if num_frames is negative. If a benchmark is given, nothing
+ * is displayed and the run ends when the benchmark is done. Returns the
+ * number of frames processed, or -1 on error.
+ */
+static int
+run_pipeline (pipeline &pipe, frame_source &source,
+    int width, int height, bool zero_copy, int num_frames, benchmark *bench,
+    vx_float32 &angle, stage_times &times, double &latency_ms)
+{
+  vx_graph graph = pipe.graph.get ();
+  held_frames held;
+  for (auto &img: pipe.in_images) {
+    held[img.get ()] = NULL;
+  }
+
+  /* Frames leave the pipeline in the same order they entered it, so
+   * the enqueue timestamps can be matched with a simple FIFO.
+   */
+  std::deque<std::chrono::steady_clock::time_point> enqueue_times;
+  tracer *trace = tracer::get ();
+  long submitted = 0;
+  long completed = 0;
+
+  double ingest_ms = 0;
+  double display_ms = 0;
+  latency_ms = 0;
+
+  for (size_t i = 0; i < pipe.in_images.size (); i++) {
+    auto start = std::chrono::steady_clock::now ();
+    vx_matrix matrix = pipe.matrices[i].get ();
+    update_matrix (matrix, angle, width, height);
+    angle++;
+
+    int ret = enqueue_input (graph, pipe.in_images[i].get (), matrix, source, zero_copy, held);
+    if (0 > ret) {
       return -1;
+    } else if (0 < ret) {
+      /* The stream is shorter than the pipeline */
+      break;
+    }
+    enqueue_times.push_back (start);
+    if (trace) {
+      trace->frame_begin (submitted);
     }
+    submitted++;
   }
 
-  for (auto &img: out_images) {
-    vx_status status = enqueue_output (graph.get (), img.get ()); 
+  for (auto &img: pipe.out_images) {
+    vx_status status = enqueue_output (graph, img.get ()); 
     if (VX_SUCCESS != status) {
       std::cerr << "vx-training: Unable to enqueue input buffer: " << status << std::endl;
       return -1;
     }
   }
   
-  cv::namedWindow ("Processed image", cv::WINDOW_AUTOSIZE);
-
   vx_image in_image;
   vx_image out_image;
-  vx_float32 angle = 0.0;
-  while (-1 == cv::waitKey(30)) {
-    /*
-      Images in OpenVX have the origin of the coordinate system in the
-      upper left corner. Images will rotate around the origin. To rotate
-      around the center we need to translate the image so that the origin
-      matches the center, rotate, and translate back. In linear algebra,
-      this is achieved by multiplying transformation matrices, were 
-      they are applied from right to left.
-      
-          [1 0 w/2] [ cos(a) -sin(a) 0 ] [1 0 -w/2]
-      R = [0 1 h/2] [ sin(a)  sin(a) 0 ] [0 1 -h/2]
-          [0 0   1] [      0       0 1 ] [0 0    1]
-
-          [ cos(a) -sin(a) -cos(a)*w/2 + sin(a)*h/2 + w/2 ]
-      R = [ sin(a)  sin(a) -cos(a)*h/2 - sin(a)*h/2 + h/2 ]
-    	  [      0       0                              1 ]
-    */
-    vx_float32 rad = angle*M_PI/180.0;
-    angle++;
-    /* Rotation only matrix */
-    //vx_float32 mat[3][2] = {
-    //  {cos (rad), sin (rad)},
-    //  {-sin (rad), cos (rad)},
-    //  {0, 0},
-    //};
-    
-    /* Translate + rotate + translate back */
-    vx_float32 mat[3][2] = {
-      {cos (rad), sin (rad)},
-      {-sin (rad), cos (rad)},
-      {-cos (rad)*width/2 + sin (rad)*height/2 + width/2, -cos (rad)*height/2 - sin (rad)*width/2 + height/2},
-    };
-    vxCopyMatrix(matrix.get (), mat, VX_WRITE_ONLY, VX_MEMORY_TYPE_HOST);
+  vx_matrix matrix;
+  int frames = 0;
+  if (bench) {
+    bench->begin ();
+  }
+  while (frames != num_frames && submitted > completed) {
+    if (bench && bench->done ()) {
+      break;
+    }
+
+    /* Pacing, not display, so it stays out of the stage times */
+    if (!bench && -1 != cv::waitKey(30)) {
+      break;
+    }
     
     /* wait for input to be available, dequeue it -
      * BLOCKs until input can be dequeued
      */
-    vx_status status = dequeue_input(graph.get (), &in_image);
+    vx_status status = pipe.events ? wait_done (graph, 0) : VX_SUCCESS;
+    if (VX_SUCCESS == status) {
+      status = dequeue_input(graph, &in_image);
+    }
     if (VX_SUCCESS != status) {
       std::cerr << "vx-training: Unable to dequeue input buffer: " << status << std::endl;
       return -1;
     }
+    release_input (source, in_image, held);
+
+    /* The matrix of the same frame, free to be rewritten now */
+    status = pipe.events ? wait_done (graph, 2) : VX_SUCCESS;
+    if (VX_SUCCESS == status) {
+      status = dequeue_matrix(graph, &matrix);
+    }
+    if (VX_SUCCESS != status) {
+      std::cerr << "vx-training: Unable to dequeue matrix: " << status << std::endl;
+      return -1;
+    }
 
     /* wait for input to be available, dequeue it -
      * BLOCKs until input can be dequeued
      */
-    status = dequeue_output(graph.get (), &out_image);
+    status = pipe.events ? wait_done (graph, 1) : VX_SUCCESS;
+    if (VX_SUCCESS == status) {
+      status = dequeue_output(graph, &out_image);
+    }
     if (VX_SUCCESS != status) {
       std::cerr << "vx-training: Unable to dequeue output buffer: " << status << std::endl;
       return -1;
     }
+    sample_performance (pipe);
+    first_output_done (pipe);
+    if (trace) {
+      trace->frame_end (completed);
+    }
+    completed++;
+
+    double frame_latency_ms = elapsed_ms (enqueue_times.front ());
+    latency_ms += frame_latency_ms;
+    enqueue_times.pop_front ();
+    frames++;
+    if (bench) {
+      bench->add_frame (frame_latency_ms);
+    }
+
+    auto display_start = std::chrono::steady_clock::now ();
+    if (!bench && 0 != show_image (out_image)) {
+      std::cerr << "vx-training: Error displaying output image" << std::endl;
+      return -1;
+    }
+    display_ms += elapsed_ms (display_start);
 
     /* recycle output */
-    status = enqueue_output(graph.get (), out_image);
+    status = enqueue_output(graph, out_image);
     if (VX_SUCCESS != status) {
       std::cerr << "vx-training: Unable to enqueue input buffer: " << status << std::endl;
       return -1;
     }
 
-    /* recycle input - fill new data and re-enqueue*/
-    status = enqueue_input(graph.get (), in_image, img_data.get ());
-    if (VX_SUCCESS != status) {
-      std::cerr << "vx-training: Unable to enqueue output buffer: " << status << std::endl;
+    /* recycle input - fill new data and re-enqueue, unless the stream
+     * is over, then just let the frames in flight come out
+     */
+    auto ingest_start = std::chrono::steady_clock::now ();
+    update_matrix (matrix, angle, width, height);
+    angle++;
+    int ret = enqueue_input(graph, in_image, matrix, source, zero_copy, held);
+    ingest_ms += elapsed_ms (ingest_start);
+    if (0 > ret) {
       return -1;
+    } else if (0 < ret) {
+      continue;
+    }
+    enqueue_times.push_back (ingest_start);
+    if (trace) {
+      trace->frame_begin (submitted);
     }
+    submitted++;
   }
 
   /*
    * wait until all previous graph executions have completed
    */
-  vxWaitGraph(graph.get ());
+  vxWaitGraph(graph);
 
   /* flush output references, only required
    * if need to consume last few references
    */
-  while (is_output_available(graph.get ())) {
-    dequeue_output(graph.get (), &out_image);
+  while (is_output_available(graph)) {
+    dequeue_output(graph, &out_image);
+    if (trace) {
+      trace->frame_end (completed);
+    }
+    completed++;
+    if (!bench) {
+      show_image (out_image);
+    }
+  }
+  release_inputs (source, held);
+
+  if (frames > 0) {
+    vx_perf_t perf = vx::query<vx_perf_t> (graph, VX_GRAPH_PERFORMANCE);
+
+    times.ingest = ingest_ms / frames;
+    times.display = display_ms / frames;
+    times.graph = perf.avg/1000000.0;
+    latency_ms /= frames;
+  }
+
+  return frames;
+}
+
+/* Same as run_pipeline() but every stage runs on its own thread:
+ *
+ *  ingest:  fills free input images with new frames
+ *  feed:    enqueues ready inputs and recycles the consumed ones
+ *  drain:   dequeues processed outputs and enqueues recycled ones
+ *  sink:    displays the outputs, runs in the calling thread since
+ *           HighGUI must be driven from the main thread
+ *
+ * The stages hand images to each other through lock-free SPSC
+ * queues. The sink only displays the most recent output and recycles
+ * the rest, so a slow display never holds the graph back.
+ */
+static int
+run_pipeline_threaded (pipeline &pipe, frame_source &source,
+    int width, int height, bool zero_copy, benchmark *bench, vx_float32 &angle,
+    double &latency_ms, int &displayed)
+{
+  typedef std::chrono::steady_clock::time_point time_point;
+
+  vx_graph graph = pipe.graph.get ();
+  const size_t depth = pipe.in_images.size ();
+
+  spsc_queue<vx_image> free_inputs (depth);
+  spsc_queue<vx_image> ready_inputs (depth);
+  spsc_queue<vx_image> free_outputs (depth);
+  spsc_queue<vx_image> done_outputs (depth);
+  /* A frame keeps its timestamp until its output is dequeued. Inputs
+   * are released as soon as the graph consumes them, so besides the
+   * depth inputs in flight, up to depth completed outputs may still be
+   * waiting to be dequeued.
+   */
+  spsc_queue<time_point> enqueue_times (2*depth);
+
+  std::atomic<bool> running (true);
+  std::atomic<bool> failed (false);
+  std::atomic<bool> feeding (true);
+  std::atomic<bool> drained (false);
+  std::atomic<bool> exhausted (false);
+  std::atomic<int> enqueued (0);
+  std::atomic<int> dequeued (0);
+  tracer *trace = tracer::get ();
+  /* Only touched by the drain thread until it is joined */
+  double total_latency_ms = 0;
+
+  /* Without events the stages spin, yielding, while idle */
+  wakeup ingest_wakeup (pipe.events);
+  wakeup feed_wakeup (pipe.events);
+  wakeup drain_wakeup (pipe.events);
+  wakeup sink_wakeup (pipe.events);
+  auto stop = [&] () {
+    running = false;
+    for (auto w: { &ingest_wakeup, &feed_wakeup, &drain_wakeup, &sink_wakeup }) {
+      w->notify ();
+    }
+  };
+
+  held_frames held;
+  for (auto &img: pipe.in_images) {
+    held[img.get ()] = NULL;
+    free_inputs.push (img.get ());
+  }
+
+  for (auto &img: pipe.out_images) {
+    free_outputs.push (img.get ());
+  }
+
+  /* The drain thread accounts frames as soon as it starts */
+  if (bench) {
+    bench->begin ();
+  }
+
+  std::thread ingest ([&] () {
+    if (trace) {
+      trace->set_thread_name ("ingest");
+    }
+    while (running) {
+      unsigned long seen = ingest_wakeup.seen ();
+      vx_image image;
+      if (!free_inputs.pop (image)) {
+        ingest_wakeup.wait (seen);
+        continue;
+      }
+
+      int ret = acquire_input (source, image, zero_copy, held);
+      if (0 > ret) {
+        failed = true;
+        stop ();
+        break;
+      } else if (0 < ret) {
+        exhausted = true;
+        feed_wakeup.notify ();
+        break;
+      }
+      ready_inputs.push (image);
+      feed_wakeup.notify ();
+    }
+  });
+
+  std::thread feed ([&] () {
+    size_t in_flight = 0;
+    vx_float32 feed_angle = angle;
+    /* Only this thread touches the matrices */
+    std::vector<vx_matrix> free_matrices;
+    for (auto &matrix: pipe.matrices) {
+      free_matrices.push_back (matrix.get ());
+    }
+    if (trace) {
+      trace->set_thread_name ("feed");
+    }
+    while (running) {
+      unsigned long seen = feed_wakeup.seen ();
+      /* Checked before popping, the ingest thread is done pushing once
+       * it is set.
+       */
+      bool ended = exhausted;
+      vx_image image;
+      if (in_flight < depth && ready_inputs.pop (image)) {
+        vx_matrix matrix = free_matrices.back ();
+        free_matrices.pop_back ();
+        update_matrix (matrix, feed_angle, width, height);
+        feed_angle++;
+
+        if (!enqueue_times.push (std::chrono::steady_clock::now ())) {
+          std::cerr << "vx-training: Too many frames waiting for their output" << std::endl;
+          failed = true;
+          stop ();
+          break;
+        }
+        if (trace) {
+          trace->frame_begin (enqueued);
+        }
+        vx_status status = enqueue_matrix (graph, matrix);
+        if (VX_SUCCESS == status) {
+          status = enqueue_prepared_input (graph, image);
+        }
+        if (VX_SUCCESS != status) {
+          std::cerr << "vx-training: Unable to enqueue input buffer: " << status << std::endl;
+          failed = true;
+          stop ();
+          break;
+        }
+        in_flight++;
+        enqueued++;
+        drain_wakeup.notify ();
+        continue;
+      }
+
+      /* Only block if the graph owns every input, otherwise just
+       * check if any of them is done. With events, never block: the
+       * matrix is consumed by the last node, so once it is done the
+       * input of the same frame is too.
+       */
+      bool done = false;
+      if (in_flight > 0 && (pipe.events || in_flight < depth)) {
+        done = is_done (graph, 0) && (!pipe.events || is_done (graph, 2));
+      }
+
+      if ((!pipe.events && in_flight == depth) || done) {
+        vx_status status = dequeue_input (graph, &image);
+        if (VX_SUCCESS != status) {
+          std::cerr << "vx-training: Unable to dequeue input buffer: " << status << std::endl;
+          failed = true;
+          stop ();
+          break;
+        }
+        vx_matrix matrix;
+        status = dequeue_matrix (graph, &matrix);
+        if (VX_SUCCESS != status) {
+          std::cerr << "vx-training: Unable to dequeue matrix: " << status << std::endl;
+          failed = true;
+          stop ();
+          break;
+        }
+        free_matrices.push_back (matrix);
+
+        in_flight--;
+        release_input (source, image, held);
+        free_inputs.push (image);
+        ingest_wakeup.notify ();
+      } else if (ended && 0 == in_flight) {
+        /* Every frame of the stream went through the graph */
+        stop ();
+      } else {
+        feed_wakeup.wait (seen);
+      }
+    }
+    angle = feed_angle;
+    feeding = false;
+    drain_wakeup.notify ();
+  });
+
+  std::thread drain ([&] () {
+    /* Keep going after a stop request until every enqueued frame is
+     * out, otherwise the graph would be left waiting for outputs.
+     */
+    if (trace) {
+      trace->set_thread_name ("drain");
+    }
+    /* Output buffers currently enqueued to the graph */
+    size_t graph_outputs = 0;
+    while (feeding || dequeued < enqueued) {
+      unsigned long seen = drain_wakeup.seen ();
+      vx_image image;
+      while (free_outputs.pop (image)) {
+        vx_status status = enqueue_output (graph, image);
+        if (VX_SUCCESS != status) {
+          std::cerr << "vx-training: Unable to enqueue output buffer: " << status << std::endl;
+          failed = true;
+          stop ();
+        } else {
+          graph_outputs++;
+        }
+      }
+
+      /* Without an output buffer the graph can't run, so a dequeue
+       * would block until the sink hands one back, which it can only
+       * do through this thread
+       */
+      if (dequeued >= enqueued || 0 == graph_outputs || (pipe.events && !is_done (graph, 1))) {
+        drain_wakeup.wait (seen);
+        continue;
+      }
+
+      vx_status status = dequeue_output (graph, &image);
+      if (VX_SUCCESS != status) {
+        std::cerr << "vx-training: Unable to dequeue output buffer: " << status << std::endl;
+        failed = true;
+        stop ();
+        break;
+      }
+      graph_outputs--;
+
+      sample_performance (pipe);
+      first_output_done (pipe);
+      if (trace) {
+        trace->frame_end (dequeued);
+      }
+
+      time_point start;
+      if (enqueue_times.pop (start)) {
+        double frame_latency_ms = elapsed_ms (start);
+        total_latency_ms += frame_latency_ms;
+        if (bench) {
+          bench->add_frame (frame_latency_ms);
+          if (bench->done ()) {
+            stop ();
+          }
+        }
+      }
+      dequeued++;
+      done_outputs.push (image);
+      sink_wakeup.notify ();
+    }
+    drained = true;
+    sink_wakeup.notify ();
+  });
+
+  /* Wakes the feed and drain threads up as the graph consumes inputs
+   * and matrices and completes executions, until a user event stops it
+   */
+  std::thread events;
+  if (pipe.events) {
+    events = std::thread ([&] () {
+      if (trace) {
+        trace->set_thread_name ("events");
+      }
+      vx_context context = vxGetContext ((vx_reference)graph);
+      vx_event_t event;
+      while (VX_SUCCESS == vxWaitEvent (context, &event, vx_false_e) &&
+          VX_EVENT_USER != event.type) {
+        if (EVENT_GRAPH_COMPLETED == event.app_value) {
+          drain_wakeup.notify ();
+        }
+        feed_wakeup.notify ();
+      }
+    });
+  }
+
+  displayed = 0;
+  while (!drained) {
+    unsigned long seen = sink_wakeup.seen ();
+    vx_image latest = NULL;
+    vx_image image;
+    while (done_outputs.pop (image)) {
+      if (NULL != latest) {
+        free_outputs.push (latest);
+      }
+      latest = image;
+    }
+
+    if (bench) {
+      /* Null sink, just hand the output back */
+      if (NULL != latest) {
+        free_outputs.push (latest);
+        drain_wakeup.notify ();
+      }
+      sink_wakeup.wait (seen);
+      continue;
+    }
+
+    if (NULL != latest) {
+      if (0 != show_image (latest)) {
+        std::cerr << "vx-training: Error displaying output image" << std::endl;
+        failed = true;
+        stop ();
+      }
+      displayed++;
+      free_outputs.push (latest);
+      drain_wakeup.notify ();
+    }
+
+    if (-1 != cv::waitKey (1)) {
+      stop ();
+    }
+  }
+
+  ingest.join ();
+  feed.join ();
+  drain.join ();
+  if (pipe.events) {
+    vxSendUserEvent (vxGetContext ((vx_reference)graph), 0, NULL);
+    events.join ();
+  }
+
+  /*
+   * wait until all previous graph executions have completed
+   */
+  vxWaitGraph (graph);
+  release_inputs (source, held);
+
+  int frames = dequeued;
+  latency_ms = frames > 0 ? total_latency_ms / frames : 0;
+
+  return failed ? -1 : frames;
+}
+
+/* The pipeline needs enough frames in flight to cover the end-to-end
+ * latency of a frame while the slowest stage sets the pace. Anything
+ * above that only adds latency.
+ */
+static int
+auto_depth (const stage_times &times, int max_depth)
+{
+  double total = times.ingest + times.graph + times.display;
+  double slowest = std::max (times.ingest, std::max (times.graph, times.display));
+  if (slowest <= 0) {
+    return 1;
+  }
+
+  int depth = static_cast<int>(std::ceil (total / slowest));
+  return std::min (std::max (depth, 1), max_depth);
+}
+
+int
+main (int argc, char *argv[])
+{
+  startup_profiler startup;
+  startup_begin (&startup);
+  bool zero_copy = false;
+  int depth = 2;
+  bool auto_size = false;
+  bool threaded = false;
+  const char *json_path = NULL;
+  const char *csv_path = NULL;
+  const char *trace_path = NULL;
+  int prefetch = 8;
+  int decoders = 2;
+  bool loop = false;
+  bool channel_ingest = false;
+  bool events = false;
+  benchmark bench;
+  const int max_depth = 16;
+  const int calibration_frames = 30;
+  int opt = 0;
+  while (-1 != (opt = getopt (argc, argv, "zd:tj:c:x:f:n:lge" BENCHMARK_OPTIONS))) {
+    switch (opt) {
+    case 'z':
+      zero_copy = true;
+      break;
+    case 'd':
+      if (std::string ("auto") == optarg) {
+        auto_size = true;
+      } else {
+        depth = atoi (optarg);
+      }
+      if (!auto_size && (depth < 1 || depth > max_depth)) {
+        std::cerr << "vx-training: Queue depth must be between 1 and " << max_depth << std::endl;
+        return -1;
+      }
+      break;
+    case 't':
+      threaded = true;
+      break;
+    case 'j':
+      json_path = optarg;
+      break;
+    case 'c':
+      csv_path = optarg;
+      break;
+    case 'x':
+      trace_path = optarg;
+      break;
+    case 'f':
+      prefetch = atoi (optarg);
+      if (prefetch < 1) {
+        std::cerr << "vx-training: Prefetch depth must be at least 1" << std::endl;
+        return -1;
+      }
+      break;
+    case 'n':
+      decoders = atoi (optarg);
+      if (decoders < 1) {
+        std::cerr << "vx-training: Amount of decoders must be at least 1" << std::endl;
+        return -1;
+      }
+      break;
+    case 'l':
+      loop = true;
+      break;
+    case 'g':
+      channel_ingest = true;
+      break;
+    case 'e':
+      events = true;
+      break;
+    default:
+      if (bench.parse_option (opt, optarg)) {
+        break;
+      }
+      std::cerr << "Usage: " << argv[0] << " [-z] [-d depth|auto] [-t] [-j file] [-c file] [-x file] [-f frames] [-n decoders] [-l] [-g] [-e] [-b frames|-s seconds] [-w frames] [input] [output]" << std::endl;
+      std::cerr << "\t-z: wrap the decoded image instead of copying it" << std::endl;
+      std::cerr << "\t-d: graph parameter queue depth, or \"auto\" to size it from measured stage latencies (default 2)" << std::endl;
+      std::cerr << "\t-t: run ingest, feed, drain and display on separate threads" << std::endl;
+      std::cerr << "\t-j: write the performance report as JSON to the given file" << std::endl;
+      std::cerr << "\t-c: append the performance report as CSV rows to the given file" << std::endl;
+      std::cerr << "\t-x: write a timeline of the run in Chrome trace format to the given file" << std::endl;
+      std::cerr << "\t-f: frames decoded ahead of the graph (default 8)" << std::endl;
+      std::cerr << "\t-n: threads decoding image sequences (default 2)" << std::endl;
+      std::cerr << "\t-l: start the video or image sequence over when it ends" << std::endl;
+      std::cerr << "\t-g: decode only the channel the graph extracts and drop the extract node" << std::endl;
+      std::cerr << "\t-e: wait on graph events instead of blocking in the dequeues or polling" << std::endl;
+      std::cerr << "\tThe input may be an image, a video or an image sequence such as frames/%05d.png" << std::endl;
+      std::cerr << BENCHMARK_USAGE;
+      return -1;
+    }
+  }
+
+  const char *filename = "lena.png";
+  if (argc > optind) {
+    filename = argv[optind];
+  }
+
+  const char *outname = "out.png";
+  if (argc > optind + 1) {
+    outname = argv[optind + 1];
+  }
+  
+  auto context = vx::wrap (vxCreateContext ());
+
+  vx_status status = vxGetStatus ((vx_reference)context.get ());
+  if (VX_SUCCESS != status) {
+    std::cerr << "vx-training: Unable to create context:" << status << std::endl;
+    return -1;
   }
 
-  vx_perf_t perf;
-  vxQueryGraph(graph.get (), VX_GRAPH_PERFORMANCE, &perf, sizeof(perf));
+  startup_mark (&startup, "Context creation");
+
+  vx_bool reentrant = vx_false_e;
+  vxRegisterLogCallback(context.get (), context_log_callback, reentrant);
+
+  vxDirective ((vx_reference)context.get (), VX_DIRECTIVE_ENABLE_PERFORMANCE);
+
+  if (events) {
+    status = vxEnableEvents (context.get ());
+    if (VX_SUCCESS != status) {
+      std::cerr << "vx-training: Unable to enable events: " << status << std::endl;
+      return -1;
+    }
+  }
+
+  frame_source source (prefetch, decoders, loop);
+  if (channel_ingest) {
+    /* The red channel, the one the graph extracts */
+    source.extract (0);
+  }
+  if (zero_copy) {
+    /* The graph reads the frames in place while they are queued */
+    source.keep (auto_size ? max_depth : depth);
+  }
+  if (!source.open (filename)) {
+    return -1;
+  }
+  int width = source.width ();
+  int height = source.height ();
+  /* Zero-copy inputs need some memory to wrap until the first frames
+   * arrive
+   */
+  unsigned char *img_data = source.placeholder ();
+
+  startup_mark (&startup, "Source open");
+
+  benchmark *headless = bench.enabled () ? &bench : NULL;
+  if (!headless) {
+    cv::namedWindow ("Processed image", cv::WINDOW_AUTOSIZE);
+  }
+
+  vx_float32 angle = 0.0;
+  stage_times times;
+  double latency_ms = 0;
+
+  if (auto_size) {
+    /* Measure each stage with a single frame in flight, where they
+     * can't hide behind each other.
+     */
+    pipeline calibration;
+    if (0 != create_pipeline (context.get (), img_data,
+            width, height, 1, zero_copy, channel_ingest, events, calibration)) {
+      return -1;
+    }
+
+    /* Calibrate headless too, but without touching the real benchmark */
+    benchmark calibration_bench;
+    calibration_bench.frames = calibration_frames;
+    calibration_bench.warmup = 0;
+
+    if (calibration_frames != run_pipeline (calibration, source,
+            width, height, zero_copy, calibration_frames,
+            headless ? &calibration_bench : NULL, angle, times, latency_ms)) {
+      std::cerr << "vx-training: Pipeline calibration failed" << std::endl;
+      return -1;
+    }
+
+    depth = auto_depth (times, max_depth);
+
+    std::cout << "Measured stage latencies:" << std::endl;
+    std::cout << "\tIngest: " << times.ingest << "ms" << std::endl;
+    std::cout << "\tGraph: " << times.graph << "ms" << std::endl;
+    std::cout << "\tDisplay: " << times.display << "ms" << std::endl;
+    std::cout << "\t---" << std::endl;
+
+    startup_mark (&startup, "Queue depth calibration");
+  }
+
+  /* Start after the calibration, so only the measured run is traced */
+  if (trace_path) {
+    tracer::start ();
+    tracer::get ()->set_thread_name ("main");
+  }
+
+  pipeline pipe;
+  pipe.startup = &startup;
+  if (0 != create_pipeline (context.get (), img_data,
+          width, height, depth, zero_copy, channel_ingest, events, pipe)) {
+    return -1;
+  }
+
+  auto start = std::chrono::steady_clock::now ();
+  int displayed = 0;
+  int frames = 0;
+  if (threaded) {
+    frames = run_pipeline_threaded (pipe, source, width, height,
+        zero_copy, headless, angle, latency_ms, displayed);
+  } else {
+    frames = run_pipeline (pipe, source, width, height,
+        zero_copy, -1, headless, angle, times, latency_ms);
+    displayed = headless ? 0 : frames;
+  }
+  if (frames < 0) {
+    return -1;
+  }
+  double total_ms = elapsed_ms (start);
+
+  std::cout << "Pipeline:" << std::endl;
+  std::cout << "\tQueue depth: " << depth << (auto_size ? " (auto)" : "") << std::endl;
+  if (auto_size) {
+    double slowest = std::max (times.ingest, std::max (times.graph, times.display));
+    std::cout << "\tExpected throughput: " << 1000.0/slowest << "fps" << std::endl;
+    std::cout << "\tExpected latency: " << depth*slowest << "ms" << std::endl;
+  }
+  std::cout << "\tMeasured throughput: " << frames*1000.0/total_ms << "fps" << std::endl;
+  std::cout << "\tMeasured latency: " << latency_ms << "ms" << std::endl;
+  std::cout << "\tDisplayed frames: " << displayed << "/" << frames << std::endl;
+  std::cout << "\t---" << std::endl;
+
+  vx_graph graph = pipe.graph.get ();
+  vx_perf_t perf = vx::query<vx_perf_t> (graph, VX_GRAPH_PERFORMANCE);
 
   std::cout << "Graph performance:" << std::endl;
   std::cout << "\tLast measurement: " << perf.tmp << std::endl;
@@ -409,12 +1510,16 @@ main (int argc, char *argv[])
   std::cout << "\tSum of durations: " << perf.sum << std::endl;
   std::cout << "\tNumber of measurements: " << perf.num << std::endl;
   std::cout << "\t---" << std::endl;
+
+  std::cout << "Graph latency distribution:" << std::endl;
+  pipe.graph_latency.print ();
+  std::cout << "\t---" << std::endl;
   
-  for (auto &node: nodes) {
-    vx_perf_t perf;
-    vxQueryNode(node.get (), VX_NODE_PERFORMANCE, &perf, sizeof(perf));
+  for (size_t i = 0; i < pipe.nodes.size (); i++) {
+    auto &node = pipe.nodes[i];
+    vx_perf_t perf = vx::query<vx_perf_t> (node.get (), VX_NODE_PERFORMANCE);
 
-    std::cout << "Node performance:" << std::endl;
+    std::cout << "Node " << pipe.node_names[i] << " performance:" << std::endl;
     std::cout << "\tLast measurement: " << perf.tmp << std::endl;
     std::cout << "\tFirst measurement of the set: " << perf.beg << std::endl;
     std::cout << "\tLast measurement of the set: " << perf.end << std::endl;
@@ -424,9 +1529,57 @@ main (int argc, char *argv[])
     std::cout << "\tSum of durations: " << perf.sum << std::endl;
     std::cout << "\tNumber of measurements: " << perf.num << std::endl;
     std::cout << "\t---" << std::endl;
+
+    std::cout << "Node " << pipe.node_names[i] << " latency distribution:" << std::endl;
+    pipe.node_latency[i].print ();
+    std::cout << "\t---" << std::endl;
+  }
+
+  if (json_path || csv_path) {
+    perf_exporter exporter ("vx_training_09");
+    exporter.set ("width", width);
+    exporter.set ("height", height);
+    exporter.set ("input_format", perf_exporter::format_name (pipe.input_format));
+    exporter.set ("output_format", perf_exporter::format_name (VX_DF_IMAGE_U8));
+    exporter.set ("interpolation", perf_exporter::interpolation_name (pipe.interpolation));
+    exporter.set ("queue_depth", depth);
+    exporter.set ("auto_depth", auto_size);
+    exporter.set ("threaded", threaded);
+    exporter.set ("zero_copy", zero_copy);
+    exporter.set ("channel_ingest", channel_ingest);
+    exporter.set ("events", events);
+
+    exporter.add_graph (graph, &pipe.graph_latency);
+    for (size_t i = 0; i < pipe.nodes.size (); i++) {
+      exporter.add_node (pipe.nodes[i].get (), pipe.node_kernels[i], &pipe.node_latency[i]);
+    }
+
+    if (json_path && !exporter.write_json (json_path)) {
+      std::cerr << "vx-training: Unable to write performance report to " << json_path << std::endl;
+      return -1;
+    }
+
+    if (csv_path && !exporter.write_csv (csv_path)) {
+      std::cerr << "vx-training: Unable to write performance report to " << csv_path << std::endl;
+      return -1;
+    }
+  }
+
+  if (trace_path) {
+    if (!tracer::get ()->write (trace_path)) {
+      std::cerr << "vx-training: Unable to write trace to " << trace_path << std::endl;
+      return -1;
+    }
+    tracer::stop ();
+  }
+
+  source.report ();
+
+  if (headless) {
+    bench.report ();
+  } else {
+    cv::destroyAllWindows ();
   }
-  
-  cv::destroyAllWindows ();
 
   return 0;
 }
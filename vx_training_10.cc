@@ -12,34 +12,35 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
+#include "vx_training_batcher.h"
+#include "vx_training_bench.h"
+#include "vx_training_handles.h"
+#include "vx_training_memory.h"
+#include "vx_training_raw.h"
+#include "vx_training_startup.h"
+#include "vx_training_video_sink.h"
+
+#include <chrono>
 #include <cmath>
 #include <iostream>
 #include <memory>
 #include <opencv2/opencv.hpp>
+#include <thread>
+#include <unistd.h>
+#include <utility>
 #include <vector>
 #include <VX/vx_khr_pipelining.h>
 #include <VX/vx.h>
 
 
-template<typename T>
-static std::shared_ptr<T>
-smart_ref (T *ptr)
-{
-  return std::shared_ptr<T> (ptr, [](T *ptr) {
-    vxReleaseReference ((vx_reference *)&ptr);
-  });
-}
-
 static int
 populate_image (vx_image image, const unsigned char *img_data)
 {
   int ret = -1;
 
-  vx_uint32 width = 0;
-  vx_uint32 height = 0;
+  vx_uint32 width = vx::query<vx_uint32> (image, VX_IMAGE_WIDTH);
+  vx_uint32 height = vx::query<vx_uint32> (image, VX_IMAGE_HEIGHT);
   vx_int32 channels = 3;
-  vxQueryImage (image, VX_IMAGE_WIDTH, &width, sizeof (width));
-  vxQueryImage (image, VX_IMAGE_HEIGHT, &height, sizeof (height));
 
   vx_imagepatch_addressing_t layout = { width, height, channels,
     static_cast<vx_int32>(width*channels), 0, 0, 0, 0 };
@@ -58,15 +59,30 @@ populate_image (vx_image image, const unsigned char *img_data)
   return ret;
 }
 
+static vx_image
+create_image_from_data (vx_context context, vx_uint32 width, vx_uint32 height,
+    unsigned char *img_data)
+{
+  vx_int32 channels = 3;
+
+  /* The image takes the host buffer as its backing store, no data is
+   * copied. The buffer must outlive the image.
+   */
+  vx_imagepatch_addressing_t layout = { width, height, channels,
+    static_cast<vx_int32>(width*channels), VX_SCALE_UNITY, VX_SCALE_UNITY, 1, 1 };
+  void *ptrs[] = { img_data };
+
+  return vxCreateImageFromHandle (context, VX_DF_IMAGE_RGB, &layout, ptrs,
+      VX_MEMORY_TYPE_HOST);
+}
+
 static int
 show_image (vx_image image)
 {
   int ret = -1;
 
-  vx_uint32 width = 0;
-  vx_uint32 height = 0;
-  vxQueryImage (image, VX_IMAGE_WIDTH, &width, sizeof (width));
-  vxQueryImage (image, VX_IMAGE_HEIGHT, &height, sizeof (height));
+  vx_uint32 width = vx::query<vx_uint32> (image, VX_IMAGE_WIDTH);
+  vx_uint32 height = vx::query<vx_uint32> (image, VX_IMAGE_HEIGHT);
 
   const vx_rectangle_t rect = { 0, 0, width, height };
   vx_uint32 plane = 0;
@@ -98,139 +114,670 @@ context_log_callback(vx_context context, vx_reference ref, vx_status status,
   std::cout << "vx-training [dbg]: " << string << std::endl;
 }
 
-int
-main (int argc, char *argv[])
+/* Dequeues exactly count references from a graph parameter. A single
+ * dequeue returns whatever is available, so it may take a few calls.
+ */
+static vx_status
+dequeue_all (vx_graph graph, vx_uint32 parameter, vx_image *refs, vx_uint32 count)
 {
-  const char *filename = "lena.png";
-  if (argc >= 2) {
-    filename = argv[1];
+  vx_uint32 total = 0;
+  while (total < count) {
+    vx_uint32 num_refs = 0;
+    vx_status status = vxGraphParameterDequeueDoneRef (graph, parameter,
+        (vx_reference*)&refs[total], count - total, &num_refs);
+    if (VX_SUCCESS != status) {
+      return status;
+    }
+    total += num_refs;
   }
 
-  const char *outname = "out.mp4";
-  if (argc >= 3) {
-    outname = argv[2];
+  return VX_SUCCESS;
+}
+
+/* Enqueues a whole batch and waits for it to be processed. On return
+ * the references in the arrays are the ones dequeued, in the order the
+ * graph released them.
+ */
+static vx_status
+process_batch (vx_graph graph, vx_image *in_refs, vx_image *out_refs, vx_uint32 count)
+{
+  vx_status status = vxGraphParameterEnqueueReadyRef(graph, 1, (vx_reference*)out_refs,
+      count);
+  if (VX_SUCCESS != status) {
+    std::cerr << "vx-training: Unable to enqueue output images: " << status << std::endl;
+    return status;
   }
-  
-  auto context = smart_ref (vxCreateContext ());
 
-  vx_status status = vxGetStatus ((vx_reference)context.get ());
+  status = vxGraphParameterEnqueueReadyRef(graph, 0, (vx_reference*)in_refs, count);
   if (VX_SUCCESS != status) {
-    std::cerr << "vx-training: Unable to create context:" << status << std::endl;
-    return -1;
+    std::cerr << "vx-training: Unable to enqueue input images: " << status << std::endl;
+    return status;
   }
 
-  vx_bool reentrant = vx_false_e;
-  vxRegisterLogCallback(context.get (), context_log_callback, reentrant);
+  status = dequeue_all (graph, 1, out_refs, count);
+  if (VX_SUCCESS != status) {
+    std::cerr << "vx-training: Unable to dequeue output images: " << status << std::endl;
+    return status;
+  }
 
-  int width = 0;
-  int height = 0;
-  int channels = 0;
-  auto img_data = std::shared_ptr<unsigned char>(stbi_load (filename, &width, &height, &channels, 3), free);
-  if (NULL == img_data) {
-    std::cerr << "vx-training: Unable to load image " << filename << std::endl;
+  status = dequeue_all (graph, 0, in_refs, count);
+  if (VX_SUCCESS != status) {
+    std::cerr << "vx-training: Unable to dequeue input images: " << status << std::endl;
+    return status;
+  }
+
+  return VX_SUCCESS;
+}
+
+/* Copies the pixels of one image into another of the same size and
+ * format, wherever the source memory comes from.
+ */
+static int
+copy_image (vx_image src, vx_image dst)
+{
+  vx_uint32 width = vx::query<vx_uint32> (src, VX_IMAGE_WIDTH);
+  vx_uint32 height = vx::query<vx_uint32> (src, VX_IMAGE_HEIGHT);
+
+  const vx_rectangle_t rect = { 0, 0, width, height };
+  vx_map_id map_id = 0;
+  vx_imagepatch_addressing_t addr = VX_IMAGEPATCH_ADDR_INIT;
+  void *ptr = NULL;
+  vx_status status = vxMapImagePatch (src, &rect, 0, &map_id, &addr, &ptr, VX_READ_ONLY,
+      VX_MEMORY_TYPE_HOST, VX_NOGAP_X);
+  if (VX_SUCCESS != status) {
+    std::cerr << "vx-training: Unable to map image for reading: " << status << std::endl;
     return -1;
   }
 
-  const int num_images = 32;
-  std::vector <std::shared_ptr<_vx_image>> in_images;
-  for (int i= 0; i < num_images; i++) {
-    auto in_image = smart_ref(vxCreateImage(context.get (), width, height, VX_DF_IMAGE_RGB));
-    status = vxGetStatus ((vx_reference)in_image.get ());
+  status = vxCopyImagePatch (dst, &rect, 0, &addr, ptr, VX_WRITE_ONLY, VX_MEMORY_TYPE_HOST);
+  vxUnmapImagePatch (src, map_id);
+  if (VX_SUCCESS != status) {
+    std::cerr << "vx-training: Unable to copy data into image: " << status << std::endl;
+    return -1;
+  }
+
+  return 0;
+}
+
+/* A graph that processes a batch of images. Queued batches enqueue
+ * every image on the graph parameters and run the graph once per
+ * image. Replicated batches hold the images in object arrays and
+ * replicate the nodes over them, so a single execution processes the
+ * whole batch and the implementation is free to spread the items
+ * across cores.
+ */
+struct batch_graph {
+  vx::Graph graph;
+  std::vector<vx::Node> nodes;
+  vx::ObjectArray in_array;
+  vx::ObjectArray intermediate_array;
+  vx::ObjectArray out_array;
+  vx::Image intermediate;
+  std::vector<vx::Image> in_images;
+  std::vector<vx::Image> out_images;
+  std::vector<vx_image> in_refs;
+  std::vector<vx_image> out_refs;
+  bool replicated;
+  /* Startup the graph and the first batch are accounted to, if any */
+  startup_profiler *startup = NULL;
+};
+
+static void
+mark_batch_startup (batch_graph &batch, const char *phase)
+{
+  if (NULL != batch.startup) {
+    startup_mark (batch.startup, phase);
+  }
+}
+
+/* Reports the startup once the first batch is out */
+static void
+first_batch_done (batch_graph &batch)
+{
+  if (NULL != batch.startup) {
+    startup_mark (batch.startup, "First batch");
+    startup_report (batch.startup, "Time to first batch");
+    batch.startup = NULL;
+  }
+}
+
+static int
+check_nodes (const batch_graph &batch)
+{
+  for (auto &node: batch.nodes) {
+    vx_status status = vxGetStatus ((vx_reference)node.get ());
     if (VX_SUCCESS != status) {
-      std::cerr << "vx-training: Unable to create input image: " << status << std::endl;
+      std::cerr << "vx-training: Unable to create processing node: " << status << std::endl;
       return -1;
     }
+  }
 
-    if (0 != populate_image (in_image.get (), img_data.get ())) {
-      std::cerr << "vx-training: Unable to fill input image" << std::endl;
-      return -1;
-    }
+  return 0;
+}
 
-    in_images.push_back (in_image);
-  }
+/* Takes over the given inputs and enqueues them all on every run */
+static int
+create_queued_batch (vx_context context, int width, int height, vx_matrix matrix,
+    std::vector<vx::Image> in_images, batch_graph &batch)
+{
+  batch.replicated = false;
+  batch.in_images = std::move (in_images);
 
-  std::vector <std::shared_ptr<_vx_image>> out_images;
-  for (int i= 0; i < num_images; i++) {
-    auto out_image = smart_ref(vxCreateImage(context.get (), width, height, VX_DF_IMAGE_U8));
-    status = vxGetStatus ((vx_reference)out_image.get ());
+  for (size_t i = 0; i < batch.in_images.size (); i++) {
+    auto out_image = vx::wrap(vxCreateImage(context, width, height, VX_DF_IMAGE_U8));
+    vx_status status = vxGetStatus ((vx_reference)out_image.get ());
     if (VX_SUCCESS != status) {
       std::cerr << "vx-training: Unable to create input image: " << status << std::endl;
       return -1;
     }
     
-    out_images.push_back (out_image);
+    batch.out_images.push_back (std::move (out_image));
   }
   
-  auto graph = smart_ref (vxCreateGraph (context.get ()));
+  batch.graph = vx::wrap (vxCreateGraph (context));
 
-  status = vxGetStatus ((vx_reference)graph.get ());
+  vx_status status = vxGetStatus ((vx_reference)batch.graph.get ());
   if (VX_SUCCESS != status) {
     std::cerr << "vx-training: Unable to create graph: " << status << std::endl;
     return -1;
   }
 
-  auto intermediate = smart_ref (vxCreateVirtualImage(graph.get (), width, height, VX_DF_IMAGE_U8));
+  batch.intermediate = vx::wrap (vxCreateVirtualImage(batch.graph.get (), width, height, VX_DF_IMAGE_U8));
 
-  status = vxGetStatus ((vx_reference)intermediate.get ());
+  status = vxGetStatus ((vx_reference)batch.intermediate.get ());
   if (VX_SUCCESS != status) {
     std::cerr << "vx-training: Unable to create virtual image: " << status << std::endl;
     return -1;
   }
 
-  auto matrix = smart_ref (vxCreateMatrix(context.get (), VX_TYPE_FLOAT32, 2, 3));
   vx_enum interpolation = VX_INTERPOLATION_BILINEAR;
   
-  std::vector<std::shared_ptr<_vx_node>> nodes = {
+  batch.nodes = vx::wrap_all ({
     // Input image will now be a parameter
-    smart_ref (vxChannelExtractNode (graph.get (), in_images[0].get (), VX_CHANNEL_R, intermediate.get ())),
+    vxChannelExtractNode (batch.graph.get (), batch.in_images[0].get (), VX_CHANNEL_R, batch.intermediate.get ()),
     // Ouput image will now be a parameters
-    smart_ref (vxWarpAffineNode (graph.get (), intermediate.get (), matrix.get (), interpolation, out_images[0].get ()))
-  };
+    vxWarpAffineNode (batch.graph.get (), batch.intermediate.get (), matrix, interpolation, batch.out_images[0].get ())
+  });
 
-  for (auto &node: nodes) {
-    status = vxGetStatus ((vx_reference)node.get ());
-    
-    if (VX_SUCCESS != status) {
-      std::cerr << "vx-training: Unable to create processing node: " << status << std::endl;
-      return -1;
-    }
+  if (0 != check_nodes (batch)) {
+    return -1;
   }
 
-  vx_parameter parameter = vxGetParameterByIndex(nodes[0].get(), 0);
-  vxAddParameterToGraph(graph.get (), parameter);
+  vx_parameter parameter = vxGetParameterByIndex(batch.nodes[0].get(), 0);
+  vxAddParameterToGraph(batch.graph.get (), parameter);
   vxReleaseParameter(&parameter);
 
-  parameter = vxGetParameterByIndex(nodes[1].get(), 3);
-  vxAddParameterToGraph(graph.get (), parameter);
+  parameter = vxGetParameterByIndex(batch.nodes[1].get(), 3);
+  vxAddParameterToGraph(batch.graph.get (), parameter);
   vxReleaseParameter(&parameter);
 
-  vx_image in_refs[num_images];
-  for (int i=0; i<num_images; ++i) {
-    in_refs[i] = in_images[i].get ();
+  for (auto &image: batch.in_images) {
+    batch.in_refs.push_back (image.get ());
   }
 
-  vx_image out_refs[num_images];
-  for (int i=0; i<num_images; ++i) {
-    out_refs[i] = out_images[i].get ();
+  for (auto &image: batch.out_images) {
+    batch.out_refs.push_back (image.get ());
   }
   
   std::vector<vx_graph_parameter_queue_params_t> queue_params_list(2);
   queue_params_list[0].graph_parameter_index = 0;
-  queue_params_list[0].refs_list_size = in_images.size();
-  queue_params_list[0].refs_list = (vx_reference*)&in_refs[0];
+  queue_params_list[0].refs_list_size = batch.in_refs.size();
+  queue_params_list[0].refs_list = (vx_reference*)batch.in_refs.data ();
   queue_params_list[1].graph_parameter_index = 1;
-  queue_params_list[1].refs_list_size = out_images.size();
-  queue_params_list[1].refs_list = (vx_reference*)&out_refs[0];
+  queue_params_list[1].refs_list_size = batch.out_refs.size();
+  queue_params_list[1].refs_list = (vx_reference*)batch.out_refs.data ();
 
-  vxSetGraphScheduleConfig(graph.get (), VX_GRAPH_SCHEDULE_MODE_QUEUE_AUTO,
+  vxSetGraphScheduleConfig(batch.graph.get (), VX_GRAPH_SCHEDULE_MODE_QUEUE_AUTO,
       queue_params_list.size(), queue_params_list.data());
   
-  status = vxVerifyGraph (graph.get ());
+  mark_batch_startup (batch, "Graph and node creation");
+
+  status = vxVerifyGraph (batch.graph.get ());
   if (VX_SUCCESS != status) {
     std::cerr << "vx-training: Graph validation failed: " << status << std::endl;
     return -1;
   }
 
+  mark_batch_startup (batch, "Graph verification");
+
+  return 0;
+}
+
+/* Object array items are created by the array, so the inputs can't
+ * wrap host memory. Every item is filled with a copy of the source.
+ */
+static int
+create_replicated_batch (vx_context context, int width, int height, int count,
+    vx_matrix matrix, vx_image source, batch_graph &batch)
+{
+  batch.replicated = true;
+
+  auto in_exemplar = vx::wrap (vxCreateImage (context, width, height, VX_DF_IMAGE_RGB));
+  auto out_exemplar = vx::wrap (vxCreateImage (context, width, height, VX_DF_IMAGE_U8));
+  batch.in_array = vx::wrap (vxCreateObjectArray (context, (vx_reference)in_exemplar.get (), count));
+  batch.out_array = vx::wrap (vxCreateObjectArray (context, (vx_reference)out_exemplar.get (), count));
+  for (auto array: { batch.in_array.get (), batch.out_array.get () }) {
+    vx_status status = vxGetStatus ((vx_reference)array);
+    if (VX_SUCCESS != status) {
+      std::cerr << "vx-training: Unable to create object array: " << status << std::endl;
+      return -1;
+    }
+  }
+
+  for (int i = 0; i < count; i++) {
+    auto in_image = vx::wrap ((vx_image)vxGetObjectArrayItem (batch.in_array.get (), i));
+    auto out_image = vx::wrap ((vx_image)vxGetObjectArrayItem (batch.out_array.get (), i));
+    if (0 != copy_image (source, in_image.get ())) {
+      return -1;
+    }
+
+    batch.in_refs.push_back (in_image.get ());
+    batch.out_refs.push_back (out_image.get ());
+    batch.in_images.push_back (std::move (in_image));
+    batch.out_images.push_back (std::move (out_image));
+  }
+
+  batch.graph = vx::wrap (vxCreateGraph (context));
+
+  vx_status status = vxGetStatus ((vx_reference)batch.graph.get ());
+  if (VX_SUCCESS != status) {
+    std::cerr << "vx-training: Unable to create graph: " << status << std::endl;
+    return -1;
+  }
+
+  batch.intermediate_array = vx::wrap (vxCreateVirtualObjectArray (batch.graph.get (),
+      (vx_reference)out_exemplar.get (), count));
+
+  status = vxGetStatus ((vx_reference)batch.intermediate_array.get ());
+  if (VX_SUCCESS != status) {
+    std::cerr << "vx-training: Unable to create virtual object array: " << status << std::endl;
+    return -1;
+  }
+
+  /* The nodes are built on the first item of each array, and then
+   * replicated over the rest
+   */
+  auto intermediate = vx::wrap ((vx_image)vxGetObjectArrayItem (batch.intermediate_array.get (), 0));
+  vx_enum interpolation = VX_INTERPOLATION_BILINEAR;
+
+  batch.nodes = vx::wrap_all ({
+    vxChannelExtractNode (batch.graph.get (), batch.in_refs[0], VX_CHANNEL_R, intermediate.get ()),
+    vxWarpAffineNode (batch.graph.get (), intermediate.get (), matrix, interpolation, batch.out_refs[0])
+  });
+
+  if (0 != check_nodes (batch)) {
+    return -1;
+  }
+
+  /* Images are replicated, the channel, matrix and interpolation are
+   * shared by every item
+   */
+  vx_bool extract_replicate[] = { vx_true_e, vx_false_e, vx_true_e };
+  vx_bool warp_replicate[] = { vx_true_e, vx_false_e, vx_false_e, vx_true_e };
+  status = vxReplicateNode (batch.graph.get (), batch.nodes[0].get (), extract_replicate, 3);
+  if (VX_SUCCESS == status) {
+    status = vxReplicateNode (batch.graph.get (), batch.nodes[1].get (), warp_replicate, 4);
+  }
+  if (VX_SUCCESS != status) {
+    std::cerr << "vx-training: Unable to replicate nodes: " << status << std::endl;
+    return -1;
+  }
+
+  mark_batch_startup (batch, "Graph and node creation");
+
+  status = vxVerifyGraph (batch.graph.get ());
+  if (VX_SUCCESS != status) {
+    std::cerr << "vx-training: Graph validation failed: " << status << std::endl;
+    return -1;
+  }
+
+  mark_batch_startup (batch, "Graph verification");
+
+  return 0;
+}
+
+/* Records the objects of a verified batch. Wrapped inputs are left
+ * out, their memory belongs to the decoded image or the raw file.
+ */
+static void
+account_batch (memory_accounting &memory, const batch_graph &batch, vx_matrix matrix,
+    bool wrapped_inputs)
+{
+  const char *group = batch.replicated ? "replicated batch" : "queued batch";
+  if (batch.replicated) {
+    memory_add_object_array (&memory, group, "inputs", batch.in_array.get (), 0);
+    memory_add_object_array (&memory, group, "intermediates", batch.intermediate_array.get (), 1);
+    memory_add_object_array (&memory, group, "outputs", batch.out_array.get (), 0);
+  } else {
+    if (!wrapped_inputs) {
+      for (auto &image: batch.in_images) {
+        memory_add_image (&memory, group, "input", image.get ());
+      }
+    }
+    memory_add_virtual_image (&memory, group, "intermediate", batch.intermediate.get ());
+    for (auto &image: batch.out_images) {
+      memory_add_image (&memory, group, "output", image.get ());
+    }
+  }
+  memory_add_matrix (&memory, group, "matrix", matrix);
+}
+
+static vx_status
+run_batch (batch_graph &batch)
+{
+  vx_status status = VX_SUCCESS;
+  if (!batch.replicated) {
+    status = process_batch (batch.graph.get (), batch.in_refs.data (), batch.out_refs.data (),
+        batch.in_refs.size ());
+  } else {
+    status = vxProcessGraph (batch.graph.get ());
+    if (VX_SUCCESS != status) {
+      std::cerr << "vx-training: Unable to process the batch: " << status << std::endl;
+    }
+  }
+
+  if (VX_SUCCESS == status) {
+    first_batch_done (batch);
+  }
+
+  return status;
+}
+
+/* Runs the batch until the benchmark is done. Returns the processed
+ * images per second, or a negative value on error.
+ */
+static double
+measure_batch (batch_graph &batch, benchmark bench)
+{
+  bench.begin ();
+  while (!bench.done ()) {
+    auto start = std::chrono::steady_clock::now ();
+    if (VX_SUCCESS != run_batch (batch)) {
+      return -1;
+    }
+
+    double batch_ms = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now () - start).count ();
+    for (size_t i = 0; i < batch.in_refs.size (); i++) {
+      bench.add_frame (batch_ms);
+    }
+  }
+
+  return bench.throughput ();
+}
+
+/* Per image cost of queued and replicated batches of 1 up to max_batch
+ * images
+ */
+static int
+compare_batching (vx_context context, vx_image source, vx_matrix matrix,
+    int width, int height, int max_batch, const benchmark &bench)
+{
+  std::vector<int> batch_sizes;
+  for (int count = 1; count < max_batch; count *= 2) {
+    batch_sizes.push_back (count);
+  }
+  batch_sizes.push_back (max_batch);
+
+  std::cout << "Batching:" << std::endl;
+  for (int count: batch_sizes) {
+    std::vector<vx::Image> in_images;
+    for (int i = 0; i < count; i++) {
+      auto in_image = vx::wrap (vxCreateImage (context, width, height, VX_DF_IMAGE_RGB));
+      if (VX_SUCCESS != vxGetStatus ((vx_reference)in_image.get ()) ||
+          0 != copy_image (source, in_image.get ())) {
+        std::cerr << "vx-training: Unable to create input image" << std::endl;
+        return -1;
+      }
+      in_images.push_back (std::move (in_image));
+    }
+
+    batch_graph queued;
+    batch_graph replicated;
+    if (0 != create_queued_batch (context, width, height, matrix, std::move (in_images), queued) ||
+        0 != create_replicated_batch (context, width, height, count, matrix, source, replicated)) {
+      return -1;
+    }
+
+    double queued_fps = measure_batch (queued, bench);
+    double replicated_fps = measure_batch (replicated, bench);
+    if (queued_fps <= 0 || replicated_fps <= 0) {
+      return -1;
+    }
+
+    std::cout << "\t" << count << " images: queued " << 1000.0/queued_fps << "ms per image, replicated "
+              << 1000.0/replicated_fps << "ms per image, " << replicated_fps/queued_fps << "x" << std::endl;
+  }
+  std::cout << "\t---" << std::endl;
+
+  return 0;
+}
+
+/* Frames arrive at a steady rate and are batched as the batcher
+ * decides, up to the size of the queued batch. Every output is
+ * recorded. Runs until the benchmark is done, sampling the resident
+ * memory as it goes.
+ */
+static int
+run_adaptive (batch_graph &batch, adaptive_batcher &batcher, double arrival_fps,
+    video_sink &sink, benchmark &bench, memory_accounting &memory)
+{
+  typedef adaptive_batcher::clock clock;
+  const auto start = clock::now ();
+  long arrived = 0;
+  long batches = 0;
+  auto arrival = [&] (long frame) {
+    return start + std::chrono::duration_cast<clock::duration>(
+        std::chrono::duration<double>(frame/arrival_fps));
+  };
+
+  bench.begin ();
+  while (!bench.done ()) {
+    auto now = clock::now ();
+    for (; arrival (arrived) <= now; arrived++) {
+      batcher.arrive (arrival (arrived));
+    }
+
+    adaptive_batcher::flush_reason reason;
+    if (!batcher.should_flush (now, reason)) {
+      auto wake = arrival (arrived);
+      if (batcher.waiting () > 0) {
+        wake = std::min (wake, batcher.deadline ());
+      }
+      std::this_thread::sleep_until (wake);
+      continue;
+    }
+
+    auto frames = batcher.take ();
+    vx_uint32 count = frames.size ();
+    if (VX_SUCCESS != process_batch (batch.graph.get (), batch.in_refs.data (), batch.out_refs.data (), count)) {
+      return -1;
+    }
+    first_batch_done (batch);
+
+    auto done = clock::now ();
+    batcher.completed (frames, done, std::chrono::duration<double, std::milli>(done - now).count (), reason);
+    for (auto frame: frames) {
+      bench.add_frame (std::chrono::duration<double, std::milli>(done - frame).count ());
+    }
+    if (0 == ++batches % MEMORY_SAMPLE_PERIOD) {
+      memory_sample (&memory);
+    }
+
+    for (vx_uint32 i = 0; i < count; i++) {
+      if (sink.push (batch.out_refs[i]) < 0) {
+        std::cerr << "vx-training: Unable to record output image" << std::endl;
+        return -1;
+      }
+    }
+  }
+
+  return 0;
+}
+
+int
+main (int argc, char *argv[])
+{
+  startup_profiler startup;
+  startup_begin (&startup);
+  memory_accounting memory;
+  memory_begin (&memory);
+  bool zero_copy = false;
+  int sink_capacity = 64;
+  bool sink_block = false;
+  bool replicate = false;
+  int compare_max = 0;
+  double budget_ms = 0;
+  double arrival_fps = 120;
+  benchmark bench;
+  int opt = 0;
+  while (-1 != (opt = getopt (argc, argv, "zq:Brc:L:a:" BENCHMARK_OPTIONS))) {
+    switch (opt) {
+    case 'z':
+      zero_copy = true;
+      break;
+    case 'q':
+      sink_capacity = atoi (optarg);
+      if (sink_capacity < 1) {
+        std::cerr << "vx-training: The video queue must hold at least 1 frame" << std::endl;
+        return -1;
+      }
+      break;
+    case 'B':
+      sink_block = true;
+      break;
+    case 'r':
+      replicate = true;
+      break;
+    case 'c':
+      compare_max = atoi (optarg);
+      if (compare_max < 1) {
+        std::cerr << "vx-training: Batches must hold at least 1 image" << std::endl;
+        return -1;
+      }
+      break;
+    case 'L':
+      budget_ms = atof (optarg);
+      if (budget_ms <= 0) {
+        std::cerr << "vx-training: Invalid latency budget " << optarg << std::endl;
+        return -1;
+      }
+      break;
+    case 'a':
+      arrival_fps = atof (optarg);
+      if (arrival_fps <= 0) {
+        std::cerr << "vx-training: Invalid arrival rate " << optarg << std::endl;
+        return -1;
+      }
+      break;
+    default:
+      if (bench.parse_option (opt, optarg)) {
+        break;
+      }
+      std::cerr << "Usage: " << argv[0] << " [-z] [-q frames] [-B] [-r] [-c images] [-L ms] [-a fps] [-b frames|-s seconds] [-w frames] [image] [output]" << std::endl;
+      std::cerr << "\t-z: wrap the decoded image instead of copying it" << std::endl;
+      std::cerr << "\t-q: frames the video encoder may fall behind before dropping (default 64)" << std::endl;
+      std::cerr << "\t-B: wait for the video encoder instead of dropping frames" << std::endl;
+      std::cerr << "\t-r: replicate the nodes over the batch and process it in a single execution" << std::endl;
+      std::cerr << "\t-c: compare queued and replicated batches of 1 up to the given images, then exit" << std::endl;
+      std::cerr << "\t-L: batch frames as they arrive, sized to keep the p99 latency within the given budget" << std::endl;
+      std::cerr << "\t-a: arrival rate of the frames in adaptive batching (default 120)" << std::endl;
+      std::cerr << BENCHMARK_USAGE;
+      return -1;
+    }
+  }
+
+  /* Batch sizes vary, which replicated graphs can't do */
+  if (budget_ms > 0 && replicate) {
+    std::cerr << "vx-training: Adaptive batching only works with queued batches" << std::endl;
+    return -1;
+  }
+
+  /* Adaptive batching is a streaming run */
+  if (budget_ms > 0 && !bench.enabled ()) {
+    bench.seconds = 10;
+  }
+
+  const char *filename = "lena.png";
+  if (argc > optind) {
+    filename = argv[optind];
+  }
+
+  const char *outname = "out.mp4";
+  if (argc > optind + 1) {
+    outname = argv[optind + 1];
+  }
+  
+  auto context = vx::wrap (vxCreateContext ());
+
+  vx_status status = vxGetStatus ((vx_reference)context.get ());
+  if (VX_SUCCESS != status) {
+    std::cerr << "vx-training: Unable to create context:" << status << std::endl;
+    return -1;
+  }
+
+  startup_mark (&startup, "Context creation");
+
+  vx_bool reentrant = vx_false_e;
+  vxRegisterLogCallback(context.get (), context_log_callback, reentrant);
+
+  int width = 0;
+  int height = 0;
+  int channels = 0;
+  std::shared_ptr<unsigned char> img_data;
+  /* Closed after the images that wrap it, which are declared later */
+  auto raw = std::shared_ptr<raw_frame>(new raw_frame (), [] (raw_frame *frame) {
+    raw_close (frame);
+    delete frame;
+  });
+
+  if (raw_probe (filename)) {
+    if (0 != raw_open (filename, raw.get ()) || VX_DF_IMAGE_RGB != raw->format) {
+      std::cerr << "vx-training: Unable to load RGB raw image " << filename << std::endl;
+      return -1;
+    }
+    width = raw->width;
+    height = raw->height;
+  } else {
+    img_data = std::shared_ptr<unsigned char>(stbi_load (filename, &width, &height, &channels, 3), free);
+    if (NULL == img_data) {
+      std::cerr << "vx-training: Unable to load image " << filename << std::endl;
+      return -1;
+    }
+  }
+
+  startup_mark (&startup, "Image load");
+
+  const int num_images = 32;
+  /* Replicated batches and the comparison only need the source frame */
+  const int num_inputs = (replicate || compare_max > 0) ? 1 : num_images;
+  std::vector <vx::Image> in_images;
+  for (int i= 0; i < num_inputs; i++) {
+    /* Inputs are only read by the graph, so in zero-copy mode all the
+     * batch entries may safely share the same decoded buffer. Raw
+     * inputs are always wrapped where they are mapped.
+     */
+    auto in_image = vx::wrap(raw->data ?
+        raw_create_image (context.get (), raw.get ()) :
+        zero_copy ?
+        create_image_from_data (context.get (), width, height, img_data.get ()) :
+        vxCreateImage(context.get (), width, height, VX_DF_IMAGE_RGB));
+    status = vxGetStatus ((vx_reference)in_image.get ());
+    if (VX_SUCCESS != status) {
+      std::cerr << "vx-training: Unable to create input image: " << status << std::endl;
+      return -1;
+    }
+
+    if (img_data && !zero_copy && 0 != populate_image (in_image.get (), img_data.get ())) {
+      std::cerr << "vx-training: Unable to fill input image" << std::endl;
+      return -1;
+    }
+
+    in_images.push_back (std::move (in_image));
+  }
+
+  auto matrix = vx::wrap (vxCreateMatrix(context.get (), VX_TYPE_FLOAT32, 2, 3));
+
   /*
     Images in OpenVX have the origin of the coordinate system in the
     upper left corner. Images will rotate around the origin. To rotate
@@ -264,36 +811,118 @@ main (int argc, char *argv[])
   };
   vxCopyMatrix(matrix.get (), mat, VX_WRITE_ONLY, VX_MEMORY_TYPE_HOST);
 
-  status = vxGraphParameterEnqueueReadyRef(graph.get (), 0, (vx_reference*)&in_refs[0],
-      in_images.size ());
-  if (VX_SUCCESS != status) {
-    std::cerr << "vx-training: Unable to enqueue input images: " << status << std::endl;
+  startup_mark (&startup, "Image creation");
+
+  if (compare_max > 0) {
+    /* The images of each run are counted, not the batches */
+    if (!bench.enabled ()) {
+      bench.frames = 256;
+    }
+    return compare_batching (context.get (), in_images[0].get (), matrix.get (), width, height,
+        compare_max, bench);
+  }
+
+  batch_graph batch;
+  batch.startup = &startup;
+  if (0 != (replicate ?
+        create_replicated_batch (context.get (), width, height, num_images, matrix.get (), in_images[0].get (), batch) :
+        create_queued_batch (context.get (), width, height, matrix.get (), std::move (in_images), batch))) {
     return -1;
   }
 
-  vx_uint32 num_refs;
-  status = vxGraphParameterDequeueDoneRef(graph.get (), 1, (vx_reference*)out_refs[0],
-      out_images.size (), &num_refs);
-  if (VX_SUCCESS != status) {
-    std::cerr << "vx-training: Unable to dequeue output images: " << status << std::endl;
+  /* Outputs are encoded on a thread of their own, the batch loop only
+   * pays for a copy of each frame.
+   */
+  video_sink sink (sink_capacity, sink_block);
+  if (!sink.open (outname, width, height, 30)) {
+    std::cerr << "vx-training: Unable to open video file " << outname << std::endl;
     return -1;
   }
 
+  startup_mark (&startup, "Video sink setup");
+
+  if (raw->data) {
+    memory_add_host (&memory, "host", "mapped raw file", raw->map_size);
+  } else {
+    memory_add_host (&memory, "host", "decoded image", static_cast<size_t>(width)*height*3);
+  }
+  account_batch (memory, batch, matrix.get (), !batch.replicated && (zero_copy || raw->data));
+  memory_add_host (&memory, "video sink", "frame pool", static_cast<size_t>(width)*height*sink_capacity);
+  memory_setup_done (&memory);
+
+  auto record_batch = [&] () {
+    for (int i = 0; i < num_images; i++) {
+      if (sink.push (batch.out_refs[i]) < 0) {
+        std::cerr << "vx-training: Unable to record output image" << std::endl;
+        return false;
+      }
+    }
+    return true;
+  };
+
+  adaptive_batcher batcher (num_images, budget_ms, 4*num_images);
+  if (budget_ms > 0) {
+    if (0 != run_adaptive (batch, batcher, arrival_fps, sink, bench, memory)) {
+      return -1;
+    }
+  } else if (bench.enabled ()) {
+    /* Every image in a batch waits for the whole batch */
+    long batches = 0;
+    bench.begin ();
+    while (!bench.done ()) {
+      auto start = std::chrono::steady_clock::now ();
+      status = run_batch (batch);
+      if (VX_SUCCESS != status) {
+        return -1;
+      }
+
+      double batch_ms = std::chrono::duration<double, std::milli>(
+          std::chrono::steady_clock::now () - start).count ();
+      for (int i = 0; i < num_images; i++) {
+        bench.add_frame (batch_ms);
+      }
+      if (0 == ++batches % MEMORY_SAMPLE_PERIOD) {
+        memory_sample (&memory);
+      }
+
+      if (!record_batch ()) {
+        return -1;
+      }
+    }
+  } else {
+    status = run_batch (batch);
+    if (VX_SUCCESS != status) {
+      return -1;
+    }
+
+    if (!record_batch ()) {
+      return -1;
+    }
+  }
+
   /*
    * wait until all previous graph executions have completed
    */
-  vxWaitGraph(graph.get ());
+  vxWaitGraph(batch.graph.get ());
+  memory_sample (&memory);
 
-  std::cout << "Processed " << num_refs << " images in a single batch!" << std::endl;
+  if (bench.enabled ()) {
+    bench.report ();
+    if (budget_ms > 0) {
+      batcher.report ();
+    }
+  } else {
+    std::cout << "Processed " << num_images << " images in a single batch"
+              << (batch.replicated ? " execution!" : "!") << std::endl;
 
-  cv::namedWindow ("Processed image", cv::WINDOW_AUTOSIZE);
-  for (const auto &image: out_images) {
-    show_image (image.get ());
-    cv::waitKey(30);
+    cv::namedWindow ("Processed image", cv::WINDOW_AUTOSIZE);
+    for (const auto &image: batch.out_images) {
+      show_image (image.get ());
+      cv::waitKey(30);
+    }
   }
   
-  vx_perf_t perf;
-  vxQueryGraph(graph.get (), VX_GRAPH_PERFORMANCE, &perf, sizeof(perf));
+  vx_perf_t perf = vx::query<vx_perf_t> (batch.graph.get (), VX_GRAPH_PERFORMANCE);
 
   std::cout << "Graph performance:" << std::endl;
   std::cout << "\tLast measurement: " << perf.tmp << std::endl;
@@ -306,9 +935,8 @@ main (int argc, char *argv[])
   std::cout << "\tNumber of measurements: " << perf.num << std::endl;
   std::cout << "\t---" << std::endl;
   
-  for (auto &node: nodes) {
-    vx_perf_t perf;
-    vxQueryNode(node.get (), VX_NODE_PERFORMANCE, &perf, sizeof(perf));
+  for (auto &node: batch.nodes) {
+    vx_perf_t perf = vx::query<vx_perf_t> (node.get (), VX_NODE_PERFORMANCE);
 
     std::cout << "Node performance:" << std::endl;
     std::cout << "\tLast measurement: " << perf.tmp << std::endl;
@@ -321,8 +949,14 @@ main (int argc, char *argv[])
     std::cout << "\tNumber of measurements: " << perf.num << std::endl;
     std::cout << "\t---" << std::endl;
   }
-  
-  cv::destroyAllWindows ();
+
+  sink.close ();
+  sink.report ();
+  memory_report (&memory);
+
+  if (!bench.enabled ()) {
+    cv::destroyAllWindows ();
+  }
 
   return 0;
 }
@@ -0,0 +1,287 @@
+/* Copyright (C) 2022 RidgeRun, LLC (http://www.ridgerun.com)
+ * All Rights Reserved.
+ *
+ * The contents of this software are proprietary and confidential to RidgeRun,
+ * LLC.  No part of this program may be photocopied, reproduced or translated
+ * into another programming language without prior written consent of
+ * RidgeRun, LLC.  The user is free to modify the source code after obtaining
+ * a software license from RidgeRun.  All source code changes must be provided
+ * back to RidgeRun without any encumbrance.
+ */
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include "vx_training_bench.h"
+#include "vx_training_handles.h"
+#include "vx_training_kernels.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <opencv2/opencv.hpp>
+#include <unistd.h>
+#include <VX/vx.h>
+
+static int
+populate_image (vx_image image, const unsigned char *img_data)
+{
+  int ret = -1;
+
+  vx_uint32 width = vx::query<vx_uint32> (image, VX_IMAGE_WIDTH);
+  vx_uint32 height = vx::query<vx_uint32> (image, VX_IMAGE_HEIGHT);
+  vx_int32 channels = 3;
+
+  vx_imagepatch_addressing_t layout = { width, height, channels,
+    static_cast<vx_int32>(width*channels), 0, 0, 0, 0 };
+
+  const vx_rectangle_t rect = { 0, 0, width, height };
+
+  vx_status status = vxCopyImagePatch (image, &rect, 0, &layout, (void *)img_data,
+      VX_WRITE_ONLY, VX_MEMORY_TYPE_HOST);
+  if (VX_SUCCESS != status) {
+    std::cerr << "vx-training: Unable to copy data into image: " << status << std::endl;
+    ret = -1;
+  } else {
+    ret = 0;
+  }
+
+  return ret;
+}
+
+/* Number of pixels that differ between both images, and by how much */
+static int
+compare_images (vx_image a, vx_image b, long &mismatches, int &max_diff)
+{
+  vx_uint32 width = vx::query<vx_uint32> (a, VX_IMAGE_WIDTH);
+  vx_uint32 height = vx::query<vx_uint32> (a, VX_IMAGE_HEIGHT);
+
+  const vx_rectangle_t rect = { 0, 0, width, height };
+  vx_map_id map_a = 0;
+  vx_map_id map_b = 0;
+  vx_imagepatch_addressing_t addr_a = VX_IMAGEPATCH_ADDR_INIT;
+  vx_imagepatch_addressing_t addr_b = VX_IMAGEPATCH_ADDR_INIT;
+  vx_uint8 *ptr_a = NULL;
+  vx_uint8 *ptr_b = NULL;
+
+  vx_status status = vxMapImagePatch (a, &rect, 0, &map_a, &addr_a, (void **)&ptr_a,
+      VX_READ_ONLY, VX_MEMORY_TYPE_HOST, VX_NOGAP_X);
+  if (VX_SUCCESS != status) {
+    std::cerr << "vx-training: Unable to map image for reading: " << status << std::endl;
+    return -1;
+  }
+
+  status = vxMapImagePatch (b, &rect, 0, &map_b, &addr_b, (void **)&ptr_b,
+      VX_READ_ONLY, VX_MEMORY_TYPE_HOST, VX_NOGAP_X);
+  if (VX_SUCCESS != status) {
+    std::cerr << "vx-training: Unable to map image for reading: " << status << std::endl;
+    vxUnmapImagePatch (a, map_a);
+    return -1;
+  }
+
+  mismatches = 0;
+  max_diff = 0;
+  for (vx_uint32 y = 0; y < height; y++) {
+    for (vx_uint32 x = 0; x < width; x++) {
+      int diff = std::abs (ptr_a[y*addr_a.stride_y + x] - ptr_b[y*addr_b.stride_y + x]);
+      mismatches += diff > 0;
+      max_diff = std::max (max_diff, diff);
+    }
+  }
+
+  vxUnmapImagePatch (b, map_b);
+  vxUnmapImagePatch (a, map_a);
+
+  return 0;
+}
+
+/* Processes the graph until the benchmark is done and reports it */
+static int
+run_graph (vx_graph graph, benchmark bench, const std::string &label)
+{
+  std::cout << label << ":" << std::endl;
+
+  bench.begin ();
+  while (!bench.done ()) {
+    auto start = std::chrono::steady_clock::now ();
+    vx_status status = vxProcessGraph (graph);
+    if (VX_SUCCESS != status) {
+      std::cerr << "vx-training: Error processing the graph: " << status << std::endl;
+      return -1;
+    }
+    bench.add_frame (std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now () - start).count ());
+  }
+  bench.report ();
+
+  return 0;
+}
+
+static void VX_CALLBACK
+context_log_callback(vx_context context, vx_reference ref, vx_status status,
+    const vx_char string[])
+{
+  std::cout << "vx-training [dbg]: " << string << std::endl;
+}
+
+int
+main (int argc, char *argv[])
+{
+  int width = 0;
+  int height = 0;
+  benchmark bench;
+  int opt = 0;
+  while (-1 != (opt = getopt (argc, argv, "r:" BENCHMARK_OPTIONS))) {
+    switch (opt) {
+    case 'r':
+      if (2 != sscanf (optarg, "%dx%d", &width, &height) || width < 1 || height < 1) {
+        std::cerr << "vx-training: Invalid resolution " << optarg << std::endl;
+        return -1;
+      }
+      break;
+    default:
+      if (bench.parse_option (opt, optarg)) {
+        break;
+      }
+      std::cerr << "Usage: " << argv[0] << " [-r WIDTHxHEIGHT] [-b frames|-s seconds] [-w frames] [image]" << std::endl;
+      std::cerr << "\t-r: scale the image to the given resolution before processing it" << std::endl;
+      std::cerr << BENCHMARK_USAGE;
+      return -1;
+    }
+  }
+
+  /* This example is a benchmark on its own */
+  if (!bench.enabled ()) {
+    bench.frames = 200;
+  }
+
+  const char *filename = "lena.png";
+  if (argc > optind) {
+    filename = argv[optind];
+  }
+
+  int img_width = 0;
+  int img_height = 0;
+  int channels = 0;
+  auto img_data = std::shared_ptr<unsigned char>(stbi_load (filename, &img_width, &img_height, &channels, 3), free);
+  if (NULL == img_data) {
+    std::cerr << "vx-training: Unable to load image " << filename << std::endl;
+    return -1;
+  }
+
+  /* Small images fit in cache, where the intermediate buffer is
+   * cheap. Scale them up to see the effect on memory traffic.
+   */
+  cv::Mat rgb (img_height, img_width, CV_8UC3, img_data.get ());
+  if (width > 0) {
+    cv::resize (rgb.clone (), rgb, cv::Size (width, height));
+  }
+  width = rgb.cols;
+  height = rgb.rows;
+
+  auto context = vx::wrap (vxCreateContext ());
+
+  vx_status status = vxGetStatus ((vx_reference)context.get ());
+  if (VX_SUCCESS != status) {
+    std::cerr << "vx-training: Unable to create context:" << status << std::endl;
+    return -1;
+  }
+
+  vx_bool reentrant = vx_false_e;
+  vxRegisterLogCallback(context.get (), context_log_callback, reentrant);
+
+  status = register_channel_gaussian3x3 (context.get ());
+  if (VX_SUCCESS != status) {
+    std::cerr << "vx-training: Unable to register the fused kernel: " << status << std::endl;
+    return -1;
+  }
+
+  auto in_image = vx::wrap (vxCreateImage (context.get (), width, height, VX_DF_IMAGE_RGB));
+  auto chain_out = vx::wrap (vxCreateImage (context.get (), width, height, VX_DF_IMAGE_U8));
+  auto fused_out = vx::wrap (vxCreateImage (context.get (), width, height, VX_DF_IMAGE_U8));
+  for (auto image: { in_image.get (), chain_out.get (), fused_out.get () }) {
+    status = vxGetStatus ((vx_reference)image);
+    if (VX_SUCCESS != status) {
+      std::cerr << "vx-training: Unable to create image: " << status << std::endl;
+      return -1;
+    }
+  }
+
+  if (0 != populate_image (in_image.get (), rgb.data)) {
+    std::cerr << "vx-training: Unable to populate image" << std::endl;
+    return -1;
+  }
+
+  /* Reference: the two node chain from the C examples */
+  auto chain = vx::wrap (vxCreateGraph (context.get ()));
+  auto intermediate = vx::wrap (vxCreateVirtualImage (chain.get (), width, height, VX_DF_IMAGE_U8));
+  auto extract = vx::wrap (vxChannelExtractNode (chain.get (), in_image.get (), VX_CHANNEL_R, intermediate.get ()));
+  auto gaussian = vx::wrap (vxGaussian3x3Node (chain.get (), intermediate.get (), chain_out.get ()));
+
+  /* The fused kernel replicates the borders, do the same so both
+   * outputs can be compared pixel by pixel.
+   */
+  vx_border_t border = { VX_BORDER_REPLICATE };
+  vxSetNodeAttribute (gaussian.get (), VX_NODE_BORDER, &border, sizeof (border));
+
+  auto fused = vx::wrap (vxCreateGraph (context.get ()));
+  auto fused_node = vx::wrap (channel_gaussian3x3_node (fused.get (), in_image.get (), VX_CHANNEL_R, fused_out.get ()));
+
+  for (auto node: { extract.get (), gaussian.get (), fused_node.get () }) {
+    status = vxGetStatus ((vx_reference)node);
+    if (VX_SUCCESS != status) {
+      std::cerr << "vx-training: Unable to create processing node: " << status << std::endl;
+      return -1;
+    }
+  }
+
+  for (auto graph: { chain.get (), fused.get () }) {
+    status = vxVerifyGraph (graph);
+    if (VX_SUCCESS != status) {
+      std::cerr << "vx-training: Graph validation failed: " << status << std::endl;
+      return -1;
+    }
+  }
+
+  std::cout << "Resolution: " << width << "x" << height << std::endl;
+  std::cout << "\t---" << std::endl;
+
+  if (0 != run_graph (chain.get (), bench, "ChannelExtract + Gaussian3x3")) {
+    return -1;
+  }
+
+  /* Run the fused kernel with every instruction set up to the best
+   * one, to see how much comes from fusing and how much from SIMD.
+   */
+  const simd_level best = kernels_simd ();
+  for (int level = SIMD_SCALAR; level <= best; level++) {
+    kernels_simd () = static_cast<simd_level>(level);
+
+    std::string label = std::string ("Fused kernel (") + simd_name (kernels_simd ()) + ")";
+    if (0 != run_graph (fused.get (), bench, label)) {
+      return -1;
+    }
+
+    long mismatches = 0;
+    int max_diff = 0;
+    if (0 != compare_images (chain_out.get (), fused_out.get (), mismatches, max_diff)) {
+      return -1;
+    }
+    std::cout << "\tDifferent pixels: " << mismatches << std::endl;
+    std::cout << "\tMaximum difference: " << max_diff << std::endl;
+    std::cout << "\t---" << std::endl;
+  }
+
+  /* The chain writes the intermediate image and reads it back, the
+   * fused kernel only touches the input and the output.
+   */
+  double pixels = static_cast<double>(width)*height;
+  std::cout << "Estimated memory traffic per frame:" << std::endl;
+  std::cout << "\tChain: " << 6*pixels/1e6 << "MB" << std::endl;
+  std::cout << "\tFused: " << 4*pixels/1e6 << "MB" << std::endl;
+  std::cout << "\t---" << std::endl;
+
+  return 0;
+}
@@ -0,0 +1,562 @@
+/* Copyright (C) 2022 RidgeRun, LLC (http://www.ridgerun.com)
+ * All Rights Reserved.
+ *
+ * The contents of this software are proprietary and confidential to RidgeRun,
+ * LLC.  No part of this program may be photocopied, reproduced or translated
+ * into another programming language without prior written consent of
+ * RidgeRun, LLC.  The user is free to modify the source code after obtaining
+ * a software license from RidgeRun.  All source code changes must be provided
+ * back to RidgeRun without any encumbrance.
+ */
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include "vx_training_bench.h"
+#include "vx_training_handles.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <linux/perf_event.h>
+#include <memory>
+#include <opencv2/opencv.hpp>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+#include <VX/vx.h>
+
+static int
+populate_image (vx_image image, const unsigned char *img_data)
+{
+  int ret = -1;
+
+  vx_uint32 width = vx::query<vx_uint32> (image, VX_IMAGE_WIDTH);
+  vx_uint32 height = vx::query<vx_uint32> (image, VX_IMAGE_HEIGHT);
+  vx_int32 channels = 3;
+
+  vx_imagepatch_addressing_t layout = { width, height, channels,
+    static_cast<vx_int32>(width*channels), 0, 0, 0, 0 };
+
+  const vx_rectangle_t rect = { 0, 0, width, height };
+
+  vx_status status = vxCopyImagePatch (image, &rect, 0, &layout, (void *)img_data,
+      VX_WRITE_ONLY, VX_MEMORY_TYPE_HOST);
+  if (VX_SUCCESS != status) {
+    std::cerr << "vx-training: Unable to copy data into image: " << status << std::endl;
+    ret = -1;
+  } else {
+    ret = 0;
+  }
+
+  return ret;
+}
+
+/* Counts last level cache misses of the whole process, including the
+ * threads of the OpenVX implementation, as a proxy of DRAM traffic.
+ * Not available in every system, e.g. in containers or VMs.
+ */
+class llc_counter
+{
+public:
+  llc_counter () : fd (-1)
+  {
+    struct perf_event_attr attr;
+    memset (&attr, 0, sizeof (attr));
+    attr.size = sizeof (attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    fd = syscall (__NR_perf_event_open, &attr, 0, -1, -1, 0);
+  }
+
+  ~llc_counter ()
+  {
+    if (fd >= 0) {
+      close (fd);
+    }
+  }
+
+  bool
+  available () const
+  {
+    return fd >= 0;
+  }
+
+  void
+  start ()
+  {
+    if (available ()) {
+      ioctl (fd, PERF_EVENT_IOC_RESET, 0);
+      ioctl (fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+  }
+
+  /* Bytes brought from memory since start() */
+  double
+  stop ()
+  {
+    long long misses = 0;
+    if (available ()) {
+      ioctl (fd, PERF_EVENT_IOC_DISABLE, 0);
+      if (sizeof (misses) != read (fd, &misses, sizeof (misses))) {
+        misses = 0;
+      }
+    }
+    return misses*64.0;
+  }
+
+private:
+  int fd;
+};
+
+/* The chain of example 06 rotates the image around its center. The
+ * matrix maps output coordinates to input coordinates:
+ *
+ *   x0 = m[0][0]*x + m[1][0]*y + m[2][0]
+ *   y0 = m[0][1]*x + m[1][1]*y + m[2][1]
+ */
+static void
+rotation_matrix (vx_float32 degrees, int width, int height, vx_float32 mat[3][2])
+{
+  vx_float32 rad = degrees*M_PI/180.0;
+  vx_float32 c = cos (rad);
+  vx_float32 s = sin (rad);
+  vx_float32 cx = width/2.0;
+  vx_float32 cy = height/2.0;
+
+  mat[0][0] = c;
+  mat[0][1] = s;
+  mat[1][0] = -s;
+  mat[1][1] = c;
+  mat[2][0] = cx - c*cx + s*cy;
+  mat[2][1] = cy - s*cx - c*cy;
+}
+
+/* Input region the warp reads to produce the given output region. The
+ * margin covers the bilinear neighbours and the halo of the Gaussian,
+ * so the border handling at the edges of the region never kicks in
+ * for pixels that are actually used.
+ */
+static vx_rectangle_t
+source_footprint (const vx_rectangle_t &out, const vx_float32 mat[3][2], int width, int height)
+{
+  const int margin = 2;
+  float min_x = INFINITY;
+  float min_y = INFINITY;
+  float max_x = -INFINITY;
+  float max_y = -INFINITY;
+
+  vx_uint32 xs[] = { out.start_x, out.end_x };
+  vx_uint32 ys[] = { out.start_y, out.end_y };
+  for (vx_uint32 x: xs) {
+    for (vx_uint32 y: ys) {
+      float x0 = mat[0][0]*x + mat[1][0]*y + mat[2][0];
+      float y0 = mat[0][1]*x + mat[1][1]*y + mat[2][1];
+      min_x = std::min (min_x, x0);
+      min_y = std::min (min_y, y0);
+      max_x = std::max (max_x, x0);
+      max_y = std::max (max_y, y0);
+    }
+  }
+
+  /* Tiles that map completely outside of the input still need a
+   * valid region, every pixel will take the constant border anyway.
+   */
+  auto clamp = [] (float v, int low, int high) {
+    return static_cast<vx_uint32>(std::min (std::max (static_cast<int>(v), low), high));
+  };
+  vx_rectangle_t rect;
+  rect.start_x = clamp (std::floor (min_x) - margin, 0, width - 2);
+  rect.start_y = clamp (std::floor (min_y) - margin, 0, height - 2);
+  rect.end_x = std::max (clamp (std::ceil (max_x) + margin, 0, width), rect.start_x + 2);
+  rect.end_y = std::max (clamp (std::ceil (max_y) + margin, 0, height), rect.start_y + 2);
+
+  return rect;
+}
+
+/* Largest tile whose working set fits in half of the L2, leaving the
+ * rest for the implementation. The working set is the RGB footprint,
+ * the two U8 intermediates of the same size and the output tile.
+ */
+static int
+tile_size_for_cache (const vx_float32 mat[3][2], long l2_bytes)
+{
+  int tile = 16;
+  for (int next = 32; next <= 1024; next *= 2) {
+    double span_x = next*(std::fabs (mat[0][0]) + std::fabs (mat[1][0])) + 4;
+    double span_y = next*(std::fabs (mat[0][1]) + std::fabs (mat[1][1])) + 4;
+    double bytes = 5*span_x*span_y + static_cast<double>(next)*next;
+    if (bytes > l2_bytes/2) {
+      break;
+    }
+    tile = next;
+  }
+  return tile;
+}
+
+static long
+l2_cache_size ()
+{
+  long size = sysconf (_SC_LEVEL2_CACHE_SIZE);
+  return size > 0 ? size : 1024*1024;
+}
+
+/* Every graph and object of a configuration, released together */
+struct chain {
+  std::vector<vx::Graph> graphs;
+  std::vector<vx::Reference> refs;
+};
+
+/* ChannelExtract -> Gaussian3x3 -> WarpAffine from the input region to
+ * the output region. Both regions are ROIs of the full images, the
+ * intermediates are virtual and only as large as the input region.
+ */
+static int
+add_chain (vx_context context, vx_image input, vx_image output, const vx_rectangle_t &in_rect,
+    const vx_rectangle_t &out_rect, const vx_float32 mat[3][2], chain &c)
+{
+  vx_uint32 width = in_rect.end_x - in_rect.start_x;
+  vx_uint32 height = in_rect.end_y - in_rect.start_y;
+
+  auto graph = vx::wrap (vxCreateGraph (context));
+  vx_status status = vxGetStatus ((vx_reference)graph.get ());
+  if (VX_SUCCESS != status) {
+    std::cerr << "vx-training: Unable to create graph: " << status << std::endl;
+    return -1;
+  }
+
+  vx_image in_roi = vxCreateImageFromROI (input, &in_rect);
+  vx_image out_roi = vxCreateImageFromROI (output, &out_rect);
+  vx_image intermediates[] = {
+    vxCreateVirtualImage (graph.get (), width, height, VX_DF_IMAGE_U8),
+    vxCreateVirtualImage (graph.get (), width, height, VX_DF_IMAGE_U8),
+  };
+
+  /* Move the origin of the matrix to the corners of both regions */
+  vx_float32 local[3][2];
+  memcpy (local, mat, sizeof (local));
+  local[2][0] += mat[0][0]*out_rect.start_x + mat[1][0]*out_rect.start_y - in_rect.start_x;
+  local[2][1] += mat[0][1]*out_rect.start_x + mat[1][1]*out_rect.start_y - in_rect.start_y;
+
+  vx_matrix matrix = vxCreateMatrix (context, VX_TYPE_FLOAT32, 2, 3);
+  vxCopyMatrix (matrix, local, VX_WRITE_ONLY, VX_MEMORY_TYPE_HOST);
+
+  vx_node nodes[] = {
+    vxChannelExtractNode (graph.get (), in_roi, VX_CHANNEL_R, intermediates[0]),
+    vxGaussian3x3Node (graph.get (), intermediates[0], intermediates[1]),
+    vxWarpAffineNode (graph.get (), intermediates[1], matrix, VX_INTERPOLATION_BILINEAR, out_roi),
+  };
+
+  vx_reference refs[] = { (vx_reference)in_roi, (vx_reference)out_roi,
+    (vx_reference)intermediates[0], (vx_reference)intermediates[1], (vx_reference)matrix,
+    (vx_reference)nodes[0], (vx_reference)nodes[1], (vx_reference)nodes[2] };
+  for (auto ref: refs) {
+    c.refs.push_back (vx::wrap (ref));
+    status = vxGetStatus (ref);
+    if (VX_SUCCESS != status) {
+      std::cerr << "vx-training: Unable to create graph object: " << status << std::endl;
+      return -1;
+    }
+  }
+
+  /* Same borders in both modes, so the outputs match */
+  vx_border_t replicate = { VX_BORDER_REPLICATE };
+  vx_border_t constant = { VX_BORDER_CONSTANT };
+  vxSetNodeAttribute (nodes[1], VX_NODE_BORDER, &replicate, sizeof (replicate));
+  vxSetNodeAttribute (nodes[2], VX_NODE_BORDER, &constant, sizeof (constant));
+
+  status = vxVerifyGraph (graph.get ());
+  if (VX_SUCCESS != status) {
+    std::cerr << "vx-training: Graph validation failed: " << status << std::endl;
+    return -1;
+  }
+
+  c.graphs.push_back (std::move (graph));
+  return 0;
+}
+
+static int
+create_untiled (vx_context context, vx_image input, vx_image output,
+    const vx_float32 mat[3][2], int width, int height, chain &c)
+{
+  const vx_rectangle_t rect = { 0, 0, static_cast<vx_uint32>(width), static_cast<vx_uint32>(height) };
+  return add_chain (context, input, output, rect, rect, mat, c);
+}
+
+/* One graph per output tile. The matrix is fixed, so the footprint of
+ * every tile is computed once, when the graphs are built.
+ */
+static int
+create_tiled (vx_context context, vx_image input, vx_image output,
+    const vx_float32 mat[3][2], int width, int height, int tile, chain &c)
+{
+  for (int y = 0; y < height; y += tile) {
+    for (int x = 0; x < width; x += tile) {
+      vx_rectangle_t out_rect;
+      out_rect.start_x = x;
+      out_rect.start_y = y;
+      out_rect.end_x = std::min (x + tile, width);
+      out_rect.end_y = std::min (y + tile, height);
+
+      vx_rectangle_t in_rect = source_footprint (out_rect, mat, width, height);
+      if (0 != add_chain (context, input, output, in_rect, out_rect, mat, c)) {
+        return -1;
+      }
+    }
+  }
+  return 0;
+}
+
+/* Processes every graph of the chain per frame until the benchmark is
+ * done, and reports throughput and memory traffic.
+ */
+static int
+run_chain (chain &c, benchmark bench, const std::string &label, double pixels)
+{
+  auto process = [&c] () {
+    for (auto &graph: c.graphs) {
+      vx_status status = vxProcessGraph (graph.get ());
+      if (VX_SUCCESS != status) {
+        std::cerr << "vx-training: Error processing the graph: " << status << std::endl;
+        return false;
+      }
+    }
+    return true;
+  };
+
+  /* Warm up outside of the counters */
+  for (int i = 0; i < bench.warmup; i++) {
+    if (!process ()) {
+      return -1;
+    }
+  }
+  bench.warmup = 0;
+
+  std::cout << label << ":" << std::endl;
+  std::cout << "\tGraphs per frame: " << c.graphs.size () << std::endl;
+
+  llc_counter counter;
+  counter.start ();
+  bench.begin ();
+  int frames = 0;
+  while (!bench.done ()) {
+    auto start = std::chrono::steady_clock::now ();
+    if (!process ()) {
+      return -1;
+    }
+    bench.add_frame (std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now () - start).count ());
+    frames++;
+  }
+  double bytes = counter.stop ();
+  double fps = bench.throughput ();
+
+  if (counter.available () && frames > 0) {
+    std::cout << "\tMemory traffic: " << bytes/frames/1e6 << "MB/frame ("
+              << bytes/frames/pixels << " bytes/pixel)" << std::endl;
+    std::cout << "\tMemory bandwidth: " << bytes/frames*fps/1e9 << "GB/s" << std::endl;
+  } else {
+    std::cout << "\tMemory traffic: unavailable, cache miss counters can't be opened" << std::endl;
+  }
+  bench.report ();
+
+  return 0;
+}
+
+/* Number of pixels that differ between both images, and by how much */
+static int
+compare_images (vx_image a, vx_image b, long &mismatches, int &max_diff)
+{
+  vx_uint32 width = vx::query<vx_uint32> (a, VX_IMAGE_WIDTH);
+  vx_uint32 height = vx::query<vx_uint32> (a, VX_IMAGE_HEIGHT);
+
+  const vx_rectangle_t rect = { 0, 0, width, height };
+  vx_map_id map_a = 0;
+  vx_map_id map_b = 0;
+  vx_imagepatch_addressing_t addr_a = VX_IMAGEPATCH_ADDR_INIT;
+  vx_imagepatch_addressing_t addr_b = VX_IMAGEPATCH_ADDR_INIT;
+  vx_uint8 *ptr_a = NULL;
+  vx_uint8 *ptr_b = NULL;
+
+  vx_status status = vxMapImagePatch (a, &rect, 0, &map_a, &addr_a, (void **)&ptr_a,
+      VX_READ_ONLY, VX_MEMORY_TYPE_HOST, VX_NOGAP_X);
+  if (VX_SUCCESS != status) {
+    std::cerr << "vx-training: Unable to map image for reading: " << status << std::endl;
+    return -1;
+  }
+
+  status = vxMapImagePatch (b, &rect, 0, &map_b, &addr_b, (void **)&ptr_b,
+      VX_READ_ONLY, VX_MEMORY_TYPE_HOST, VX_NOGAP_X);
+  if (VX_SUCCESS != status) {
+    std::cerr << "vx-training: Unable to map image for reading: " << status << std::endl;
+    vxUnmapImagePatch (a, map_a);
+    return -1;
+  }
+
+  mismatches = 0;
+  max_diff = 0;
+  for (vx_uint32 y = 0; y < height; y++) {
+    for (vx_uint32 x = 0; x < width; x++) {
+      int diff = std::abs (ptr_a[y*addr_a.stride_y + x] - ptr_b[y*addr_b.stride_y + x]);
+      mismatches += diff > 0;
+      max_diff = std::max (max_diff, diff);
+    }
+  }
+
+  vxUnmapImagePatch (b, map_b);
+  vxUnmapImagePatch (a, map_a);
+
+  return 0;
+}
+
+static void VX_CALLBACK
+context_log_callback(vx_context context, vx_reference ref, vx_status status,
+    const vx_char string[])
+{
+  std::cout << "vx-training [dbg]: " << string << std::endl;
+}
+
+int
+main (int argc, char *argv[])
+{
+  std::vector<cv::Size> resolutions;
+  int tile = 0;
+  benchmark bench;
+  int opt = 0;
+  while (-1 != (opt = getopt (argc, argv, "r:t:" BENCHMARK_OPTIONS))) {
+    int width = 0;
+    int height = 0;
+    switch (opt) {
+    case 'r':
+      if (2 != sscanf (optarg, "%dx%d", &width, &height) || width < 2 || height < 2) {
+        std::cerr << "vx-training: Invalid resolution " << optarg << std::endl;
+        return -1;
+      }
+      resolutions.push_back (cv::Size (width, height));
+      break;
+    case 't':
+      tile = atoi (optarg);
+      if (tile < 16) {
+        std::cerr << "vx-training: Tile size must be at least 16" << std::endl;
+        return -1;
+      }
+      break;
+    default:
+      if (bench.parse_option (opt, optarg)) {
+        break;
+      }
+      std::cerr << "Usage: " << argv[0] << " [-r WIDTHxHEIGHT]... [-t size] [-b frames|-s seconds] [-w frames] [image]" << std::endl;
+      std::cerr << "\t-r: resolution to test, may be repeated (default 1080p, 4K and 8K)" << std::endl;
+      std::cerr << "\t-t: tile size in pixels (default sized from the L2 cache)" << std::endl;
+      std::cerr << BENCHMARK_USAGE;
+      return -1;
+    }
+  }
+
+  /* This example is a benchmark on its own */
+  if (!bench.enabled ()) {
+    bench.frames = 20;
+  }
+
+  if (resolutions.empty ()) {
+    resolutions = { cv::Size (1920, 1080), cv::Size (3840, 2160), cv::Size (7680, 4320) };
+  }
+
+  const char *filename = "lena.png";
+  if (argc > optind) {
+    filename = argv[optind];
+  }
+
+  int img_width = 0;
+  int img_height = 0;
+  int channels = 0;
+  auto img_data = std::shared_ptr<unsigned char>(stbi_load (filename, &img_width, &img_height, &channels, 3), free);
+  if (NULL == img_data) {
+    std::cerr << "vx-training: Unable to load image " << filename << std::endl;
+    return -1;
+  }
+  cv::Mat original (img_height, img_width, CV_8UC3, img_data.get ());
+
+  auto context = vx::wrap (vxCreateContext ());
+
+  vx_status status = vxGetStatus ((vx_reference)context.get ());
+  if (VX_SUCCESS != status) {
+    std::cerr << "vx-training: Unable to create context:" << status << std::endl;
+    return -1;
+  }
+
+  vx_bool reentrant = vx_false_e;
+  vxRegisterLogCallback(context.get (), context_log_callback, reentrant);
+
+  long l2 = l2_cache_size ();
+  std::cout << "L2 cache: " << l2/1024 << "KB" << std::endl;
+  std::cout << "\t---" << std::endl;
+
+  for (const auto &resolution: resolutions) {
+    int width = resolution.width;
+    int height = resolution.height;
+
+    /* Synthetic frame of the requested size */
+    cv::Mat rgb;
+    cv::resize (original, rgb, resolution);
+
+    auto in_image = vx::wrap (vxCreateImage (context.get (), width, height, VX_DF_IMAGE_RGB));
+    auto untiled_out = vx::wrap (vxCreateImage (context.get (), width, height, VX_DF_IMAGE_U8));
+    auto tiled_out = vx::wrap (vxCreateImage (context.get (), width, height, VX_DF_IMAGE_U8));
+    for (auto image: { in_image.get (), untiled_out.get (), tiled_out.get () }) {
+      status = vxGetStatus ((vx_reference)image);
+      if (VX_SUCCESS != status) {
+        std::cerr << "vx-training: Unable to create image: " << status << std::endl;
+        return -1;
+      }
+    }
+
+    if (0 != populate_image (in_image.get (), rgb.data)) {
+      std::cerr << "vx-training: Unable to populate image" << std::endl;
+      return -1;
+    }
+
+    vx_float32 mat[3][2];
+    rotation_matrix (45.0, width, height, mat);
+    int tile_size = tile > 0 ? tile : tile_size_for_cache (mat, l2);
+
+    chain untiled;
+    chain tiled;
+    if (0 != create_untiled (context.get (), in_image.get (), untiled_out.get (), mat, width, height, untiled) ||
+        0 != create_tiled (context.get (), in_image.get (), tiled_out.get (), mat, width, height, tile_size, tiled)) {
+      return -1;
+    }
+
+    double pixels = static_cast<double>(width)*height;
+    std::cout << "Resolution: " << width << "x" << height << std::endl;
+    std::cout << "\tTile size: " << tile_size << "x" << tile_size << std::endl;
+    std::cout << "\t---" << std::endl;
+
+    if (0 != run_chain (untiled, bench, "Untiled", pixels) ||
+        0 != run_chain (tiled, bench, "Tiled", pixels)) {
+      return -1;
+    }
+
+    long mismatches = 0;
+    int max_diff = 0;
+    if (0 != compare_images (untiled_out.get (), tiled_out.get (), mismatches, max_diff)) {
+      return -1;
+    }
+    std::cout << "Tiled vs untiled output:" << std::endl;
+    std::cout << "\tDifferent pixels: " << mismatches << std::endl;
+    std::cout << "\tMaximum difference: " << max_diff << std::endl;
+    std::cout << "\t---" << std::endl;
+  }
+
+  return 0;
+}
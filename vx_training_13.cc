@@ -0,0 +1,380 @@
+/* Copyright (C) 2022 RidgeRun, LLC (http://www.ridgerun.com)
+ * All Rights Reserved.
+ *
+ * The contents of this software are proprietary and confidential to RidgeRun,
+ * LLC.  No part of this program may be photocopied, reproduced or translated
+ * into another programming language without prior written consent of
+ * RidgeRun, LLC.  The user is free to modify the source code after obtaining
+ * a software license from RidgeRun.  All source code changes must be provided
+ * back to RidgeRun without any encumbrance.
+ */
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include "vx_training_bench.h"
+#include "vx_training_handles.h"
+#include "vx_training_kernels.h"
+#include "vx_training_perf_export.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <opencv2/opencv.hpp>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include <VX/vx.h>
+
+static int
+populate_image (vx_image image, const unsigned char *img_data)
+{
+  int ret = -1;
+
+  vx_uint32 width = vx::query<vx_uint32> (image, VX_IMAGE_WIDTH);
+  vx_uint32 height = vx::query<vx_uint32> (image, VX_IMAGE_HEIGHT);
+  vx_int32 channels = 1;
+
+  vx_imagepatch_addressing_t layout = { width, height, channels,
+    static_cast<vx_int32>(width*channels), 0, 0, 0, 0 };
+
+  const vx_rectangle_t rect = { 0, 0, width, height };
+
+  vx_status status = vxCopyImagePatch (image, &rect, 0, &layout, (void *)img_data,
+      VX_WRITE_ONLY, VX_MEMORY_TYPE_HOST);
+  if (VX_SUCCESS != status) {
+    std::cerr << "vx-training: Unable to copy data into image: " << status << std::endl;
+    ret = -1;
+  } else {
+    ret = 0;
+  }
+
+  return ret;
+}
+
+/* Number of pixels that differ between both images by more than the
+ * given tolerance, and the largest difference.
+ */
+static int
+compare_images (vx_image a, vx_image b, int tolerance, long &mismatches, int &max_diff)
+{
+  vx_uint32 width = vx::query<vx_uint32> (a, VX_IMAGE_WIDTH);
+  vx_uint32 height = vx::query<vx_uint32> (a, VX_IMAGE_HEIGHT);
+
+  const vx_rectangle_t rect = { 0, 0, width, height };
+  vx_map_id map_a = 0;
+  vx_map_id map_b = 0;
+  vx_imagepatch_addressing_t addr_a = VX_IMAGEPATCH_ADDR_INIT;
+  vx_imagepatch_addressing_t addr_b = VX_IMAGEPATCH_ADDR_INIT;
+  vx_uint8 *ptr_a = NULL;
+  vx_uint8 *ptr_b = NULL;
+
+  vx_status status = vxMapImagePatch (a, &rect, 0, &map_a, &addr_a, (void **)&ptr_a,
+      VX_READ_ONLY, VX_MEMORY_TYPE_HOST, VX_NOGAP_X);
+  if (VX_SUCCESS != status) {
+    std::cerr << "vx-training: Unable to map image for reading: " << status << std::endl;
+    return -1;
+  }
+
+  status = vxMapImagePatch (b, &rect, 0, &map_b, &addr_b, (void **)&ptr_b,
+      VX_READ_ONLY, VX_MEMORY_TYPE_HOST, VX_NOGAP_X);
+  if (VX_SUCCESS != status) {
+    std::cerr << "vx-training: Unable to map image for reading: " << status << std::endl;
+    vxUnmapImagePatch (a, map_a);
+    return -1;
+  }
+
+  mismatches = 0;
+  max_diff = 0;
+  for (vx_uint32 y = 0; y < height; y++) {
+    for (vx_uint32 x = 0; x < width; x++) {
+      int diff = std::abs (ptr_a[y*addr_a.stride_y + x] - ptr_b[y*addr_b.stride_y + x]);
+      mismatches += diff > tolerance;
+      max_diff = std::max (max_diff, diff);
+    }
+  }
+
+  vxUnmapImagePatch (b, map_b);
+  vxUnmapImagePatch (a, map_a);
+
+  return 0;
+}
+
+/* Rotation around the center plus a small zoom, so samples fall at
+ * arbitrary fractional positions.
+ */
+static void
+update_matrix (vx_matrix matrix, vx_float32 degrees, int width, int height)
+{
+  vx_float32 rad = degrees*M_PI/180.0;
+  vx_float32 scale = 0.8;
+  vx_float32 c = scale*cos (rad);
+  vx_float32 s = scale*sin (rad);
+  vx_float32 cx = width/2.0;
+  vx_float32 cy = height/2.0;
+
+  vx_float32 mat[3][2] = {
+    {c, s},
+    {-s, c},
+    {cx - c*cx + s*cy, cy - s*cx - c*cy},
+  };
+  vxCopyMatrix (matrix, mat, VX_WRITE_ONLY, VX_MEMORY_TYPE_HOST);
+}
+
+/* Warp graph with either the stock node or the user kernel */
+static vx::Graph
+create_graph (vx_context context, vx_image input, vx_matrix matrix, vx_enum interpolation,
+    vx_image output, bool user_kernel)
+{
+  auto graph = vx::wrap (vxCreateGraph (context));
+  vx_status status = vxGetStatus ((vx_reference)graph.get ());
+  if (VX_SUCCESS != status) {
+    std::cerr << "vx-training: Unable to create graph: " << status << std::endl;
+    return NULL;
+  }
+
+  auto node = vx::wrap (user_kernel ?
+      warp_affine_node (graph.get (), input, matrix, interpolation, output) :
+      vxWarpAffineNode (graph.get (), input, matrix, interpolation, output));
+  status = vxGetStatus ((vx_reference)node.get ());
+  if (VX_SUCCESS != status) {
+    std::cerr << "vx-training: Unable to create processing node: " << status << std::endl;
+    return NULL;
+  }
+
+  /* Undefined borders may differ, pin them down to compare */
+  vx_border_t border = { VX_BORDER_CONSTANT };
+  vxSetNodeAttribute (node.get (), VX_NODE_BORDER, &border, sizeof (border));
+
+  status = vxVerifyGraph (graph.get ());
+  if (VX_SUCCESS != status) {
+    std::cerr << "vx-training: Graph validation failed: " << status << std::endl;
+    return NULL;
+  }
+
+  return graph;
+}
+
+/* Processes the graph until the benchmark is done. Returns the
+ * throughput in frames per second, or a negative value on error.
+ */
+static double
+run_graph (vx_graph graph, benchmark bench)
+{
+  bench.begin ();
+  while (!bench.done ()) {
+    auto start = std::chrono::steady_clock::now ();
+    vx_status status = vxProcessGraph (graph);
+    if (VX_SUCCESS != status) {
+      std::cerr << "vx-training: Error processing the graph: " << status << std::endl;
+      return -1;
+    }
+    bench.add_frame (std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now () - start).count ());
+  }
+
+  return bench.throughput ();
+}
+
+static void VX_CALLBACK
+context_log_callback(vx_context context, vx_reference ref, vx_status status,
+    const vx_char string[])
+{
+  std::cout << "vx-training [dbg]: " << string << std::endl;
+}
+
+int
+main (int argc, char *argv[])
+{
+  int width = 1920;
+  int height = 1080;
+  unsigned max_threads = std::max (std::thread::hardware_concurrency (), 1u);
+  benchmark bench;
+  int opt = 0;
+  while (-1 != (opt = getopt (argc, argv, "r:n:" BENCHMARK_OPTIONS))) {
+    switch (opt) {
+    case 'r':
+      if (2 != sscanf (optarg, "%dx%d", &width, &height) || width < 1 || height < 1) {
+        std::cerr << "vx-training: Invalid resolution " << optarg << std::endl;
+        return -1;
+      }
+      break;
+    case 'n':
+      if (atoi (optarg) < 1) {
+        std::cerr << "vx-training: At least one thread is needed" << std::endl;
+        return -1;
+      }
+      max_threads = atoi (optarg);
+      break;
+    default:
+      if (bench.parse_option (opt, optarg)) {
+        break;
+      }
+      std::cerr << "Usage: " << argv[0] << " [-r WIDTHxHEIGHT] [-n threads] [-b frames|-s seconds] [-w frames] [image]" << std::endl;
+      std::cerr << "\t-r: scale the image to the given resolution (default 1920x1080)" << std::endl;
+      std::cerr << "\t-n: largest amount of threads to measure (default one per core)" << std::endl;
+      std::cerr << BENCHMARK_USAGE;
+      return -1;
+    }
+  }
+
+  /* This example is a benchmark on its own */
+  if (!bench.enabled ()) {
+    bench.frames = 50;
+  }
+
+  const char *filename = "lena.png";
+  if (argc > optind) {
+    filename = argv[optind];
+  }
+
+  int img_width = 0;
+  int img_height = 0;
+  int channels = 0;
+  auto img_data = std::shared_ptr<unsigned char>(stbi_load (filename, &img_width, &img_height, &channels, 1), free);
+  if (NULL == img_data) {
+    std::cerr << "vx-training: Unable to load image " << filename << std::endl;
+    return -1;
+  }
+
+  cv::Mat gray;
+  cv::resize (cv::Mat (img_height, img_width, CV_8UC1, img_data.get ()), gray, cv::Size (width, height));
+
+  auto context = vx::wrap (vxCreateContext ());
+
+  vx_status status = vxGetStatus ((vx_reference)context.get ());
+  if (VX_SUCCESS != status) {
+    std::cerr << "vx-training: Unable to create context:" << status << std::endl;
+    return -1;
+  }
+
+  vx_bool reentrant = vx_false_e;
+  vxRegisterLogCallback(context.get (), context_log_callback, reentrant);
+
+  status = register_warp_affine (context.get ());
+  if (VX_SUCCESS != status) {
+    std::cerr << "vx-training: Unable to register the warp affine kernel: " << status << std::endl;
+    return -1;
+  }
+
+  auto in_image = vx::wrap (vxCreateImage (context.get (), width, height, VX_DF_IMAGE_U8));
+  auto stock_out = vx::wrap (vxCreateImage (context.get (), width, height, VX_DF_IMAGE_U8));
+  auto user_out = vx::wrap (vxCreateImage (context.get (), width, height, VX_DF_IMAGE_U8));
+  for (auto image: { in_image.get (), stock_out.get (), user_out.get () }) {
+    status = vxGetStatus ((vx_reference)image);
+    if (VX_SUCCESS != status) {
+      std::cerr << "vx-training: Unable to create image: " << status << std::endl;
+      return -1;
+    }
+  }
+
+  if (0 != populate_image (in_image.get (), gray.data)) {
+    std::cerr << "vx-training: Unable to populate image" << std::endl;
+    return -1;
+  }
+
+  auto matrix = vx::wrap (vxCreateMatrix (context.get (), VX_TYPE_FLOAT32, 2, 3));
+  update_matrix (matrix.get (), 30.0, width, height);
+
+  std::cout << "Resolution: " << width << "x" << height << std::endl;
+  std::cout << "\t---" << std::endl;
+
+  /* The warp has no SSSE3 version, only plain C and AVX2 differ */
+  const simd_level best = kernels_simd ();
+  std::vector<simd_level> levels = { SIMD_SCALAR };
+  if (SIMD_AVX2 == best) {
+    levels.push_back (best);
+  }
+
+  /* Correctness: both interpolations, at every instruction set the warp
+   * implements, over a few angles. Bilinear may round differently than
+   * the stock node, so differences of one level are tolerated.
+   */
+  const vx_enum interpolations[] = { VX_INTERPOLATION_NEAREST_NEIGHBOR, VX_INTERPOLATION_BILINEAR };
+  bool passed = true;
+  for (vx_enum interpolation: interpolations) {
+    auto stock = create_graph (context.get (), in_image.get (), matrix.get (), interpolation, stock_out.get (), false);
+    auto user = create_graph (context.get (), in_image.get (), matrix.get (), interpolation, user_out.get (), true);
+    if (!stock || !user) {
+      return -1;
+    }
+
+    for (simd_level level: levels) {
+      kernels_simd () = level;
+
+      long mismatches = 0;
+      int max_diff = 0;
+      for (vx_float32 angle: { 0.0, 30.0, 45.0, 137.0 }) {
+        update_matrix (matrix.get (), angle, width, height);
+        if (VX_SUCCESS != vxProcessGraph (stock.get ()) || VX_SUCCESS != vxProcessGraph (user.get ())) {
+          std::cerr << "vx-training: Error processing the graph" << std::endl;
+          return -1;
+        }
+
+        long angle_mismatches = 0;
+        int angle_diff = 0;
+        if (0 != compare_images (stock_out.get (), user_out.get (), 1, angle_mismatches, angle_diff)) {
+          return -1;
+        }
+        mismatches += angle_mismatches;
+        max_diff = std::max (max_diff, angle_diff);
+      }
+
+      std::cout << "Correctness (" << perf_exporter::interpolation_name (interpolation) << ", "
+                << simd_name (kernels_simd ()) << "):" << std::endl;
+      std::cout << "\tPixels off by more than 1: " << mismatches << std::endl;
+      std::cout << "\tMaximum difference: " << max_diff << std::endl;
+      std::cout << "\t---" << std::endl;
+      passed = passed && 0 == mismatches;
+    }
+  }
+  kernels_simd () = best;
+
+  /* Scaling: bilinear, the case that dominates examples 07 and 08 */
+  update_matrix (matrix.get (), 30.0, width, height);
+  auto stock = create_graph (context.get (), in_image.get (), matrix.get (), VX_INTERPOLATION_BILINEAR, stock_out.get (), false);
+  auto user = create_graph (context.get (), in_image.get (), matrix.get (), VX_INTERPOLATION_BILINEAR, user_out.get (), true);
+  if (!stock || !user) {
+    return -1;
+  }
+
+  double stock_fps = run_graph (stock.get (), bench);
+  if (stock_fps < 0) {
+    return -1;
+  }
+  std::cout << "Stock vxWarpAffineNode: " << stock_fps << "fps" << std::endl;
+  std::cout << "\t---" << std::endl;
+
+  std::vector<unsigned> thread_counts;
+  for (unsigned threads = 1; threads < max_threads; threads *= 2) {
+    thread_counts.push_back (threads);
+  }
+  thread_counts.push_back (max_threads);
+
+  for (simd_level level: levels) {
+    kernels_simd () = level;
+    std::cout << "User kernel (" << simd_name (kernels_simd ()) << "):" << std::endl;
+
+    double single_fps = 0;
+    for (unsigned threads: thread_counts) {
+      set_kernels_threads (threads);
+      double fps = run_graph (user.get (), bench);
+      if (fps < 0) {
+        return -1;
+      }
+      if (1 == threads) {
+        single_fps = fps;
+      }
+
+      std::cout << "\t" << threads << " threads: " << fps << "fps, "
+                << (single_fps > 0 ? fps/single_fps : 0) << "x over 1 thread, "
+                << (stock_fps > 0 ? fps/stock_fps : 0) << "x over the stock node" << std::endl;
+    }
+    std::cout << "\t---" << std::endl;
+  }
+
+  return passed ? 0 : -1;
+}
@@ -0,0 +1,197 @@
+/* Copyright (C) 2022 RidgeRun, LLC (http://www.ridgerun.com)
+ * All Rights Reserved.
+ *
+ * The contents of this software are proprietary and confidential to RidgeRun,
+ * LLC.  No part of this program may be photocopied, reproduced or translated
+ * into another programming language without prior written consent of
+ * RidgeRun, LLC.  The user is free to modify the source code after obtaining
+ * a software license from RidgeRun.  All source code changes must be provided
+ * back to RidgeRun without any encumbrance.
+ */
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+
+#include "vx_training_raw.h"
+
+#include <stdio.h>
+#include <time.h>
+#include <VX/vx.h>
+
+static double
+elapsed_ms (const struct timespec *start)
+{
+  struct timespec now;
+  clock_gettime (CLOCK_MONOTONIC, &now);
+
+  return (now.tv_sec - start->tv_sec)*1000.0 + (now.tv_nsec - start->tv_nsec)/1000000.0;
+}
+
+/* Decodes an image into a raw RGB file */
+static int
+convert_to_raw (const char *filename, const char *outname)
+{
+  int width = 0;
+  int height = 0;
+  int channels = 0;
+  unsigned char *img_data = stbi_load (filename, &width, &height, &channels, 3);
+  if (NULL == img_data) {
+    fprintf (stderr, "vx-training: Unable to load image \"%s\"\n", filename);
+    return -1;
+  }
+
+  int ret = raw_write (outname, width, height, VX_DF_IMAGE_RGB, img_data, width*3);
+
+  free (img_data);
+  return ret;
+}
+
+/* Encodes a raw file as PNG */
+static int
+convert_from_raw (const char *filename, const char *outname)
+{
+  int ret = -1;
+  raw_frame raw;
+
+  if (0 != raw_open (filename, &raw)) {
+    goto out;
+  }
+
+  if (VX_DF_IMAGE_U8 != raw.format && VX_DF_IMAGE_RGB != raw.format &&
+      VX_DF_IMAGE_RGBX != raw.format) {
+    fprintf (stderr, "vx-training: Only U8, RGB and RGBX raw images can be stored as PNG\n");
+    goto close_raw;
+  }
+
+  if (0 == stbi_write_png (outname, raw.width, raw.height, raw.stride_x, raw.data, raw.stride_y)) {
+    fprintf (stderr, "vx-training: Unable to write image to %s\n", outname);
+    goto close_raw;
+  }
+
+  ret = 0;
+
+ close_raw:
+  raw_close (&raw);
+
+ out:
+  return ret;
+}
+
+/* Compares what it takes to get the same frame into an image from the
+ * PNG and from the raw file
+ */
+static int
+compare_loading (vx_context context, const char *png_path, const char *raw_path)
+{
+  int ret = -1;
+  struct timespec start;
+  raw_frame raw;
+
+  int width = 0;
+  int height = 0;
+  int channels = 0;
+  clock_gettime (CLOCK_MONOTONIC, &start);
+  unsigned char *img_data = stbi_load (png_path, &width, &height, &channels, 3);
+  double decode_ms = elapsed_ms (&start);
+  if (NULL == img_data) {
+    fprintf (stderr, "vx-training: Unable to load image \"%s\"\n", png_path);
+    goto out;
+  }
+
+  clock_gettime (CLOCK_MONOTONIC, &start);
+  if (0 != raw_open (raw_path, &raw)) {
+    goto free_img_data;
+  }
+  vx_image image = raw_create_image (context, &raw);
+  double map_ms = elapsed_ms (&start);
+
+  vx_status status = vxGetStatus ((vx_reference)image);
+  if (VX_SUCCESS != status) {
+    fprintf (stderr, "vx-training: Unable to wrap raw image: %d\n", status);
+    goto free_image;
+  }
+
+  /* The pages of the mapping are read in as they are touched */
+  clock_gettime (CLOCK_MONOTONIC, &start);
+  unsigned long checksum = 0;
+  for (vx_uint32 y = 0; y < raw.height; y++) {
+    for (vx_uint32 x = 0; x < raw.width*raw.stride_x; x += RAW_PAGE_SIZE/4) {
+      checksum += raw.data[y*raw.stride_y + x];
+    }
+  }
+  double touch_ms = elapsed_ms (&start);
+
+  printf ("Frame loading:\n");
+  printf ("\tResolution: %dx%d\n", width, height);
+  printf ("\tPNG decode: %gms\n", decode_ms);
+  printf ("\tRaw map and wrap: %gms\n", map_ms);
+  printf ("\tRaw first touch: %gms (checksum %lu)\n", touch_ms, checksum);
+  printf ("\t---\n");
+
+  ret = 0;
+
+ free_image:
+  vxReleaseImage (&image);
+  raw_close (&raw);
+
+ free_img_data:
+  free (img_data);
+
+ out:
+  return ret;
+}
+
+static void VX_CALLBACK
+context_log_callback(vx_context context, vx_reference ref, vx_status status,
+    const vx_char string[])
+{
+  printf ("vx-training [dbg]: %s\n", string);
+}
+
+int
+main (int argc, char *argv[])
+{
+  int ret = -1;
+
+  const char *filename = "lena.png";
+  if (argc >= 2) {
+    filename = argv[1];
+  }
+
+  const char *outname = "lena.raw";
+  if (argc >= 3) {
+    outname = argv[2];
+  }
+
+  vx_context context = vxCreateContext ();
+
+  vx_status status = vxGetStatus ((vx_reference)context);
+  if (VX_SUCCESS != status) {
+    fprintf (stderr, "vx-training: Unable to create context: %d\n", status);;
+    goto free_context;
+  }
+
+  vx_bool reentrant = vx_false_e;
+  vxRegisterLogCallback(context, context_log_callback, reentrant);
+
+  /* Raw files turn into PNG, anything stb can decode into raw */
+  int from_raw = raw_probe (filename);
+  if (0 != (from_raw ? convert_from_raw (filename, outname) : convert_to_raw (filename, outname))) {
+    fprintf (stderr, "vx-training: Unable to convert \"%s\" to \"%s\"\n", filename, outname);
+    goto free_context;
+  }
+
+  if (0 != compare_loading (context, from_raw ? outname : filename, from_raw ? filename : outname)) {
+    goto free_context;
+  }
+
+  ret = 0;
+
+ free_context:
+  vxReleaseContext (&context);
+
+  return ret;
+}
@@ -0,0 +1,459 @@
+/* Copyright (C) 2022 RidgeRun, LLC (http://www.ridgerun.com)
+ * All Rights Reserved.
+ *
+ * The contents of this software are proprietary and confidential to RidgeRun,
+ * LLC.  No part of this program may be photocopied, reproduced or translated
+ * into another programming language without prior written consent of
+ * RidgeRun, LLC.  The user is free to modify the source code after obtaining
+ * a software license from RidgeRun.  All source code changes must be provided
+ * back to RidgeRun without any encumbrance.
+ */
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include "vx_training_bench.h"
+#include "vx_training_coro.h"
+#include "vx_training_handles.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <opencv2/opencv.hpp>
+#include <string>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+#include <VX/vx_khr_pipelining.h>
+#include <VX/vx.h>
+
+static int
+populate_image (vx_image image, const unsigned char *img_data)
+{
+  int ret = -1;
+
+  vx_uint32 width = vx::query<vx_uint32> (image, VX_IMAGE_WIDTH);
+  vx_uint32 height = vx::query<vx_uint32> (image, VX_IMAGE_HEIGHT);
+  vx_int32 channels = 3;
+
+  vx_imagepatch_addressing_t layout = { width, height, channels,
+    static_cast<vx_int32>(width*channels), 0, 0, 0, 0 };
+
+  const vx_rectangle_t rect = { 0, 0, width, height };
+
+  vx_status status = vxCopyImagePatch (image, &rect, 0, &layout, (void *)img_data,
+      VX_WRITE_ONLY, VX_MEMORY_TYPE_HOST);
+  if (VX_SUCCESS != status) {
+    std::cerr << "vx-training: Unable to copy data into image: " << status << std::endl;
+    ret = -1;
+  } else {
+    ret = 0;
+  }
+
+  return ret;
+}
+
+static void
+update_matrix (vx_matrix matrix, vx_float32 angle, int width, int height)
+{
+  /* Translate + rotate + translate back, as in example 09 */
+  vx_float32 rad = angle*M_PI/180.0;
+  vx_float32 mat[3][2] = {
+    {cos (rad), sin (rad)},
+    {-sin (rad), cos (rad)},
+    {-cos (rad)*width/2 + sin (rad)*height/2 + width/2, -cos (rad)*height/2 - sin (rad)*width/2 + height/2},
+  };
+  vxCopyMatrix(matrix, mat, VX_WRITE_ONLY, VX_MEMORY_TYPE_HOST);
+}
+
+static double
+elapsed_ms (const std::chrono::steady_clock::time_point &start)
+{
+  return std::chrono::duration<double, std::milli>(
+      std::chrono::steady_clock::now () - start).count ();
+}
+
+/* One independent copy of the example 09 pipeline. Streams only share
+ * the context and the thread that feeds them, every one of them owns
+ * its graph, buffers and matrices.
+ */
+struct stream {
+  int id;
+  vx::Graph graph;
+  /* Awaitable view of the graph, owned by the loop */
+  async_graph *async;
+  vx::Image intermediate;
+  std::vector<vx::Node> nodes;
+  std::vector<vx::Image> in_images;
+  std::vector<vx::Image> out_images;
+  std::vector<vx::Matrix> matrices;
+  benchmark bench;
+};
+
+static int
+create_stream (vx_context context, graph_loop &loop, int id, int width, int height, int depth,
+    stream &s)
+{
+  s.id = id;
+
+  for (int i = 0; i < depth; i++) {
+    auto in_image = vx::wrap (vxCreateImage (context, width, height, VX_DF_IMAGE_RGB));
+    auto out_image = vx::wrap (vxCreateImage (context, width, height, VX_DF_IMAGE_U8));
+    auto matrix = vx::wrap (vxCreateMatrix (context, VX_TYPE_FLOAT32, 2, 3));
+    if (VX_SUCCESS != vxGetStatus ((vx_reference)in_image.get ()) ||
+        VX_SUCCESS != vxGetStatus ((vx_reference)out_image.get ()) ||
+        VX_SUCCESS != vxGetStatus ((vx_reference)matrix.get ())) {
+      std::cerr << "vx-training: Unable to create the buffers of stream " << id << std::endl;
+      return -1;
+    }
+
+    s.in_images.push_back (std::move (in_image));
+    s.out_images.push_back (std::move (out_image));
+    s.matrices.push_back (std::move (matrix));
+  }
+
+  s.graph = vx::wrap (vxCreateGraph (context));
+  vx_status status = vxGetStatus ((vx_reference)s.graph.get ());
+  if (VX_SUCCESS != status) {
+    std::cerr << "vx-training: Unable to create graph: " << status << std::endl;
+    return -1;
+  }
+
+  s.intermediate = vx::wrap (vxCreateVirtualImage (s.graph.get (), width, height, VX_DF_IMAGE_U8));
+  status = vxGetStatus ((vx_reference)s.intermediate.get ());
+  if (VX_SUCCESS != status) {
+    std::cerr << "vx-training: Unable to create virtual image: " << status << std::endl;
+    return -1;
+  }
+
+  s.nodes = vx::wrap_all ({
+    vxChannelExtractNode (s.graph.get (), s.in_images[0].get (), VX_CHANNEL_R, s.intermediate.get ()),
+    vxWarpAffineNode (s.graph.get (), s.intermediate.get (), s.matrices[0].get (),
+        VX_INTERPOLATION_BILINEAR, s.out_images[0].get ())
+  });
+
+  for (auto &node: s.nodes) {
+    status = vxGetStatus ((vx_reference)node.get ());
+    if (VX_SUCCESS != status) {
+      std::cerr << "vx-training: Unable to create processing node: " << status << std::endl;
+      return -1;
+    }
+  }
+
+  std::string name = "stream_" + std::to_string (id);
+  vxSetReferenceName ((vx_reference)s.graph.get (), name.c_str ());
+
+  /* Input, output and matrix, the same parameters as example 09 */
+  vx_parameter parameter = vxGetParameterByIndex (s.nodes[0].get (), 0);
+  vxAddParameterToGraph (s.graph.get (), parameter);
+  vxReleaseParameter (&parameter);
+
+  parameter = vxGetParameterByIndex (s.nodes[1].get (), 3);
+  vxAddParameterToGraph (s.graph.get (), parameter);
+  vxReleaseParameter (&parameter);
+
+  parameter = vxGetParameterByIndex (s.nodes[1].get (), 1);
+  vxAddParameterToGraph (s.graph.get (), parameter);
+  vxReleaseParameter (&parameter);
+
+  std::vector<vx_reference> in_refs;
+  std::vector<vx_reference> out_refs;
+  std::vector<vx_reference> matrix_refs;
+  for (int i = 0; i < depth; i++) {
+    in_refs.push_back ((vx_reference)s.in_images[i].get ());
+    out_refs.push_back ((vx_reference)s.out_images[i].get ());
+    matrix_refs.push_back ((vx_reference)s.matrices[i].get ());
+  }
+
+  std::vector<vx_graph_parameter_queue_params_t> queue_params_list(3);
+  queue_params_list[0].graph_parameter_index = 0;
+  queue_params_list[0].refs_list_size = in_refs.size ();
+  queue_params_list[0].refs_list = in_refs.data ();
+  queue_params_list[1].graph_parameter_index = 1;
+  queue_params_list[1].refs_list_size = out_refs.size ();
+  queue_params_list[1].refs_list = out_refs.data ();
+  queue_params_list[2].graph_parameter_index = 2;
+  queue_params_list[2].refs_list_size = matrix_refs.size ();
+  queue_params_list[2].refs_list = matrix_refs.data ();
+
+  vxSetGraphScheduleConfig (s.graph.get (), VX_GRAPH_SCHEDULE_MODE_QUEUE_AUTO,
+      queue_params_list.size (), queue_params_list.data ());
+
+  s.async = loop.add (s.graph.get ());
+  if (NULL == s.async) {
+    return -1;
+  }
+
+  status = vxVerifyGraph (s.graph.get ());
+  if (VX_SUCCESS != status) {
+    std::cerr << "vx-training: Graph validation failed: " << status << std::endl;
+    return -1;
+  }
+
+  return 0;
+}
+
+/* Copies a new frame into the input and enqueues it along with the
+ * matrix to warp it with.
+ */
+static int
+enqueue_frame (stream &s, vx_image image, vx_matrix matrix, const unsigned char *img_data,
+    vx_float32 angle, int width, int height)
+{
+  if (0 != populate_image (image, img_data)) {
+    return -1;
+  }
+  update_matrix (matrix, angle, width, height);
+
+  vx_status status = s.async->enqueue (2, (vx_reference)matrix);
+  if (VX_SUCCESS == status) {
+    status = s.async->enqueue (0, (vx_reference)image);
+  }
+  if (VX_SUCCESS != status) {
+    std::cerr << "vx-training: Unable to enqueue frame on stream " << s.id << ": " << status << std::endl;
+    return -1;
+  }
+
+  return 0;
+}
+
+/* Feeds the stream until its benchmark is done. Instead of blocking,
+ * the coroutine is suspended while the graph works, so the thread can
+ * feed other streams in the meantime.
+ */
+static graph_task
+run_stream (stream &s, const unsigned char *img_data, int width, int height)
+{
+  async_graph &graph = *s.async;
+  const int depth = s.in_images.size ();
+  /* Streams start at different angles so they don't work in lockstep */
+  vx_float32 angle = 360.0*s.id/64;
+  std::deque<std::chrono::steady_clock::time_point> enqueue_times;
+
+  for (int i = 0; i < depth; i++) {
+    if (VX_SUCCESS != graph.enqueue (1, (vx_reference)s.out_images[i].get ())) {
+      std::cerr << "vx-training: Unable to enqueue output on stream " << s.id << std::endl;
+      co_return -1;
+    }
+  }
+
+  s.bench.begin ();
+  for (int i = 0; i < depth; i++) {
+    enqueue_times.push_back (std::chrono::steady_clock::now ());
+    if (0 != enqueue_frame (s, s.in_images[i].get (), s.matrices[i].get (), img_data, angle++, width, height)) {
+      co_return -1;
+    }
+  }
+
+  int in_flight = depth;
+  while (in_flight > 0) {
+    vx_image in_image = (vx_image)co_await graph.dequeue (0);
+    vx_matrix matrix = (vx_matrix)co_await graph.dequeue (2);
+    vx_image out_image = (vx_image)co_await graph.dequeue (1);
+    if (NULL == in_image || NULL == matrix || NULL == out_image) {
+      co_return -1;
+    }
+    in_flight--;
+
+    s.bench.add_frame (elapsed_ms (enqueue_times.front ()));
+    enqueue_times.pop_front ();
+
+    if (VX_SUCCESS != graph.enqueue (1, (vx_reference)out_image)) {
+      std::cerr << "vx-training: Unable to enqueue output on stream " << s.id << std::endl;
+      co_return -1;
+    }
+
+    /* Stop feeding once done, the frames in flight drain the queues */
+    if (s.bench.done ()) {
+      continue;
+    }
+
+    enqueue_times.push_back (std::chrono::steady_clock::now ());
+    if (0 != enqueue_frame (s, in_image, matrix, img_data, angle++, width, height)) {
+      co_return -1;
+    }
+    in_flight++;
+  }
+
+  co_return 0;
+}
+
+/* Runs the given amount of streams at once, all of them from the
+ * calling thread. Returns false on error.
+ */
+static bool
+run_streams (vx_context context, int count, int width, int height, int depth,
+    const unsigned char *img_data, const benchmark &bench, bool details)
+{
+  graph_loop loop (context);
+  std::vector<stream> streams (count);
+  for (int i = 0; i < count; i++) {
+    if (0 != create_stream (context, loop, i, width, height, depth, streams[i])) {
+      return false;
+    }
+    streams[i].bench = bench;
+  }
+
+  for (auto &s: streams) {
+    loop.spawn (run_stream (s, img_data, width, height));
+  }
+  int ret = loop.run ();
+
+  /* Every frame was dequeued, or a stream failed and left frames in
+   * flight. Either way, make sure the graphs are idle before they are
+   * released.
+   */
+  for (auto &s: streams) {
+    vxWaitGraph (s.graph.get ());
+  }
+  if (0 != ret) {
+    return false;
+  }
+
+  double total_fps = 0;
+  double min_fps = 0;
+  double max_fps = 0;
+  double latency_sum = 0;
+  double max_latency = 0;
+  for (auto &s: streams) {
+    double fps = s.bench.throughput ();
+    total_fps += fps;
+    min_fps = (0 == s.id || fps < min_fps) ? fps : min_fps;
+    max_fps = std::max (max_fps, fps);
+    latency_sum += s.bench.average_latency ();
+    max_latency = std::max (max_latency, s.bench.maximum_latency ());
+  }
+
+  std::cout << count << " streams:" << std::endl;
+  std::cout << "\tAggregate throughput: " << total_fps << "fps" << std::endl;
+  std::cout << "\tPer-stream throughput: " << total_fps/count << "fps (min " << min_fps
+            << "fps, max " << max_fps << "fps)" << std::endl;
+  std::cout << "\tAverage latency: " << latency_sum/count << "ms" << std::endl;
+  std::cout << "\tMaximum latency: " << max_latency << "ms" << std::endl;
+  if (details) {
+    for (auto &s: streams) {
+      std::cout << "\tStream " << s.id << ": " << s.bench.throughput () << "fps, "
+                << s.bench.average_latency () << "ms average latency, "
+                << s.bench.maximum_latency () << "ms maximum latency" << std::endl;
+    }
+  }
+  std::cout << "\t---" << std::endl;
+
+  return true;
+}
+
+static void VX_CALLBACK
+context_log_callback(vx_context context, vx_reference ref, vx_status status,
+    const vx_char string[])
+{
+  std::cout << "vx-training [dbg]: " << string << std::endl;
+}
+
+int
+main (int argc, char *argv[])
+{
+  int width = 1280;
+  int height = 720;
+  int max_streams = 64;
+  int depth = 2;
+  bool details = false;
+  benchmark bench;
+  int opt = 0;
+  while (-1 != (opt = getopt (argc, argv, "r:n:d:v" BENCHMARK_OPTIONS))) {
+    switch (opt) {
+    case 'r':
+      if (2 != sscanf (optarg, "%dx%d", &width, &height) || width < 1 || height < 1) {
+        std::cerr << "vx-training: Invalid resolution " << optarg << std::endl;
+        return -1;
+      }
+      break;
+    case 'n':
+      max_streams = atoi (optarg);
+      if (max_streams < 1) {
+        std::cerr << "vx-training: At least one stream is needed" << std::endl;
+        return -1;
+      }
+      break;
+    case 'd':
+      depth = atoi (optarg);
+      if (depth < 1) {
+        std::cerr << "vx-training: Invalid queue depth " << optarg << std::endl;
+        return -1;
+      }
+      break;
+    case 'v':
+      details = true;
+      break;
+    default:
+      if (bench.parse_option (opt, optarg)) {
+        break;
+      }
+      std::cerr << "Usage: " << argv[0] << " [-r WIDTHxHEIGHT] [-n streams] [-d depth] [-v] [-b frames|-s seconds] [-w frames] [image]" << std::endl;
+      std::cerr << "\t-r: scale the image to the given resolution (default 1280x720)" << std::endl;
+      std::cerr << "\t-n: largest amount of streams to measure (default 64)" << std::endl;
+      std::cerr << "\t-d: queue depth of every stream (default 2)" << std::endl;
+      std::cerr << "\t-v: report every stream, not only the aggregate" << std::endl;
+      std::cerr << BENCHMARK_USAGE;
+      return -1;
+    }
+  }
+
+  /* This example is a benchmark on its own, the frames are per stream */
+  if (!bench.enabled ()) {
+    bench.frames = 100;
+  }
+
+  const char *filename = "lena.png";
+  if (argc > optind) {
+    filename = argv[optind];
+  }
+
+  int img_width = 0;
+  int img_height = 0;
+  int channels = 0;
+  auto img_data = std::shared_ptr<unsigned char>(stbi_load (filename, &img_width, &img_height, &channels, 3), free);
+  if (NULL == img_data) {
+    std::cerr << "vx-training: Unable to load image " << filename << std::endl;
+    return -1;
+  }
+
+  /* Every stream ingests a copy of the same frame */
+  cv::Mat rgb;
+  cv::resize (cv::Mat (img_height, img_width, CV_8UC3, img_data.get ()), rgb, cv::Size (width, height));
+
+  auto context = vx::wrap (vxCreateContext ());
+
+  vx_status status = vxGetStatus ((vx_reference)context.get ());
+  if (VX_SUCCESS != status) {
+    std::cerr << "vx-training: Unable to create context:" << status << std::endl;
+    return -1;
+  }
+
+  vx_bool reentrant = vx_false_e;
+  vxRegisterLogCallback(context.get (), context_log_callback, reentrant);
+
+  std::cout << "Resolution: " << width << "x" << height << std::endl;
+  std::cout << "\tQueue depth: " << depth << std::endl;
+  std::cout << "\tHost threads: 1" << std::endl;
+  std::cout << "\t---" << std::endl;
+
+  std::vector<int> stream_counts;
+  for (int count = 1; count < max_streams; count *= 2) {
+    stream_counts.push_back (count);
+  }
+  stream_counts.push_back (max_streams);
+
+  for (int count: stream_counts) {
+    if (!run_streams (context.get (), count, width, height, depth, rgb.data, bench, details)) {
+      std::cerr << "vx-training: Unable to run " << count << " streams" << std::endl;
+      return -1;
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,224 @@
+/* Copyright (C) 2022 RidgeRun, LLC (http://www.ridgerun.com)
+ * All Rights Reserved.
+ *
+ * The contents of this software are proprietary and confidential to RidgeRun,
+ * LLC.  No part of this program may be photocopied, reproduced or translated
+ * into another programming language without prior written consent of
+ * RidgeRun, LLC.  The user is free to modify the source code after obtaining
+ * a software license from RidgeRun.  All source code changes must be provided
+ * back to RidgeRun without any encumbrance.
+ */
+
+#ifndef VX_TRAINING_BATCHER_H
+#define VX_TRAINING_BATCHER_H
+
+/* Dynamic batching policy. Frames are accumulated as they arrive and
+ * flushed as a batch when either the target size is reached or the
+ * oldest frame can't wait any longer without blowing the latency
+ * budget. The target size adapts every few batches:
+ *
+ *   - Frames pile up faster than batches are flushed: the target is
+ *     doubled, larger batches amortize more of the per-execution
+ *     overhead and drain the backlog sooner.
+ *   - The p99 latency exceeds the budget: the target is halved, frames
+ *     wait too long for the batch to fill or to be processed.
+ *   - There is room in the budget and batches fill up before their
+ *     deadline: the target grows by one.
+ *
+ * The batcher only decides, it doesn't process anything, so it can sit
+ * in front of any graph.
+ */
+
+#include "vx_training_histogram.h"
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <iostream>
+#include <vector>
+
+class adaptive_batcher
+{
+public:
+  typedef std::chrono::steady_clock clock;
+
+  enum flush_reason {
+    FLUSH_SIZE,
+    FLUSH_DEADLINE,
+  };
+
+  /* Batches never exceed max_size frames, and at most max_pending
+   * frames wait for a batch, older ones are dropped beyond that.
+   */
+  adaptive_batcher (int max_size, double budget_ms, int max_pending) : max_size (max_size),
+    max_pending (max_pending), budget_ms (budget_ms), target (1), image_ms (0),
+    window (window_size), batches (0), frames (0), dropped (0), size_flushes (0),
+    deadline_flushes (0), backlogged (false), recent_size (0), recent_deadline (0),
+    recent_backlog (0), min_target (1),
+    max_target (1), last_reason (FLUSH_SIZE) {}
+
+  void
+  arrive (clock::time_point arrival)
+  {
+    if (pending.size () >= static_cast<size_t>(max_pending)) {
+      pending.pop_front ();
+      dropped++;
+    }
+    pending.push_back (arrival);
+  }
+
+  size_t
+  waiting () const
+  {
+    return pending.size ();
+  }
+
+  /* Latest time the oldest frame may be flushed, leaving room for the
+   * expected processing time of a full batch.
+   */
+  clock::time_point
+  deadline () const
+  {
+    double wait_ms = std::max (0.0, budget_ms - image_ms*target);
+    return pending.front () + std::chrono::duration_cast<clock::duration>(
+        std::chrono::duration<double, std::milli>(wait_ms));
+  }
+
+  bool
+  should_flush (clock::time_point now, flush_reason &reason) const
+  {
+    if (pending.size () >= static_cast<size_t>(target)) {
+      reason = FLUSH_SIZE;
+      return true;
+    }
+
+    if (!pending.empty () && now >= deadline ()) {
+      reason = FLUSH_DEADLINE;
+      return true;
+    }
+
+    return false;
+  }
+
+  /* Removes the frames of the next batch, oldest first, and returns
+   * their arrival times
+   */
+  std::vector<clock::time_point>
+  take ()
+  {
+    size_t count = std::min (pending.size (), static_cast<size_t>(target));
+    std::vector<clock::time_point> batch (pending.begin (), pending.begin () + count);
+    pending.erase (pending.begin (), pending.begin () + count);
+    backlogged = pending.size () >= static_cast<size_t>(target);
+    return batch;
+  }
+
+  /* Accounts a processed batch and adapts the target size */
+  void
+  completed (const std::vector<clock::time_point> &batch, clock::time_point done,
+      double batch_ms, flush_reason reason)
+  {
+    if (batch.empty ()) {
+      return;
+    }
+
+    for (auto arrival: batch) {
+      vx_uint64 latency = std::chrono::duration_cast<std::chrono::nanoseconds>(done - arrival).count ();
+      histogram.record (latency);
+      window.record (latency);
+    }
+
+    /* Smoothed cost per image, to predict how long a full batch takes */
+    double batch_image_ms = batch_ms/batch.size ();
+    image_ms = 0 == batches ? batch_image_ms : 0.8*image_ms + 0.2*batch_image_ms;
+
+    batches++;
+    frames += batch.size ();
+    last_reason = reason;
+    if (FLUSH_SIZE == reason) {
+      size_flushes++;
+      recent_size++;
+    } else {
+      deadline_flushes++;
+      recent_deadline++;
+    }
+    recent_backlog += backlogged;
+
+    if (0 != batches % adapt_every) {
+      return;
+    }
+
+    double p99_ms = window.percentile (99)/1000000.0;
+    if (2*recent_backlog > adapt_every) {
+      target = std::min (max_size, 2*target);
+    } else if (p99_ms > budget_ms) {
+      target = std::max (1, target/2);
+    } else if (p99_ms < 0.8*budget_ms && recent_size > recent_deadline) {
+      target = std::min (max_size, target + 1);
+    }
+    /* Judge the next size on its own samples only */
+    window = sliding_window (window_size);
+    recent_size = 0;
+    recent_deadline = 0;
+    recent_backlog = 0;
+    min_target = std::min (min_target, target);
+    max_target = std::max (max_target, target);
+  }
+
+  int
+  batch_size () const
+  {
+    return target;
+  }
+
+  void
+  report () const
+  {
+    std::cout << "Adaptive batching:" << std::endl;
+    std::cout << "\tLatency budget (p99): " << budget_ms << "ms" << std::endl;
+    std::cout << "\tCurrent batch size: " << target << " (range " << min_target << " to "
+              << max_target << ", max " << max_size << ")" << std::endl;
+    std::cout << "\tBatches: " << batches << std::endl;
+    if (batches > 0) {
+      std::cout << "\tAverage batch size: " << static_cast<double>(frames)/batches << std::endl;
+      std::cout << "\tLast flush reason: " << (FLUSH_SIZE == last_reason ? "size" : "deadline") << std::endl;
+    }
+    std::cout << "\tFlushes by size: " << size_flushes << std::endl;
+    std::cout << "\tFlushes by deadline: " << deadline_flushes << std::endl;
+    std::cout << "\tFrames dropped: " << dropped << std::endl;
+    std::cout << "\tEstimated time per image: " << image_ms << "ms" << std::endl;
+    std::cout << "\tp50: " << histogram.percentile (50)/1000000.0 << "ms" << std::endl;
+    std::cout << "\tp99: " << histogram.percentile (99)/1000000.0 << "ms" << std::endl;
+    std::cout << "\tMax: " << histogram.max ()/1000000.0 << "ms" << std::endl;
+    std::cout << "\t---" << std::endl;
+  }
+
+private:
+  /* Batches between two adjustments of the target size */
+  static const int adapt_every = 8;
+  static const size_t window_size = 256;
+
+  const int max_size;
+  const int max_pending;
+  const double budget_ms;
+  int target;
+  double image_ms;
+  std::deque<clock::time_point> pending;
+  latency_histogram histogram;
+  sliding_window window;
+  long batches;
+  long frames;
+  long dropped;
+  long size_flushes;
+  long deadline_flushes;
+  /* Whether a full batch was still waiting after the last flush */
+  bool backlogged;
+  int recent_size;
+  int recent_deadline;
+  int recent_backlog;
+  int min_target;
+  int max_target;
+  flush_reason last_reason;
+};
+
+#endif // VX_TRAINING_BATCHER_H
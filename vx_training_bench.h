@@ -0,0 +1,203 @@
+/* Copyright (C) 2022 RidgeRun, LLC (http://www.ridgerun.com)
+ * All Rights Reserved.
+ *
+ * The contents of this software are proprietary and confidential to RidgeRun,
+ * LLC.  No part of this program may be photocopied, reproduced or translated
+ * into another programming language without prior written consent of
+ * RidgeRun, LLC.  The user is free to modify the source code after obtaining
+ * a software license from RidgeRun.  All source code changes must be provided
+ * back to RidgeRun without any encumbrance.
+ */
+
+#ifndef VX_TRAINING_BENCH_H
+#define VX_TRAINING_BENCH_H
+
+/* Headless benchmark mode shared by the streaming examples. When
+ * enabled, the examples don't open any window nor pace the loop with
+ * cv::waitKey, they process frames as fast as possible and report
+ * throughput, latency and CPU usage.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <sys/resource.h>
+
+/* getopt flags reserved for the benchmark, to be appended to the
+ * example's own option string.
+ */
+#define BENCHMARK_OPTIONS "b:s:w:"
+
+#define BENCHMARK_USAGE \
+  "\t-b: headless benchmark, process the given amount of frames\n" \
+  "\t-s: headless benchmark, process frames for the given amount of seconds\n" \
+  "\t-w: frames to discard before measuring in benchmark mode (default 10)\n"
+
+class benchmark
+{
+public:
+  benchmark () : frames (0), seconds (0), warmup (10), warmed (0), measured (0),
+    latency_sum (0), latency_min (0), latency_max (0), cpu_start (0) {}
+
+  /* Handles one of the BENCHMARK_OPTIONS flags. Returns false if opt
+   * is not a benchmark flag or its argument is invalid.
+   */
+  bool
+  parse_option (int opt, const char *arg)
+  {
+    switch (opt) {
+    case 'b':
+      frames = atoi (arg);
+      return frames > 0;
+    case 's':
+      seconds = atof (arg);
+      return seconds > 0;
+    case 'w':
+      warmup = atoi (arg);
+      return warmup >= 0;
+    default:
+      return false;
+    }
+  }
+
+  bool
+  enabled () const
+  {
+    return frames > 0 || seconds > 0;
+  }
+
+  /* Must be called right before the first frame is processed */
+  void
+  begin ()
+  {
+    warmed = 0;
+    measured = 0;
+    latency_sum = 0;
+    latency_min = 0;
+    latency_max = 0;
+    if (0 == warmup) {
+      start ();
+    }
+  }
+
+  /* Accounts a processed frame. Frames are discarded until the warm-up
+   * is complete.
+   */
+  void
+  add_frame (double latency_ms)
+  {
+    if (warmed < warmup) {
+      warmed++;
+      if (warmed == warmup) {
+        start ();
+      }
+      return;
+    }
+
+    if (0 == measured || latency_ms < latency_min) {
+      latency_min = latency_ms;
+    }
+    latency_max = std::max (latency_max, latency_ms);
+    latency_sum += latency_ms;
+    measured++;
+  }
+
+  bool
+  done () const
+  {
+    if (warmed < warmup) {
+      return false;
+    }
+
+    if (frames > 0 && measured >= frames) {
+      return true;
+    }
+
+    return seconds > 0 && wall_ms () >= seconds*1000.0;
+  }
+
+  /* Measured frames per second */
+  double
+  throughput () const
+  {
+    double wall = wall_ms ();
+    return wall > 0 ? measured*1000.0/wall : 0;
+  }
+
+  /* Measured latencies, in milliseconds */
+  double
+  average_latency () const
+  {
+    return measured > 0 ? latency_sum/measured : 0;
+  }
+
+  double
+  maximum_latency () const
+  {
+    return latency_max;
+  }
+
+  void
+  report () const
+  {
+    double wall = wall_ms ();
+    double cpu = cpu_ms () - cpu_start;
+
+    std::cout << "Benchmark:" << std::endl;
+    std::cout << "\tWarm-up frames: " << warmed << std::endl;
+    std::cout << "\tMeasured frames: " << measured << std::endl;
+    std::cout << "\tWall time: " << wall << "ms" << std::endl;
+    if (measured > 0) {
+      std::cout << "\tThroughput: " << throughput () << "fps" << std::endl;
+      std::cout << "\tAverage latency: " << average_latency () << "ms" << std::endl;
+      std::cout << "\tMinimum latency: " << latency_min << "ms" << std::endl;
+      std::cout << "\tMaximum latency: " << latency_max << "ms" << std::endl;
+      std::cout << "\tCPU time per frame: " << cpu/measured << "ms" << std::endl;
+    }
+    std::cout << "\tCPU time: " << cpu << "ms" << std::endl;
+    std::cout << "\tCPU utilization: " << (wall > 0 ? cpu/wall : 0) << " cores" << std::endl;
+    std::cout << "\t---" << std::endl;
+  }
+
+  int frames;
+  double seconds;
+  int warmup;
+
+private:
+  /* User plus system time of every thread in the process, including
+   * the ones owned by the OpenVX implementation.
+   */
+  static double
+  cpu_ms ()
+  {
+    struct rusage usage;
+    getrusage (RUSAGE_SELF, &usage);
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec)*1000.0 +
+        (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec)/1000.0;
+  }
+
+  double
+  wall_ms () const
+  {
+    return std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now () - wall_start).count ();
+  }
+
+  void
+  start ()
+  {
+    wall_start = std::chrono::steady_clock::now ();
+    cpu_start = cpu_ms ();
+  }
+
+  int warmed;
+  int measured;
+  double latency_sum;
+  double latency_min;
+  double latency_max;
+  std::chrono::steady_clock::time_point wall_start;
+  double cpu_start;
+};
+
+#endif // VX_TRAINING_BENCH_H
@@ -0,0 +1,289 @@
+/* Copyright (C) 2022 RidgeRun, LLC (http://www.ridgerun.com)
+ * All Rights Reserved.
+ *
+ * The contents of this software are proprietary and confidential to RidgeRun,
+ * LLC.  No part of this program may be photocopied, reproduced or translated
+ * into another programming language without prior written consent of
+ * RidgeRun, LLC.  The user is free to modify the source code after obtaining
+ * a software license from RidgeRun.  All source code changes must be provided
+ * back to RidgeRun without any encumbrance.
+ */
+
+#ifndef VX_TRAINING_CORO_H
+#define VX_TRAINING_CORO_H
+
+/* Awaitable graph parameter queues. Instead of blocking the calling
+ * thread in vxGraphParameterDequeueDoneRef(), a coroutine does
+ *
+ *   vx_reference ref = co_await graph.dequeue (param);
+ *
+ * and is suspended until the graph releases a reference on that
+ * parameter. A single thread runs the event loop, which waits for the
+ * graph completion events of the context and resumes the coroutines
+ * whose references became available. That way one thread drives as many
+ * pipelines as needed, instead of one blocked thread per pipeline.
+ *
+ * Only the tasks given to the loop may await. They are run until their
+ * first await by run(), and are resumed from it too, so everything runs
+ * on the thread that called run().
+ *
+ * Requires C++20 and the events of the pipelining extension.
+ */
+
+#if __cplusplus < 202002L
+#error "vx_training_coro.h requires C++20"
+#endif
+
+#include <coroutine>
+#include <cstdlib>
+#include <iostream>
+#include <utility>
+#include <vector>
+#include <VX/vx_khr_pipelining.h>
+#include <VX/vx.h>
+
+/* A coroutine run by the graph loop. It co_returns 0 on success and
+ * -1 on error.
+ */
+class graph_task
+{
+public:
+  struct promise_type
+  {
+    int result = -1;
+
+    graph_task
+    get_return_object ()
+    {
+      return graph_task (std::coroutine_handle<promise_type>::from_promise (*this));
+    }
+
+    /* Started by the loop, and kept around after finishing so the
+     * result can be read
+     */
+    std::suspend_always initial_suspend () noexcept { return {}; }
+    std::suspend_always final_suspend () noexcept { return {}; }
+
+    void
+    return_value (int value)
+    {
+      result = value;
+    }
+
+    void
+    unhandled_exception ()
+    {
+      std::abort ();
+    }
+  };
+
+  explicit graph_task (std::coroutine_handle<promise_type> handle) : handle (handle) {}
+
+  graph_task (graph_task &&other) : handle (std::exchange (other.handle, nullptr)) {}
+
+  graph_task (const graph_task &) = delete;
+  graph_task &operator= (const graph_task &) = delete;
+
+  ~graph_task ()
+  {
+    if (handle) {
+      handle.destroy ();
+    }
+  }
+
+  std::coroutine_handle<promise_type> handle;
+};
+
+class graph_loop;
+
+/* A pipelined graph whose parameter queues can be awaited */
+class async_graph
+{
+public:
+  struct dequeue_awaiter
+  {
+    async_graph &graph;
+    vx_uint32 parameter;
+
+    bool
+    await_ready () const
+    {
+      return graph.available (parameter);
+    }
+
+    void await_suspend (std::coroutine_handle<> handle);
+
+    /* The reference is available by now, so this doesn't block.
+     * Returns NULL on error.
+     */
+    vx_reference
+    await_resume () const
+    {
+      vx_reference ref = NULL;
+      vx_uint32 num_refs = 0;
+      vx_status status = vxGraphParameterDequeueDoneRef (graph.graph, parameter, &ref, 1, &num_refs);
+      if (VX_SUCCESS != status || 0 == num_refs) {
+        std::cerr << "vx-training: Unable to dequeue from parameter " << parameter << ": " << status << std::endl;
+        return NULL;
+      }
+
+      return ref;
+    }
+  };
+
+  async_graph (graph_loop &loop, vx_graph graph, vx_uint32 id) : loop (loop), graph (graph), id (id) {}
+
+  vx_status
+  enqueue (vx_uint32 parameter, vx_reference ref)
+  {
+    return vxGraphParameterEnqueueReadyRef (graph, parameter, &ref, 1);
+  }
+
+  dequeue_awaiter
+  dequeue (vx_uint32 parameter)
+  {
+    return dequeue_awaiter { *this, parameter };
+  }
+
+  bool
+  available (vx_uint32 parameter) const
+  {
+    vx_uint32 num_refs = 0;
+    vxGraphParameterCheckDoneRef (graph, parameter, &num_refs);
+    return num_refs > 0;
+  }
+
+  graph_loop &loop;
+  vx_graph graph;
+  /* Passed as the application value of the graph events */
+  vx_uint32 id;
+};
+
+class graph_loop
+{
+public:
+  explicit graph_loop (vx_context context) : context (context), events (false) {}
+
+  /* The graph must not be verified yet, events are registered before
+   * verification. The returned object lives as long as the loop.
+   */
+  async_graph *
+  add (vx_graph graph)
+  {
+    if (!events) {
+      vx_status status = vxEnableEvents (context);
+      if (VX_SUCCESS != status) {
+        std::cerr << "vx-training: Unable to enable events: " << status << std::endl;
+        return NULL;
+      }
+      events = true;
+    }
+
+    vx_uint32 id = graphs.size ();
+    vx_status status = vxRegisterEvent ((vx_reference)graph, VX_EVENT_GRAPH_COMPLETED, 0, id);
+    if (VX_SUCCESS != status) {
+      std::cerr << "vx-training: Unable to register graph completion event: " << status << std::endl;
+      return NULL;
+    }
+
+    graphs.push_back (new async_graph (*this, graph, id));
+    waiters.resize (graphs.size ());
+    return graphs.back ();
+  }
+
+  void
+  spawn (graph_task task)
+  {
+    tasks.push_back (std::move (task));
+  }
+
+  /* Runs every task to completion. Returns 0 if all of them succeeded
+   * and -1 otherwise.
+   */
+  int
+  run ()
+  {
+    size_t running = 0;
+    for (auto &task: tasks) {
+      task.handle.resume ();
+      running += !task.handle.done ();
+    }
+
+    while (running > 0) {
+      vx_event_t event;
+      vx_status status = vxWaitEvent (context, &event, vx_false_e);
+      if (VX_SUCCESS != status) {
+        std::cerr << "vx-training: Unable to wait for events: " << status << std::endl;
+        return -1;
+      }
+
+      if (VX_EVENT_GRAPH_COMPLETED != event.type || event.app_value >= graphs.size ()) {
+        continue;
+      }
+
+      /* Resuming may add waiters back to the same graph */
+      std::vector<waiter> ready;
+      auto &graph_waiters = waiters[event.app_value];
+      for (size_t i = 0; i < graph_waiters.size ();) {
+        if (graphs[event.app_value]->available (graph_waiters[i].parameter)) {
+          ready.push_back (graph_waiters[i]);
+          graph_waiters.erase (graph_waiters.begin () + i);
+        } else {
+          i++;
+        }
+      }
+
+      for (auto &w: ready) {
+        w.handle.resume ();
+        running -= w.handle.done ();
+      }
+    }
+
+    int ret = 0;
+    for (auto &task: tasks) {
+      ret = 0 != task.handle.promise ().result ? -1 : ret;
+    }
+    tasks.clear ();
+
+    return ret;
+  }
+
+  ~graph_loop ()
+  {
+    for (auto graph: graphs) {
+      delete graph;
+    }
+    if (events) {
+      vxDisableEvents (context);
+    }
+  }
+
+private:
+  friend struct async_graph::dequeue_awaiter;
+
+  struct waiter
+  {
+    vx_uint32 parameter;
+    std::coroutine_handle<> handle;
+  };
+
+  void
+  wait (vx_uint32 id, vx_uint32 parameter, std::coroutine_handle<> handle)
+  {
+    waiters[id].push_back (waiter { parameter, handle });
+  }
+
+  vx_context context;
+  bool events;
+  std::vector<async_graph *> graphs;
+  std::vector<std::vector<waiter>> waiters;
+  std::vector<graph_task> tasks;
+};
+
+inline void
+async_graph::dequeue_awaiter::await_suspend (std::coroutine_handle<> handle)
+{
+  graph.loop.wait (graph.id, parameter, handle);
+}
+
+#endif // VX_TRAINING_CORO_H
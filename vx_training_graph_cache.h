@@ -0,0 +1,199 @@
+/* Copyright (C) 2022 RidgeRun, LLC (http://www.ridgerun.com)
+ * All Rights Reserved.
+ *
+ * The contents of this software are proprietary and confidential to RidgeRun,
+ * LLC.  No part of this program may be photocopied, reproduced or translated
+ * into another programming language without prior written consent of
+ * RidgeRun, LLC.  The user is free to modify the source code after obtaining
+ * a software license from RidgeRun.  All source code changes must be provided
+ * back to RidgeRun without any encumbrance.
+ */
+
+#ifndef VX_TRAINING_GRAPH_CACHE_H
+#define VX_TRAINING_GRAPH_CACHE_H
+
+/* Cache of verified graphs on disk, built on the import/export
+ * extension. The first run builds and verifies the graph as usual and
+ * exports it. The following runs import it instead, skipping the
+ * verification, which is where most of the startup time goes.
+ *
+ * Cache files are named after a hash of the description of the graph
+ * given by the example (nodes, image sizes and formats) and of the
+ * vendor, version and name of the OpenVX implementation. Changing any of
+ * them misses the cache instead of importing a graph that doesn't fit.
+ *
+ * The objects the application reads and writes, such as the input and
+ * output images, are not stored. They are created by the application on
+ * every run and bound to the graph on import.
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <unistd.h>
+#include <vector>
+#include <VX/vx_khr_ix.h>
+#include <VX/vx.h>
+
+class graph_cache
+{
+public:
+  explicit graph_cache (const std::string &dir) : dir (dir), import (NULL), imported (false) {}
+
+  ~graph_cache ()
+  {
+    /* Holds the imported objects, the graph was retained on load */
+    if (NULL != import) {
+      vxReleaseImport (&import);
+    }
+  }
+
+  /* Adds a line to the description of the graph, e.g. "input: 1920x1080 RGB" */
+  void
+  describe (const std::string &field)
+  {
+    description += field + "\n";
+  }
+
+  /* Cache file of the graph described so far */
+  std::string
+  path (vx_context context) const
+  {
+    vx_uint16 vendor = 0;
+    vx_uint16 version = 0;
+    vx_char implementation[VX_MAX_IMPLEMENTATION_NAME] = { 0 };
+    vxQueryContext (context, VX_CONTEXT_VENDOR_ID, &vendor, sizeof (vendor));
+    vxQueryContext (context, VX_CONTEXT_VERSION, &version, sizeof (version));
+    vxQueryContext (context, VX_CONTEXT_IMPLEMENTATION, implementation, sizeof (implementation));
+
+    std::string key = description + "vendor: " + std::to_string (vendor) + "\nversion: " +
+        std::to_string (version) + "\nimplementation: " +
+        std::string (implementation, strnlen (implementation, sizeof (implementation)));
+
+    /* FNV-1a */
+    vx_uint64 hash = 14695981039346656037ULL;
+    for (unsigned char c: key) {
+      hash = (hash ^ c)*1099511628211ULL;
+    }
+
+    char name[32];
+    snprintf (name, sizeof (name), "%016llx.vxg", static_cast<unsigned long long>(hash));
+    return dir + "/" + name;
+  }
+
+  /* Imports the cached graph and binds it to the given objects, in the
+   * same order they were stored with. Returns NULL if the graph isn't
+   * cached or can't be imported, the caller then builds it as usual.
+   * The returned graph is verified and must be released by the caller.
+   */
+  vx_graph
+  load (vx_context context, const std::vector<vx_reference> &objects)
+  {
+    std::string file = path (context);
+    std::ifstream in (file, std::ios::binary);
+    if (!in) {
+      return NULL;
+    }
+    std::vector<vx_uint8> blob ((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+    std::vector<vx_reference> refs (1, NULL);
+    refs.insert (refs.end (), objects.begin (), objects.end ());
+    std::vector<vx_enum> uses = usages (objects.size ());
+
+    import = vxImportObjectsFromMemory (context, refs.size (), refs.data (), uses.data (),
+        blob.data (), blob.size ());
+    vx_status status = vxGetStatus ((vx_reference)import);
+    if (VX_SUCCESS != status || NULL == refs[0]) {
+      std::cerr << "vx-training: Unable to import cached graph " << file << ", rebuilding it: "
+                << status << std::endl;
+      if (VX_SUCCESS == status) {
+        vxReleaseImport (&import);
+      }
+      import = NULL;
+      return NULL;
+    }
+
+    vxRetainReference (refs[0]);
+    imported = true;
+    return (vx_graph)refs[0];
+  }
+
+  /* Exports a verified graph, to be loaded with the same objects */
+  int
+  store (vx_context context, vx_graph graph, const std::vector<vx_reference> &objects)
+  {
+    std::vector<vx_reference> refs (1, (vx_reference)graph);
+    refs.insert (refs.end (), objects.begin (), objects.end ());
+    std::vector<vx_enum> uses = usages (objects.size ());
+
+    const vx_uint8 *blob = NULL;
+    vx_size length = 0;
+    vx_status status = vxExportObjectsToMemory (context, refs.size (), refs.data (), uses.data (),
+        &blob, &length);
+    if (VX_SUCCESS != status) {
+      std::cerr << "vx-training: Unable to export graph: " << status << std::endl;
+      return -1;
+    }
+
+    /* Written to a file of its own and renamed, so a concurrent start
+     * never reads a partial file, and concurrent exports never write to
+     * the same one
+     */
+    std::string file = path (context);
+    std::vector<char> tmp (file.begin (), file.end ());
+    const char suffix[] = ".XXXXXX";
+    tmp.insert (tmp.end (), suffix, suffix + sizeof (suffix));
+    int fd = mkstemp (tmp.data ());
+    if (fd < 0) {
+      std::cerr << "vx-training: Unable to create cached graph " << file << std::endl;
+      vxReleaseExportedMemory (context, &blob);
+      return -1;
+    }
+
+    bool written = true;
+    for (vx_size done = 0; written && done < length;) {
+      ssize_t ret = write (fd, blob + done, length - done);
+      written = ret > 0 || (ret < 0 && EINTR == errno);
+      done += ret > 0 ? ret : 0;
+    }
+    written = 0 == close (fd) && written;
+    vxReleaseExportedMemory (context, &blob);
+
+    if (!written || 0 != std::rename (tmp.data (), file.c_str ())) {
+      std::cerr << "vx-training: Unable to write cached graph " << file << std::endl;
+      std::remove (tmp.data ());
+      return -1;
+    }
+
+    return 0;
+  }
+
+  /* Whether the last load imported the graph */
+  bool
+  hit () const
+  {
+    return imported;
+  }
+
+private:
+  /* The graph is stored whole, the objects are left to the application */
+  static std::vector<vx_enum>
+  usages (size_t objects)
+  {
+    std::vector<vx_enum> uses (1, VX_IX_USE_EXPORT_VALUES);
+    uses.insert (uses.end (), objects, VX_IX_USE_APPLICATION_CREATE);
+    return uses;
+  }
+
+  const std::string dir;
+  std::string description;
+  vx_import import;
+  bool imported;
+};
+
+#endif // VX_TRAINING_GRAPH_CACHE_H
@@ -0,0 +1,226 @@
+/* Copyright (C) 2022 RidgeRun, LLC (http://www.ridgerun.com)
+ * All Rights Reserved.
+ *
+ * The contents of this software are proprietary and confidential to RidgeRun,
+ * LLC.  No part of this program may be photocopied, reproduced or translated
+ * into another programming language without prior written consent of
+ * RidgeRun, LLC.  The user is free to modify the source code after obtaining
+ * a software license from RidgeRun.  All source code changes must be provided
+ * back to RidgeRun without any encumbrance.
+ */
+
+#ifndef VX_TRAINING_HANDLES_H
+#define VX_TRAINING_HANDLES_H
+
+/* Move-only owners of OpenVX objects, shared by the C++ examples. A
+ * handle is the size of the raw vx_* pointer it holds and releases it
+ * with the release function of its type when it goes out of scope, as
+ * std::unique_ptr would. There is no control block nor reference count,
+ * so wrapping an object costs no allocation:
+ *
+ *   vx::Image image = vx::wrap (vxCreateImage (context, 640, 480, VX_DF_IMAGE_U8));
+ *   vx_uint32 width = vx::query<vx_uint32> (image, VX_IMAGE_WIDTH);
+ *
+ * Handles convert implicitly to the raw type, so they can be passed
+ * straight to the OpenVX API. get() is there for the casts to
+ * vx_reference.
+ */
+
+#include <cstddef>
+#include <initializer_list>
+#include <vector>
+#include <VX/vx.h>
+
+namespace vx
+{
+
+inline vx_status release (vx_reference *ref) { return vxReleaseReference (ref); }
+inline vx_status release (vx_context *ref) { return vxReleaseContext (ref); }
+inline vx_status release (vx_graph *ref) { return vxReleaseGraph (ref); }
+inline vx_status release (vx_node *ref) { return vxReleaseNode (ref); }
+inline vx_status release (vx_kernel *ref) { return vxReleaseKernel (ref); }
+inline vx_status release (vx_parameter *ref) { return vxReleaseParameter (ref); }
+inline vx_status release (vx_image *ref) { return vxReleaseImage (ref); }
+inline vx_status release (vx_matrix *ref) { return vxReleaseMatrix (ref); }
+inline vx_status release (vx_scalar *ref) { return vxReleaseScalar (ref); }
+inline vx_status release (vx_array *ref) { return vxReleaseArray (ref); }
+inline vx_status release (vx_object_array *ref) { return vxReleaseObjectArray (ref); }
+
+template<typename T>
+class handle
+{
+public:
+  handle () : ref (NULL) {}
+  handle (std::nullptr_t) : ref (NULL) {}
+  explicit handle (T ref) : ref (ref) {}
+
+  handle (handle &&other) noexcept : ref (other.release ()) {}
+
+  handle &
+  operator= (handle &&other) noexcept
+  {
+    reset (other.release ());
+    return *this;
+  }
+
+  handle (const handle &) = delete;
+  handle &operator= (const handle &) = delete;
+
+  ~handle ()
+  {
+    reset ();
+  }
+
+  T
+  get () const
+  {
+    return ref;
+  }
+
+  operator T () const
+  {
+    return ref;
+  }
+
+  /* Gives up ownership without releasing the object */
+  T
+  release ()
+  {
+    T other = ref;
+    ref = NULL;
+    return other;
+  }
+
+  void
+  reset (T other = NULL)
+  {
+    if (NULL != ref) {
+      vx::release (&ref);
+    }
+    ref = other;
+  }
+
+  /* Also reports the errors of the call that created the object */
+  vx_status
+  status () const
+  {
+    return vxGetStatus ((vx_reference)ref);
+  }
+
+private:
+  T ref;
+};
+
+typedef handle<vx_reference> Reference;
+typedef handle<vx_context> Context;
+typedef handle<vx_graph> Graph;
+typedef handle<vx_node> Node;
+typedef handle<vx_kernel> Kernel;
+typedef handle<vx_parameter> Parameter;
+typedef handle<vx_image> Image;
+typedef handle<vx_matrix> Matrix;
+typedef handle<vx_scalar> Scalar;
+typedef handle<vx_array> Array;
+typedef handle<vx_object_array> ObjectArray;
+
+/* Takes ownership of an object, the type is deduced from it */
+template<typename T>
+inline handle<T>
+wrap (T ref)
+{
+  return handle<T> (ref);
+}
+
+/* Takes ownership of several objects at once, in order. Braced lists
+ * can't hold move-only handles, but they can hold the raw objects:
+ *
+ *   nodes = vx::wrap_all ({ vxChannelExtractNode (...), vxWarpAffineNode (...) });
+ */
+template<typename T>
+inline std::vector<handle<T>>
+wrap_all (std::initializer_list<T> refs)
+{
+  std::vector<handle<T>> handles;
+  handles.reserve (refs.size ());
+  for (T ref: refs) {
+    handles.push_back (handle<T> (ref));
+  }
+  return handles;
+}
+
+/* Typed attribute queries, V () if the query fails */
+template<typename V>
+inline V
+query (vx_context ref, vx_enum attribute)
+{
+  V value = V ();
+  vxQueryContext (ref, attribute, &value, sizeof (value));
+  return value;
+}
+
+template<typename V>
+inline V
+query (vx_graph ref, vx_enum attribute)
+{
+  V value = V ();
+  vxQueryGraph (ref, attribute, &value, sizeof (value));
+  return value;
+}
+
+template<typename V>
+inline V
+query (vx_node ref, vx_enum attribute)
+{
+  V value = V ();
+  vxQueryNode (ref, attribute, &value, sizeof (value));
+  return value;
+}
+
+template<typename V>
+inline V
+query (vx_image ref, vx_enum attribute)
+{
+  V value = V ();
+  vxQueryImage (ref, attribute, &value, sizeof (value));
+  return value;
+}
+
+template<typename V>
+inline V
+query (vx_matrix ref, vx_enum attribute)
+{
+  V value = V ();
+  vxQueryMatrix (ref, attribute, &value, sizeof (value));
+  return value;
+}
+
+/* Bulk creation. Check the status of each object, as with the single
+ * creation functions.
+ */
+inline std::vector<Image>
+create_images (vx_context context, size_t count, vx_uint32 width, vx_uint32 height,
+    vx_df_image format)
+{
+  std::vector<Image> images;
+  images.reserve (count);
+  for (size_t i = 0; i < count; i++) {
+    images.push_back (wrap (vxCreateImage (context, width, height, format)));
+  }
+  return images;
+}
+
+inline std::vector<Matrix>
+create_matrices (vx_context context, size_t count, vx_enum data_type, vx_size columns,
+    vx_size rows)
+{
+  std::vector<Matrix> matrices;
+  matrices.reserve (count);
+  for (size_t i = 0; i < count; i++) {
+    matrices.push_back (wrap (vxCreateMatrix (context, data_type, columns, rows)));
+  }
+  return matrices;
+}
+
+}
+
+#endif // VX_TRAINING_HANDLES_H
@@ -0,0 +1,210 @@
+/* Copyright (C) 2022 RidgeRun, LLC (http://www.ridgerun.com)
+ * All Rights Reserved.
+ *
+ * The contents of this software are proprietary and confidential to RidgeRun,
+ * LLC.  No part of this program may be photocopied, reproduced or translated
+ * into another programming language without prior written consent of
+ * RidgeRun, LLC.  The user is free to modify the source code after obtaining
+ * a software license from RidgeRun.  All source code changes must be provided
+ * back to RidgeRun without any encumbrance.
+ */
+
+#ifndef VX_TRAINING_HISTOGRAM_H
+#define VX_TRAINING_HISTOGRAM_H
+
+/* Latency distributions built from the per-execution measurements in
+ * vx_perf_t. The cumulative values OpenVX keeps (avg, min, max) hide
+ * the tail, these keep every sample so percentiles can be reported.
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+#include <VX/vx.h>
+
+/* HDR-style histogram. Values are grouped by their most significant bit
+ * and each power of two is split in 2^sub_bits linear buckets, so the
+ * relative error is bounded (~3%) regardless of the magnitude, and the
+ * memory is fixed no matter how many samples are recorded.
+ */
+class latency_histogram
+{
+public:
+  static const int sub_bits = 5;
+  static const int sub_buckets = 1 << sub_bits;
+
+  latency_histogram () : counts ((64 - sub_bits + 1)*sub_buckets, 0), total (0), max_value (0) {}
+
+  void
+  record (vx_uint64 value)
+  {
+    counts[index (value)]++;
+    total++;
+    max_value = std::max (max_value, value);
+  }
+
+  /* Smallest value such that p percent of the samples are lower or
+   * equal, within the resolution of the bucket.
+   */
+  vx_uint64
+  percentile (double p) const
+  {
+    if (0 == total) {
+      return 0;
+    }
+
+    vx_uint64 target = static_cast<vx_uint64>(p/100.0*total + 0.5);
+    target = std::max<vx_uint64>(target, 1);
+
+    vx_uint64 seen = 0;
+    for (size_t i = 0; i < counts.size (); i++) {
+      seen += counts[i];
+      if (seen >= target) {
+        return std::min (upper_bound (i), max_value);
+      }
+    }
+
+    return max_value;
+  }
+
+  vx_uint64
+  count () const
+  {
+    return total;
+  }
+
+  vx_uint64
+  max () const
+  {
+    return max_value;
+  }
+
+private:
+  static size_t
+  index (vx_uint64 value)
+  {
+    if (value < static_cast<vx_uint64>(sub_buckets)) {
+      return value;
+    }
+
+    int msb = 63 - __builtin_clzll (value);
+    int shift = msb - sub_bits;
+    size_t sub = (value >> shift) & (sub_buckets - 1);
+    return ((shift + 1) << sub_bits) + sub;
+  }
+
+  static vx_uint64
+  upper_bound (size_t i)
+  {
+    if (i < static_cast<size_t>(sub_buckets)) {
+      return i;
+    }
+
+    int shift = (i >> sub_bits) - 1;
+    vx_uint64 sub = i & (sub_buckets - 1);
+    vx_uint64 lower = (static_cast<vx_uint64>(sub_buckets) + sub) << shift;
+    return lower + ((static_cast<vx_uint64>(1) << shift) - 1);
+  }
+
+  std::vector<vx_uint64> counts;
+  vx_uint64 total;
+  vx_uint64 max_value;
+};
+
+/* Exact statistics over the last window_size samples only, to follow
+ * how latency evolves during long runs.
+ */
+class sliding_window
+{
+public:
+  explicit sliding_window (size_t window_size) : samples (window_size), next (0), filled (0) {}
+
+  void
+  record (vx_uint64 value)
+  {
+    if (samples.empty ()) {
+      return;
+    }
+
+    samples[next] = value;
+    next = (next + 1) % samples.size ();
+    filled = std::min (filled + 1, samples.size ());
+  }
+
+  vx_uint64
+  percentile (double p) const
+  {
+    if (0 == filled) {
+      return 0;
+    }
+
+    std::vector<vx_uint64> sorted (samples.begin (), samples.begin () + filled);
+    size_t rank = static_cast<size_t>(p/100.0*(filled - 1) + 0.5);
+    std::nth_element (sorted.begin (), sorted.begin () + rank, sorted.end ());
+    return sorted[rank];
+  }
+
+  size_t
+  size () const
+  {
+    return filled;
+  }
+
+private:
+  std::vector<vx_uint64> samples;
+  size_t next;
+  size_t filled;
+};
+
+/* Tracks the latency of a graph or node by sampling its vx_perf_t
+ * after every execution.
+ */
+class latency_stats
+{
+public:
+  explicit latency_stats (size_t window_size = 0) : window (window_size), last_num (0) {}
+
+  /* Records the last measurement if the object was executed since the
+   * previous call. Returns false if there was nothing new.
+   */
+  bool
+  sample (const vx_perf_t &perf)
+  {
+    if (perf.num == last_num) {
+      return false;
+    }
+
+    last_num = perf.num;
+    histogram.record (perf.tmp);
+    window.record (perf.tmp);
+    return true;
+  }
+
+  void
+  print () const
+  {
+    std::cout << "\tSamples: " << histogram.count () << std::endl;
+    std::cout << "\tp50: " << histogram.percentile (50)/1000000.0 << "ms" << std::endl;
+    std::cout << "\tp90: " << histogram.percentile (90)/1000000.0 << "ms" << std::endl;
+    std::cout << "\tp99: " << histogram.percentile (99)/1000000.0 << "ms" << std::endl;
+    std::cout << "\tp99.9: " << histogram.percentile (99.9)/1000000.0 << "ms" << std::endl;
+    std::cout << "\tMax: " << histogram.max ()/1000000.0 << "ms" << std::endl;
+  }
+
+  void
+  print_window () const
+  {
+    std::cout << "\tSamples: " << window.size () << std::endl;
+    std::cout << "\tp50: " << window.percentile (50)/1000000.0 << "ms" << std::endl;
+    std::cout << "\tp99: " << window.percentile (99)/1000000.0 << "ms" << std::endl;
+    std::cout << "\tMax: " << window.percentile (100)/1000000.0 << "ms" << std::endl;
+  }
+
+  latency_histogram histogram;
+  sliding_window window;
+
+private:
+  vx_uint64 last_num;
+};
+
+#endif // VX_TRAINING_HISTOGRAM_H
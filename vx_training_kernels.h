@@ -0,0 +1,927 @@
+/* Copyright (C) 2022 RidgeRun, LLC (http://www.ridgerun.com)
+ * All Rights Reserved.
+ *
+ * The contents of this software are proprietary and confidential to RidgeRun,
+ * LLC.  No part of this program may be photocopied, reproduced or translated
+ * into another programming language without prior written consent of
+ * RidgeRun, LLC.  The user is free to modify the source code after obtaining
+ * a software license from RidgeRun.  All source code changes must be provided
+ * back to RidgeRun without any encumbrance.
+ */
+
+#ifndef VX_TRAINING_KERNELS_H
+#define VX_TRAINING_KERNELS_H
+
+/* User kernels that replace standard nodes, or chains of them, with
+ * faster host implementations. They are registered in the context with
+ * vxAddUserKernel and instantiated with vxCreateGenericNode, so they
+ * can be mixed with the standard nodes in any graph.
+ *
+ * The inner loops have SSSE3 and AVX2 versions, compiled through
+ * function target attributes and chosen at runtime from what the CPU
+ * supports, so the examples don't need any special compiler flags.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <VX/vx.h>
+
+#if defined(__x86_64__)
+#define VX_TRAINING_KERNELS_X86 1
+#include <immintrin.h>
+#endif
+
+/* Instruction sets the kernels know how to use, from worst to best */
+enum simd_level {
+  SIMD_SCALAR,
+  SIMD_SSSE3,
+  SIMD_AVX2,
+};
+
+static simd_level
+simd_detect ()
+{
+#ifdef VX_TRAINING_KERNELS_X86
+  __builtin_cpu_init ();
+  if (__builtin_cpu_supports ("avx2")) {
+    return SIMD_AVX2;
+  }
+  if (__builtin_cpu_supports ("ssse3")) {
+    return SIMD_SSSE3;
+  }
+#endif
+  return SIMD_SCALAR;
+}
+
+/* Instruction set used by the kernels. Defaults to the best one the
+ * CPU supports, lower it to compare against the simpler versions.
+ */
+static simd_level &
+kernels_simd ()
+{
+  static simd_level level = simd_detect ();
+  return level;
+}
+
+static const char *
+simd_name (simd_level level)
+{
+  switch (level) {
+  case SIMD_AVX2:
+    return "avx2";
+  case SIMD_SSSE3:
+    return "ssse3";
+  default:
+    return "scalar";
+  }
+}
+
+/* Channel extract */
+
+static void
+extract_row_scalar (const vx_uint8 *rgb, int channel, vx_uint8 *dst, int start, int width)
+{
+  for (int x = start; x < width; x++) {
+    dst[x] = rgb[3*x + channel];
+  }
+}
+
+#ifdef VX_TRAINING_KERNELS_X86
+/* 16 pixels are 48 interleaved bytes. Output byte i comes from byte
+ * 3*i + channel, so each of the three 16 byte loads contributes a few
+ * bytes through its own shuffle mask.
+ */
+static void __attribute__ ((target ("ssse3")))
+extract_row_ssse3 (const vx_uint8 *rgb, int channel, vx_uint8 *dst, int width)
+{
+  alignas (16) vx_uint8 masks[3][16];
+  for (int k = 0; k < 3; k++) {
+    for (int i = 0; i < 16; i++) {
+      int src = 3*i + channel - 16*k;
+      masks[k][i] = (src >= 0 && src < 16) ? src : 0x80;
+    }
+  }
+
+  const __m128i mask0 = _mm_load_si128 ((const __m128i *)masks[0]);
+  const __m128i mask1 = _mm_load_si128 ((const __m128i *)masks[1]);
+  const __m128i mask2 = _mm_load_si128 ((const __m128i *)masks[2]);
+
+  int x = 0;
+  for (; x + 16 <= width; x += 16) {
+    const vx_uint8 *src = rgb + 3*x;
+    __m128i a = _mm_loadu_si128 ((const __m128i *)src);
+    __m128i b = _mm_loadu_si128 ((const __m128i *)(src + 16));
+    __m128i c = _mm_loadu_si128 ((const __m128i *)(src + 32));
+
+    __m128i out = _mm_or_si128 (_mm_shuffle_epi8 (a, mask0),
+        _mm_or_si128 (_mm_shuffle_epi8 (b, mask1), _mm_shuffle_epi8 (c, mask2)));
+    _mm_storeu_si128 ((__m128i *)(dst + x), out);
+  }
+
+  extract_row_scalar (rgb, channel, dst, x, width);
+}
+#endif
+
+static void
+extract_row (const vx_uint8 *rgb, int channel, vx_uint8 *dst, int width, simd_level level)
+{
+#ifdef VX_TRAINING_KERNELS_X86
+  /* pshufb doesn't cross 128 bit lanes, AVX2 has nothing to add here */
+  if (level >= SIMD_SSSE3) {
+    extract_row_ssse3 (rgb, channel, dst, width);
+    return;
+  }
+#endif
+  extract_row_scalar (rgb, channel, dst, 0, width);
+}
+
+/* Gaussian 3x3, same weights and rounding as vxGaussian3x3Node:
+ *
+ *       [1 2 1]
+ * 1/16  [2 4 2]
+ *       [1 2 1]
+ *
+ * Rows r0 and r2 are the neighbours of r1, already clamped at the
+ * image borders. Columns are clamped here, which matches
+ * VX_BORDER_REPLICATE.
+ */
+static void
+gaussian_row_scalar (const vx_uint8 *r0, const vx_uint8 *r1, const vx_uint8 *r2,
+    vx_uint8 *dst, int start, int end, int width)
+{
+  for (int x = start; x < end; x++) {
+    int l = x > 0 ? x - 1 : 0;
+    int r = x + 1 < width ? x + 1 : width - 1;
+
+    int sum = r0[l] + 2*r0[x] + r0[r] +
+        2*(r1[l] + 2*r1[x] + r1[r]) +
+        r2[l] + 2*r2[x] + r2[r];
+    dst[x] = sum >> 4;
+  }
+}
+
+#ifdef VX_TRAINING_KERNELS_X86
+static inline __m128i
+gaussian_load8 (const vx_uint8 *ptr)
+{
+  return _mm_unpacklo_epi8 (_mm_loadl_epi64 ((const __m128i *)ptr), _mm_setzero_si128 ());
+}
+
+/* Horizontal [1 2 1] of 8 pixels widened to 16 bits */
+static inline __m128i
+gaussian_row8 (const vx_uint8 *row)
+{
+  __m128i sides = _mm_add_epi16 (gaussian_load8 (row - 1), gaussian_load8 (row + 1));
+  return _mm_add_epi16 (sides, _mm_slli_epi16 (gaussian_load8 (row), 1));
+}
+
+/* Returns the first column left to do */
+static int
+gaussian_row_sse (const vx_uint8 *r0, const vx_uint8 *r1, const vx_uint8 *r2,
+    vx_uint8 *dst, int x, int end)
+{
+  for (; x + 8 <= end; x += 8) {
+    __m128i sum = _mm_add_epi16 (_mm_add_epi16 (gaussian_row8 (r0 + x), gaussian_row8 (r2 + x)),
+        _mm_slli_epi16 (gaussian_row8 (r1 + x), 1));
+    __m128i out = _mm_packus_epi16 (_mm_srli_epi16 (sum, 4), _mm_setzero_si128 ());
+    _mm_storel_epi64 ((__m128i *)(dst + x), out);
+  }
+  return x;
+}
+
+static inline __m256i __attribute__ ((target ("avx2")))
+gaussian_load16 (const vx_uint8 *ptr)
+{
+  return _mm256_cvtepu8_epi16 (_mm_loadu_si128 ((const __m128i *)ptr));
+}
+
+static inline __m256i __attribute__ ((target ("avx2")))
+gaussian_row16 (const vx_uint8 *row)
+{
+  __m256i sides = _mm256_add_epi16 (gaussian_load16 (row - 1), gaussian_load16 (row + 1));
+  return _mm256_add_epi16 (sides, _mm256_slli_epi16 (gaussian_load16 (row), 1));
+}
+
+static int __attribute__ ((target ("avx2")))
+gaussian_row_avx2 (const vx_uint8 *r0, const vx_uint8 *r1, const vx_uint8 *r2,
+    vx_uint8 *dst, int x, int end)
+{
+  for (; x + 16 <= end; x += 16) {
+    __m256i sum = _mm256_add_epi16 (_mm256_add_epi16 (gaussian_row16 (r0 + x), gaussian_row16 (r2 + x)),
+        _mm256_slli_epi16 (gaussian_row16 (r1 + x), 1));
+    sum = _mm256_srli_epi16 (sum, 4);
+
+    /* packus works per lane, gather both halves in the low lane */
+    __m256i packed = _mm256_permute4x64_epi64 (_mm256_packus_epi16 (sum, sum), 0xd8);
+    _mm_storeu_si128 ((__m128i *)(dst + x), _mm256_castsi256_si128 (packed));
+  }
+  return x;
+}
+#endif
+
+static void
+gaussian_row (const vx_uint8 *r0, const vx_uint8 *r1, const vx_uint8 *r2,
+    vx_uint8 *dst, int width, simd_level level)
+{
+  /* The vector loops read one pixel to each side, leave the border
+   * columns to the scalar code.
+   */
+  int x = 1;
+  int end = width - 1;
+#ifdef VX_TRAINING_KERNELS_X86
+  if (level >= SIMD_AVX2) {
+    x = gaussian_row_avx2 (r0, r1, r2, dst, x, end);
+  }
+  if (level >= SIMD_SSSE3) {
+    x = gaussian_row_sse (r0, r1, r2, dst, x, end);
+  }
+#endif
+  gaussian_row_scalar (r0, r1, r2, dst, 0, std::min (1, width), width);
+  gaussian_row_scalar (r0, r1, r2, dst, x, width, width);
+}
+
+/* Extracts a channel of an interleaved RGB image and blurs it in a
+ * single pass. Only the last three extracted rows are kept, in a ring
+ * small enough to stay in L1, instead of a full size intermediate
+ * image that has to go through memory and be read back.
+ */
+static void
+channel_gaussian3x3 (const vx_uint8 *src, vx_int32 src_stride, int channel,
+    vx_uint8 *dst, vx_int32 dst_stride, int width, int height, simd_level level)
+{
+  std::vector<vx_uint8> ring (3*width);
+  auto row = [&] (int y) { return ring.data () + (y % 3)*width; };
+
+  extract_row (src, channel, row (0), width, level);
+  if (height > 1) {
+    extract_row (src + src_stride, channel, row (1), width, level);
+  }
+
+  for (int y = 0; y < height; y++) {
+    /* Row y+1 takes the slot of row y-2, which is not needed anymore */
+    if (y > 0 && y + 1 < height) {
+      extract_row (src + (y + 1)*src_stride, channel, row (y + 1), width, level);
+    }
+
+    gaussian_row (row (std::max (y - 1, 0)), row (y), row (std::min (y + 1, height - 1)),
+        dst + y*dst_stride, width, level);
+  }
+}
+
+#define CHANNEL_GAUSSIAN3X3_NAME "com.ridgerun.vx_training.channel_gaussian3x3"
+
+static vx_status VX_CALLBACK
+channel_gaussian3x3_validate (vx_node node, const vx_reference parameters[],
+    vx_uint32 num, vx_meta_format metas[])
+{
+  vx_image input = (vx_image)parameters[0];
+  vx_scalar channel_scalar = (vx_scalar)parameters[1];
+
+  vx_df_image format = VX_DF_IMAGE_VIRT;
+  vx_uint32 width = 0;
+  vx_uint32 height = 0;
+  vxQueryImage (input, VX_IMAGE_FORMAT, &format, sizeof (format));
+  vxQueryImage (input, VX_IMAGE_WIDTH, &width, sizeof (width));
+  vxQueryImage (input, VX_IMAGE_HEIGHT, &height, sizeof (height));
+  if (VX_DF_IMAGE_RGB != format) {
+    return VX_ERROR_INVALID_FORMAT;
+  }
+
+  vx_enum channel = 0;
+  vx_status status = vxCopyScalar (channel_scalar, &channel, VX_READ_ONLY, VX_MEMORY_TYPE_HOST);
+  if (VX_SUCCESS != status) {
+    return status;
+  }
+  if (VX_CHANNEL_R != channel && VX_CHANNEL_G != channel && VX_CHANNEL_B != channel) {
+    return VX_ERROR_INVALID_VALUE;
+  }
+
+  vx_df_image out_format = VX_DF_IMAGE_U8;
+  vxSetMetaFormatAttribute (metas[2], VX_IMAGE_FORMAT, &out_format, sizeof (out_format));
+  vxSetMetaFormatAttribute (metas[2], VX_IMAGE_WIDTH, &width, sizeof (width));
+  vxSetMetaFormatAttribute (metas[2], VX_IMAGE_HEIGHT, &height, sizeof (height));
+
+  return VX_SUCCESS;
+}
+
+static vx_status VX_CALLBACK
+channel_gaussian3x3_kernel (vx_node node, const vx_reference *parameters, vx_uint32 num)
+{
+  vx_image input = (vx_image)parameters[0];
+  vx_scalar channel_scalar = (vx_scalar)parameters[1];
+  vx_image output = (vx_image)parameters[2];
+
+  vx_enum channel = VX_CHANNEL_R;
+  vxCopyScalar (channel_scalar, &channel, VX_READ_ONLY, VX_MEMORY_TYPE_HOST);
+
+  vx_uint32 width = 0;
+  vx_uint32 height = 0;
+  vxQueryImage (output, VX_IMAGE_WIDTH, &width, sizeof (width));
+  vxQueryImage (output, VX_IMAGE_HEIGHT, &height, sizeof (height));
+
+  const vx_rectangle_t rect = { 0, 0, width, height };
+  vx_map_id in_map = 0;
+  vx_map_id out_map = 0;
+  vx_imagepatch_addressing_t in_addr = VX_IMAGEPATCH_ADDR_INIT;
+  vx_imagepatch_addressing_t out_addr = VX_IMAGEPATCH_ADDR_INIT;
+  vx_uint8 *in_ptr = NULL;
+  vx_uint8 *out_ptr = NULL;
+
+  vx_status status = vxMapImagePatch (input, &rect, 0, &in_map, &in_addr, (void **)&in_ptr,
+      VX_READ_ONLY, VX_MEMORY_TYPE_HOST, VX_NOGAP_X);
+  if (VX_SUCCESS != status) {
+    return status;
+  }
+
+  status = vxMapImagePatch (output, &rect, 0, &out_map, &out_addr, (void **)&out_ptr,
+      VX_WRITE_ONLY, VX_MEMORY_TYPE_HOST, VX_NOGAP_X);
+  if (VX_SUCCESS != status) {
+    vxUnmapImagePatch (input, in_map);
+    return status;
+  }
+
+  channel_gaussian3x3 (in_ptr, in_addr.stride_y, channel - VX_CHANNEL_R, out_ptr,
+      out_addr.stride_y, width, height, kernels_simd ());
+
+  vxUnmapImagePatch (output, out_map);
+  vxUnmapImagePatch (input, in_map);
+
+  return VX_SUCCESS;
+}
+
+/* Registers the fused ChannelExtract + Gaussian3x3 kernel in the
+ * context. Parameters are the RGB input, the channel to extract as a
+ * VX_TYPE_ENUM scalar, and the U8 output.
+ */
+static vx_status
+register_channel_gaussian3x3 (vx_context context)
+{
+  vx_enum id = 0;
+  vx_status status = vxAllocateUserKernelId (context, &id);
+  if (VX_SUCCESS != status) {
+    return status;
+  }
+
+  vx_kernel kernel = vxAddUserKernel (context, CHANNEL_GAUSSIAN3X3_NAME, id,
+      channel_gaussian3x3_kernel, 3, channel_gaussian3x3_validate, NULL, NULL);
+  status = vxGetStatus ((vx_reference)kernel);
+  if (VX_SUCCESS != status) {
+    return status;
+  }
+
+  vx_enum directions[] = { VX_INPUT, VX_INPUT, VX_OUTPUT };
+  vx_enum types[] = { VX_TYPE_IMAGE, VX_TYPE_SCALAR, VX_TYPE_IMAGE };
+  for (vx_uint32 i = 0; i < 3 && VX_SUCCESS == status; i++) {
+    status = vxAddParameterToKernel (kernel, i, directions[i], types[i],
+        VX_PARAMETER_STATE_REQUIRED);
+  }
+
+  if (VX_SUCCESS == status) {
+    status = vxFinalizeKernel (kernel);
+  }
+
+  if (VX_SUCCESS != status) {
+    vxRemoveKernel (kernel);
+  } else {
+    vxReleaseKernel (&kernel);
+  }
+
+  return status;
+}
+
+/* Same interface as vxChannelExtractNode, but the output is already
+ * blurred. The kernel must have been registered in the context.
+ */
+static vx_node
+channel_gaussian3x3_node (vx_graph graph, vx_image input, vx_enum channel, vx_image output)
+{
+  vx_context context = vxGetContext ((vx_reference)graph);
+  vx_kernel kernel = vxGetKernelByName (context, CHANNEL_GAUSSIAN3X3_NAME);
+  if (VX_SUCCESS != vxGetStatus ((vx_reference)kernel)) {
+    return NULL;
+  }
+
+  vx_node node = vxCreateGenericNode (graph, kernel);
+  vxReleaseKernel (&kernel);
+  if (VX_SUCCESS != vxGetStatus ((vx_reference)node)) {
+    return node;
+  }
+
+  /* The node keeps its own reference to the scalar */
+  vx_scalar channel_scalar = vxCreateScalar (context, VX_TYPE_ENUM, &channel);
+  vxSetParameterByIndex (node, 0, (vx_reference)input);
+  vxSetParameterByIndex (node, 1, (vx_reference)channel_scalar);
+  vxSetParameterByIndex (node, 2, (vx_reference)output);
+  vxReleaseScalar (&channel_scalar);
+
+  return node;
+}
+
+/* Fixed set of workers to split a kernel over rows. The calling thread
+ * takes the first chunk, so a pool of N threads runs N-1 workers.
+ */
+class thread_pool
+{
+public:
+  explicit thread_pool (unsigned threads) : generation (0), pending (0), stopping (false)
+  {
+    for (unsigned i = 1; i < std::max (threads, 1u); i++) {
+      workers.emplace_back (&thread_pool::work, this, i);
+    }
+  }
+
+  ~thread_pool ()
+  {
+    {
+      std::lock_guard<std::mutex> lock (mutex);
+      stopping = true;
+    }
+    wake.notify_all ();
+    for (auto &worker: workers) {
+      worker.join ();
+    }
+  }
+
+  unsigned
+  size () const
+  {
+    return workers.size () + 1;
+  }
+
+  /* Calls fn (begin, end) over contiguous chunks of [0, count), one per
+   * thread, and returns once all of them are done. Concurrent callers,
+   * e.g. nodes of graphs running in parallel, take turns.
+   */
+  void
+  parallel_for (int count, const std::function<void (int, int)> &fn)
+  {
+    std::lock_guard<std::mutex> busy (call);
+
+    {
+      std::lock_guard<std::mutex> lock (mutex);
+      task = fn;
+      task_count = count;
+      pending = workers.size ();
+      generation++;
+    }
+    wake.notify_all ();
+
+    run_chunk (0, count, fn);
+
+    std::unique_lock<std::mutex> lock (mutex);
+    done.wait (lock, [this] () { return 0 == pending; });
+  }
+
+private:
+  void
+  run_chunk (unsigned index, int count, const std::function<void (int, int)> &fn)
+  {
+    int begin = static_cast<long>(count)*index/size ();
+    int end = static_cast<long>(count)*(index + 1)/size ();
+    if (begin < end) {
+      fn (begin, end);
+    }
+  }
+
+  void
+  work (unsigned index)
+  {
+    unsigned long seen = 0;
+    while (true) {
+      std::function<void (int, int)> fn;
+      int count = 0;
+      {
+        std::unique_lock<std::mutex> lock (mutex);
+        wake.wait (lock, [&] () { return stopping || generation != seen; });
+        if (stopping) {
+          return;
+        }
+        seen = generation;
+        fn = task;
+        count = task_count;
+      }
+
+      run_chunk (index, count, fn);
+
+      std::lock_guard<std::mutex> lock (mutex);
+      if (0 == --pending) {
+        done.notify_one ();
+      }
+    }
+  }
+
+  std::vector<std::thread> workers;
+  std::mutex call;
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable done;
+  std::function<void (int, int)> task;
+  int task_count;
+  unsigned long generation;
+  size_t pending;
+  bool stopping;
+};
+
+/* Pool shared by the kernels, one thread per core by default */
+static std::unique_ptr<thread_pool> &
+kernels_pool_instance ()
+{
+  static std::unique_ptr<thread_pool> pool;
+  return pool;
+}
+
+static void
+set_kernels_threads (unsigned threads)
+{
+  kernels_pool_instance ().reset (new thread_pool (threads));
+}
+
+static thread_pool &
+kernels_pool ()
+{
+  if (!kernels_pool_instance ()) {
+    set_kernels_threads (std::max (std::thread::hardware_concurrency (), 1u));
+  }
+  return *kernels_pool_instance ();
+}
+
+/* Warp affine, same semantics as vxWarpAffineNode. Output pixel (x, y)
+ * samples the input at:
+ *
+ *   x0 = m[0][0]*x + m[1][0]*y + m[2][0]
+ *   y0 = m[0][1]*x + m[1][1]*y + m[2][1]
+ *
+ * Samples out of the input take the constant border value, or the
+ * nearest edge pixel with VX_BORDER_REPLICATE.
+ */
+struct warp_params {
+  const vx_uint8 *src;
+  vx_int32 src_stride;
+  int src_width;
+  int src_height;
+  vx_uint8 *dst;
+  vx_int32 dst_stride;
+  int dst_width;
+  vx_float32 mat[3][2];
+  vx_enum interpolation;
+  vx_enum border;
+  vx_uint8 constant;
+};
+
+static inline int
+warp_pixel (const warp_params &p, int x, int y)
+{
+  if (VX_BORDER_REPLICATE == p.border) {
+    x = std::min (std::max (x, 0), p.src_width - 1);
+    y = std::min (std::max (y, 0), p.src_height - 1);
+  } else if (x < 0 || y < 0 || x >= p.src_width || y >= p.src_height) {
+    return p.constant;
+  }
+  return p.src[y*p.src_stride + x];
+}
+
+static inline vx_uint8
+warp_bilinear (const warp_params &p, float x0, float y0)
+{
+  float xf = std::floor (x0);
+  float yf = std::floor (y0);
+  float s = x0 - xf;
+  float t = y0 - yf;
+  int xi = static_cast<int>(xf);
+  int yi = static_cast<int>(yf);
+
+  float p00 = warp_pixel (p, xi, yi);
+  float p10 = warp_pixel (p, xi + 1, yi);
+  float p01 = warp_pixel (p, xi, yi + 1);
+  float p11 = warp_pixel (p, xi + 1, yi + 1);
+
+  float top = p00 + s*(p10 - p00);
+  float bottom = p01 + s*(p11 - p01);
+  return static_cast<vx_uint8>(top + t*(bottom - top));
+}
+
+static void
+warp_row_scalar (const warp_params &p, int y, int start)
+{
+  float row_x = p.mat[1][0]*y + p.mat[2][0];
+  float row_y = p.mat[1][1]*y + p.mat[2][1];
+  vx_uint8 *dst = p.dst + y*p.dst_stride;
+
+  for (int x = start; x < p.dst_width; x++) {
+    float x0 = p.mat[0][0]*x + row_x;
+    float y0 = p.mat[0][1]*x + row_y;
+    if (VX_INTERPOLATION_BILINEAR == p.interpolation) {
+      dst[x] = warp_bilinear (p, x0, y0);
+    } else {
+      dst[x] = warp_pixel (p, static_cast<int>(std::floor (x0 + 0.5f)),
+          static_cast<int>(std::floor (y0 + 0.5f)));
+    }
+  }
+}
+
+#ifdef VX_TRAINING_KERNELS_X86
+/* 8 output pixels at a time. Groups where every sample and its
+ * neighbours are inside the input gather the four neighbours directly,
+ * the rest go through the scalar border handling.
+ */
+static void __attribute__ ((target ("avx2")))
+warp_row_avx2 (const warp_params &p, int y)
+{
+  float row_x = p.mat[1][0]*y + p.mat[2][0];
+  float row_y = p.mat[1][1]*y + p.mat[2][1];
+  vx_uint8 *dst = p.dst + y*p.dst_stride;
+
+  const __m256 m00 = _mm256_set1_ps (p.mat[0][0]);
+  const __m256 m01 = _mm256_set1_ps (p.mat[0][1]);
+  const __m256 vrow_x = _mm256_set1_ps (row_x);
+  const __m256 vrow_y = _mm256_set1_ps (row_y);
+  const __m256 lanes = _mm256_setr_ps (0, 1, 2, 3, 4, 5, 6, 7);
+  const __m256i stride = _mm256_set1_epi32 (p.src_stride);
+  const __m256i byte = _mm256_set1_epi32 (0xff);
+  /* The 4 byte gathers read two pixels past the right neighbour */
+  const __m256i max_x = _mm256_set1_epi32 (p.src_width - 4);
+  const __m256i max_y = _mm256_set1_epi32 (p.src_height - 2);
+  const __m256i zero = _mm256_setzero_si256 ();
+  const __m256i gather_order = _mm256_setr_epi32 (0, 4, 0, 0, 0, 0, 0, 0);
+  const int *base = (const int *)p.src;
+
+  int x = 0;
+  for (; x + 8 <= p.dst_width; x += 8) {
+    __m256 vx = _mm256_add_ps (_mm256_set1_ps (x), lanes);
+    __m256 x0 = _mm256_add_ps (_mm256_mul_ps (m00, vx), vrow_x);
+    __m256 y0 = _mm256_add_ps (_mm256_mul_ps (m01, vx), vrow_y);
+
+    __m256 xf = _mm256_floor_ps (x0);
+    __m256 yf = _mm256_floor_ps (y0);
+    __m256i xi = _mm256_cvttps_epi32 (xf);
+    __m256i yi = _mm256_cvttps_epi32 (yf);
+
+    __m256i outside = _mm256_or_si256 (
+        _mm256_or_si256 (_mm256_cmpgt_epi32 (zero, xi), _mm256_cmpgt_epi32 (xi, max_x)),
+        _mm256_or_si256 (_mm256_cmpgt_epi32 (zero, yi), _mm256_cmpgt_epi32 (yi, max_y)));
+
+    if (VX_INTERPOLATION_BILINEAR != p.interpolation || !_mm256_testz_si256 (outside, outside)) {
+      for (int i = 0; i < 8; i++) {
+        float sx = p.mat[0][0]*(x + i) + row_x;
+        float sy = p.mat[0][1]*(x + i) + row_y;
+        dst[x + i] = VX_INTERPOLATION_BILINEAR == p.interpolation ? warp_bilinear (p, sx, sy) :
+            warp_pixel (p, static_cast<int>(std::floor (sx + 0.5f)), static_cast<int>(std::floor (sy + 0.5f)));
+      }
+      continue;
+    }
+
+    __m256i offset = _mm256_add_epi32 (_mm256_mullo_epi32 (yi, stride), xi);
+    __m256i top = _mm256_i32gather_epi32 (base, offset, 1);
+    __m256i bottom = _mm256_i32gather_epi32 (base, _mm256_add_epi32 (offset, stride), 1);
+
+    __m256 p00 = _mm256_cvtepi32_ps (_mm256_and_si256 (top, byte));
+    __m256 p10 = _mm256_cvtepi32_ps (_mm256_and_si256 (_mm256_srli_epi32 (top, 8), byte));
+    __m256 p01 = _mm256_cvtepi32_ps (_mm256_and_si256 (bottom, byte));
+    __m256 p11 = _mm256_cvtepi32_ps (_mm256_and_si256 (_mm256_srli_epi32 (bottom, 8), byte));
+
+    __m256 s = _mm256_sub_ps (x0, xf);
+    __m256 t = _mm256_sub_ps (y0, yf);
+    __m256 upper = _mm256_add_ps (p00, _mm256_mul_ps (s, _mm256_sub_ps (p10, p00)));
+    __m256 lower = _mm256_add_ps (p01, _mm256_mul_ps (s, _mm256_sub_ps (p11, p01)));
+    __m256 value = _mm256_add_ps (upper, _mm256_mul_ps (t, _mm256_sub_ps (lower, upper)));
+
+    /* Narrow to bytes, each lane keeps 4 of them in its first word */
+    __m256i words = _mm256_packus_epi32 (_mm256_cvttps_epi32 (value), zero);
+    __m256i packed = _mm256_packus_epi16 (words, zero);
+    packed = _mm256_permutevar8x32_epi32 (packed, gather_order);
+    _mm_storel_epi64 ((__m128i *)(dst + x), _mm256_castsi256_si128 (packed));
+  }
+
+  warp_row_scalar (p, y, x);
+}
+#endif
+
+static void
+warp_affine (const warp_params &p, int height, simd_level level, thread_pool &pool)
+{
+  pool.parallel_for (height, [&] (int begin, int end) {
+    for (int y = begin; y < end; y++) {
+#ifdef VX_TRAINING_KERNELS_X86
+      if (level >= SIMD_AVX2) {
+        warp_row_avx2 (p, y);
+        continue;
+      }
+#endif
+      warp_row_scalar (p, y, 0);
+    }
+  });
+}
+
+#define WARP_AFFINE_NAME "com.ridgerun.vx_training.warp_affine"
+
+static vx_status VX_CALLBACK
+warp_affine_validate (vx_node node, const vx_reference parameters[],
+    vx_uint32 num, vx_meta_format metas[])
+{
+  vx_image input = (vx_image)parameters[0];
+  vx_matrix matrix = (vx_matrix)parameters[1];
+  vx_scalar interpolation_scalar = (vx_scalar)parameters[2];
+  vx_image output = (vx_image)parameters[3];
+
+  vx_df_image format = VX_DF_IMAGE_VIRT;
+  vxQueryImage (input, VX_IMAGE_FORMAT, &format, sizeof (format));
+  if (VX_DF_IMAGE_U8 != format) {
+    return VX_ERROR_INVALID_FORMAT;
+  }
+
+  vx_enum type = 0;
+  vx_size rows = 0;
+  vx_size columns = 0;
+  vxQueryMatrix (matrix, VX_MATRIX_TYPE, &type, sizeof (type));
+  vxQueryMatrix (matrix, VX_MATRIX_ROWS, &rows, sizeof (rows));
+  vxQueryMatrix (matrix, VX_MATRIX_COLUMNS, &columns, sizeof (columns));
+  if (VX_TYPE_FLOAT32 != type || 2 != columns || 3 != rows) {
+    return VX_ERROR_INVALID_PARAMETERS;
+  }
+
+  /* Interpolation is optional, as in vxWarpAffineNode */
+  if (NULL != interpolation_scalar) {
+    vx_enum interpolation = 0;
+    vxCopyScalar (interpolation_scalar, &interpolation, VX_READ_ONLY, VX_MEMORY_TYPE_HOST);
+    if (VX_INTERPOLATION_BILINEAR != interpolation &&
+        VX_INTERPOLATION_NEAREST_NEIGHBOR != interpolation) {
+      return VX_ERROR_INVALID_VALUE;
+    }
+  }
+
+  /* The output size is set by the user, not derived from the input */
+  vx_uint32 width = 0;
+  vx_uint32 height = 0;
+  vxQueryImage (output, VX_IMAGE_WIDTH, &width, sizeof (width));
+  vxQueryImage (output, VX_IMAGE_HEIGHT, &height, sizeof (height));
+  if (0 == width || 0 == height) {
+    return VX_ERROR_INVALID_DIMENSION;
+  }
+
+  vx_df_image out_format = VX_DF_IMAGE_U8;
+  vxSetMetaFormatAttribute (metas[3], VX_IMAGE_FORMAT, &out_format, sizeof (out_format));
+  vxSetMetaFormatAttribute (metas[3], VX_IMAGE_WIDTH, &width, sizeof (width));
+  vxSetMetaFormatAttribute (metas[3], VX_IMAGE_HEIGHT, &height, sizeof (height));
+
+  return VX_SUCCESS;
+}
+
+static vx_status VX_CALLBACK
+warp_affine_kernel (vx_node node, const vx_reference *parameters, vx_uint32 num)
+{
+  vx_image input = (vx_image)parameters[0];
+  vx_matrix matrix = (vx_matrix)parameters[1];
+  vx_scalar interpolation_scalar = (vx_scalar)parameters[2];
+  vx_image output = (vx_image)parameters[3];
+
+  warp_params p;
+  p.interpolation = VX_INTERPOLATION_NEAREST_NEIGHBOR;
+  if (NULL != interpolation_scalar) {
+    vxCopyScalar (interpolation_scalar, &p.interpolation, VX_READ_ONLY, VX_MEMORY_TYPE_HOST);
+  }
+  vxCopyMatrix (matrix, p.mat, VX_READ_ONLY, VX_MEMORY_TYPE_HOST);
+
+  /* Undefined borders may take any value, use the constant one */
+  vx_border_t border = { VX_BORDER_UNDEFINED };
+  vxQueryNode (node, VX_NODE_BORDER, &border, sizeof (border));
+  p.border = border.mode;
+  p.constant = VX_BORDER_CONSTANT == border.mode ? border.constant_value.U8 : 0;
+
+  vx_uint32 in_width = 0;
+  vx_uint32 in_height = 0;
+  vx_uint32 out_width = 0;
+  vx_uint32 out_height = 0;
+  vxQueryImage (input, VX_IMAGE_WIDTH, &in_width, sizeof (in_width));
+  vxQueryImage (input, VX_IMAGE_HEIGHT, &in_height, sizeof (in_height));
+  vxQueryImage (output, VX_IMAGE_WIDTH, &out_width, sizeof (out_width));
+  vxQueryImage (output, VX_IMAGE_HEIGHT, &out_height, sizeof (out_height));
+
+  const vx_rectangle_t in_rect = { 0, 0, in_width, in_height };
+  const vx_rectangle_t out_rect = { 0, 0, out_width, out_height };
+  vx_map_id in_map = 0;
+  vx_map_id out_map = 0;
+  vx_imagepatch_addressing_t in_addr = VX_IMAGEPATCH_ADDR_INIT;
+  vx_imagepatch_addressing_t out_addr = VX_IMAGEPATCH_ADDR_INIT;
+  vx_uint8 *in_ptr = NULL;
+  vx_uint8 *out_ptr = NULL;
+
+  vx_status status = vxMapImagePatch (input, &in_rect, 0, &in_map, &in_addr, (void **)&in_ptr,
+      VX_READ_ONLY, VX_MEMORY_TYPE_HOST, VX_NOGAP_X);
+  if (VX_SUCCESS != status) {
+    return status;
+  }
+
+  status = vxMapImagePatch (output, &out_rect, 0, &out_map, &out_addr, (void **)&out_ptr,
+      VX_WRITE_ONLY, VX_MEMORY_TYPE_HOST, VX_NOGAP_X);
+  if (VX_SUCCESS != status) {
+    vxUnmapImagePatch (input, in_map);
+    return status;
+  }
+
+  p.src = in_ptr;
+  p.src_stride = in_addr.stride_y;
+  p.src_width = in_width;
+  p.src_height = in_height;
+  p.dst = out_ptr;
+  p.dst_stride = out_addr.stride_y;
+  p.dst_width = out_width;
+
+  warp_affine (p, out_height, kernels_simd (), kernels_pool ());
+
+  vxUnmapImagePatch (output, out_map);
+  vxUnmapImagePatch (input, in_map);
+
+  return VX_SUCCESS;
+}
+
+/* Registers the multi-threaded warp affine in the context. Parameters
+ * match vxWarpAffineNode: the U8 input, the 2x3 VX_TYPE_FLOAT32
+ * matrix, the optional interpolation as a VX_TYPE_ENUM scalar and the
+ * U8 output.
+ */
+static vx_status
+register_warp_affine (vx_context context)
+{
+  vx_enum id = 0;
+  vx_status status = vxAllocateUserKernelId (context, &id);
+  if (VX_SUCCESS != status) {
+    return status;
+  }
+
+  vx_kernel kernel = vxAddUserKernel (context, WARP_AFFINE_NAME, id,
+      warp_affine_kernel, 4, warp_affine_validate, NULL, NULL);
+  status = vxGetStatus ((vx_reference)kernel);
+  if (VX_SUCCESS != status) {
+    return status;
+  }
+
+  vx_enum directions[] = { VX_INPUT, VX_INPUT, VX_INPUT, VX_OUTPUT };
+  vx_enum types[] = { VX_TYPE_IMAGE, VX_TYPE_MATRIX, VX_TYPE_SCALAR, VX_TYPE_IMAGE };
+  vx_enum states[] = { VX_PARAMETER_STATE_REQUIRED, VX_PARAMETER_STATE_REQUIRED,
+    VX_PARAMETER_STATE_OPTIONAL, VX_PARAMETER_STATE_REQUIRED };
+  for (vx_uint32 i = 0; i < 4 && VX_SUCCESS == status; i++) {
+    status = vxAddParameterToKernel (kernel, i, directions[i], types[i], states[i]);
+  }
+
+  if (VX_SUCCESS == status) {
+    status = vxFinalizeKernel (kernel);
+  }
+
+  if (VX_SUCCESS != status) {
+    vxRemoveKernel (kernel);
+  } else {
+    vxReleaseKernel (&kernel);
+  }
+
+  return status;
+}
+
+/* Drop-in replacement of vxWarpAffineNode. The kernel must have been
+ * registered in the context.
+ */
+static vx_node
+warp_affine_node (vx_graph graph, vx_image input, vx_matrix matrix, vx_enum interpolation,
+    vx_image output)
+{
+  vx_context context = vxGetContext ((vx_reference)graph);
+  vx_kernel kernel = vxGetKernelByName (context, WARP_AFFINE_NAME);
+  if (VX_SUCCESS != vxGetStatus ((vx_reference)kernel)) {
+    return NULL;
+  }
+
+  vx_node node = vxCreateGenericNode (graph, kernel);
+  vxReleaseKernel (&kernel);
+  if (VX_SUCCESS != vxGetStatus ((vx_reference)node)) {
+    return node;
+  }
+
+  vx_scalar interpolation_scalar = vxCreateScalar (context, VX_TYPE_ENUM, &interpolation);
+  vxSetParameterByIndex (node, 0, (vx_reference)input);
+  vxSetParameterByIndex (node, 1, (vx_reference)matrix);
+  vxSetParameterByIndex (node, 2, (vx_reference)interpolation_scalar);
+  vxSetParameterByIndex (node, 3, (vx_reference)output);
+  vxReleaseScalar (&interpolation_scalar);
+
+  return node;
+}
+
+/* Enumeration assigned to a user kernel, e.g. for perf_exporter */
+static vx_enum
+user_kernel_enum (vx_context context, const char *name)
+{
+  vx_enum kernel_enum = 0;
+  vx_kernel kernel = vxGetKernelByName (context, name);
+  if (VX_SUCCESS == vxGetStatus ((vx_reference)kernel)) {
+    vxQueryKernel (kernel, VX_KERNEL_ENUM, &kernel_enum, sizeof (kernel_enum));
+    vxReleaseKernel (&kernel);
+  }
+  return kernel_enum;
+}
+
+#endif // VX_TRAINING_KERNELS_H
@@ -0,0 +1,434 @@
+/* Copyright (C) 2022 RidgeRun, LLC (http://www.ridgerun.com)
+ * All Rights Reserved.
+ *
+ * The contents of this software are proprietary and confidential to RidgeRun,
+ * LLC.  No part of this program may be photocopied, reproduced or translated
+ * into another programming language without prior written consent of
+ * RidgeRun, LLC.  The user is free to modify the source code after obtaining
+ * a software license from RidgeRun.  All source code changes must be provided
+ * back to RidgeRun without any encumbrance.
+ */
+
+#ifndef VX_TRAINING_MEMORY_H
+#define VX_TRAINING_MEMORY_H
+
+/* Memory accounting of the OpenVX objects an example creates, and of
+ * the resident memory of the process. Objects are recorded once the
+ * graph is verified, when the implementation knows their final size,
+ * under a group, usually the graph they belong to:
+ *
+ *   memory_accounting memory;
+ *   memory_begin (&memory);
+ *   ...
+ *   vxVerifyGraph (graph);
+ *   memory_add_image (&memory, "graph", "in_image", in_image);
+ *   memory_add_matrix (&memory, "graph", "matrix", matrix);
+ *   memory_setup_done (&memory);
+ *   ... process, calling memory_sample () every MEMORY_SAMPLE_PERIOD frames ...
+ *   memory_report (&memory);
+ *
+ * The size of an object is the one the implementation reports, or the
+ * one its dimensions and format call for if it reports none. Virtual
+ * images are listed apart, since the implementation may never allocate
+ * them. The resident memory is read from /proc, at the start, once the
+ * setup is done, on every sample and at its peak.
+ *
+ * Names and groups must outlive the accounting, string literals are
+ * fine. Usable from both C and C++.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <VX/vx.h>
+
+#define MEMORY_MAX_OBJECTS 256
+/* Frames or batches processed between samples */
+#define MEMORY_SAMPLE_PERIOD 16
+
+typedef struct
+{
+  const char *group;
+  const char *name;
+  const char *kind;
+  char detail[64];
+  size_t bytes;
+  int is_virtual;
+} memory_object;
+
+typedef struct
+{
+  memory_object objects[MEMORY_MAX_OBJECTS];
+  int count;
+  /* Objects beyond MEMORY_MAX_OBJECTS, only added to the totals */
+  int unlisted;
+  size_t unlisted_bytes;
+  /* Resident memory, in bytes */
+  size_t start_rss;
+  size_t setup_rss;
+  size_t steady_rss;
+  long samples;
+} memory_accounting;
+
+/* Current resident memory, or 0 if unknown */
+static size_t
+memory_rss (void)
+{
+  FILE *file = fopen ("/proc/self/statm", "r");
+  if (NULL == file) {
+    return 0;
+  }
+
+  /* Total size first, then the resident pages */
+  unsigned long size = 0;
+  unsigned long pages = 0;
+  int found = fscanf (file, "%lu %lu", &size, &pages);
+  fclose (file);
+
+  return 2 == found ? pages*(size_t)sysconf (_SC_PAGESIZE) : 0;
+}
+
+/* Highest resident memory of the process so far, or 0 if unknown */
+static size_t
+memory_peak_rss (void)
+{
+  FILE *file = fopen ("/proc/self/status", "r");
+  if (NULL == file) {
+    return 0;
+  }
+
+  char line[256];
+  unsigned long kb = 0;
+  while (NULL != fgets (line, sizeof (line), file)) {
+    if (1 == sscanf (line, "VmHWM: %lu kB", &kb)) {
+      break;
+    }
+  }
+  fclose (file);
+
+  return kb*1024;
+}
+
+static void
+memory_begin (memory_accounting *acc)
+{
+  acc->count = 0;
+  acc->unlisted = 0;
+  acc->unlisted_bytes = 0;
+  acc->start_rss = memory_rss ();
+  acc->setup_rss = acc->start_rss;
+  acc->steady_rss = acc->start_rss;
+  acc->samples = 0;
+}
+
+/* Bytes per pixel of the format, in eighths so subsampled formats fit */
+static size_t
+memory_format_eighths (vx_df_image format)
+{
+  switch (format) {
+  case VX_DF_IMAGE_U8:
+    return 8;
+  case VX_DF_IMAGE_U16:
+  case VX_DF_IMAGE_S16:
+  case VX_DF_IMAGE_UYVY:
+  case VX_DF_IMAGE_YUYV:
+    return 16;
+  case VX_DF_IMAGE_RGB:
+  case VX_DF_IMAGE_YUV4:
+    return 24;
+  case VX_DF_IMAGE_RGBX:
+  case VX_DF_IMAGE_U32:
+  case VX_DF_IMAGE_S32:
+    return 32;
+  case VX_DF_IMAGE_NV12:
+  case VX_DF_IMAGE_NV21:
+  case VX_DF_IMAGE_IYUV:
+    return 12;
+  default:
+    return 0;
+  }
+}
+
+static const char *
+memory_format_name (vx_df_image format)
+{
+  switch (format) {
+  case VX_DF_IMAGE_U8:
+    return "U8";
+  case VX_DF_IMAGE_U16:
+    return "U16";
+  case VX_DF_IMAGE_S16:
+    return "S16";
+  case VX_DF_IMAGE_U32:
+    return "U32";
+  case VX_DF_IMAGE_S32:
+    return "S32";
+  case VX_DF_IMAGE_RGB:
+    return "RGB";
+  case VX_DF_IMAGE_RGBX:
+    return "RGBX";
+  case VX_DF_IMAGE_NV12:
+    return "NV12";
+  case VX_DF_IMAGE_NV21:
+    return "NV21";
+  case VX_DF_IMAGE_IYUV:
+    return "IYUV";
+  case VX_DF_IMAGE_YUV4:
+    return "YUV4";
+  case VX_DF_IMAGE_UYVY:
+    return "UYVY";
+  case VX_DF_IMAGE_YUYV:
+    return "YUYV";
+  default:
+    return "other";
+  }
+}
+
+static memory_object *
+memory_add (memory_accounting *acc, const char *group, const char *name, const char *kind,
+    size_t bytes)
+{
+  if (acc->count >= MEMORY_MAX_OBJECTS) {
+    acc->unlisted++;
+    acc->unlisted_bytes += bytes;
+    return NULL;
+  }
+
+  memory_object *obj = &acc->objects[acc->count++];
+  obj->group = group;
+  obj->name = name;
+  obj->kind = kind;
+  obj->detail[0] = '\0';
+  obj->bytes = bytes;
+  obj->is_virtual = 0;
+  return obj;
+}
+
+/* Memory owned by the application rather than by OpenVX, such as a
+ * decoded frame or a queue of copies
+ */
+static void
+memory_add_host (memory_accounting *acc, const char *group, const char *name, size_t bytes)
+{
+  memory_add (acc, group, name, "host", bytes);
+}
+
+/* Size of an image, as reported by the implementation or computed */
+static size_t
+memory_image_size (vx_image image, vx_uint32 *width, vx_uint32 *height, vx_df_image *format)
+{
+  vx_size size = 0;
+  *width = 0;
+  *height = 0;
+  *format = VX_DF_IMAGE_VIRT;
+  vxQueryImage (image, VX_IMAGE_WIDTH, width, sizeof (*width));
+  vxQueryImage (image, VX_IMAGE_HEIGHT, height, sizeof (*height));
+  vxQueryImage (image, VX_IMAGE_FORMAT, format, sizeof (*format));
+  if (VX_SUCCESS != vxQueryImage (image, VX_IMAGE_SIZE, &size, sizeof (size)) || 0 == size) {
+    size = (size_t)*width * *height * memory_format_eighths (*format) / 8;
+  }
+
+  return size;
+}
+
+static void
+memory_record_image (memory_accounting *acc, const char *group, const char *name,
+    vx_image image, int is_virtual)
+{
+  vx_uint32 width = 0;
+  vx_uint32 height = 0;
+  vx_df_image format = VX_DF_IMAGE_VIRT;
+  size_t size = memory_image_size (image, &width, &height, &format);
+
+  memory_object *obj = memory_add (acc, group, name, "image", size);
+  if (NULL != obj) {
+    snprintf (obj->detail, sizeof (obj->detail), "%ux%u %s", width, height,
+        memory_format_name (format));
+    obj->is_virtual = is_virtual;
+  }
+}
+
+static void
+memory_add_image (memory_accounting *acc, const char *group, const char *name, vx_image image)
+{
+  memory_record_image (acc, group, name, image, 0);
+}
+
+/* Intermediate images, which the implementation may never allocate */
+static void
+memory_add_virtual_image (memory_accounting *acc, const char *group, const char *name,
+    vx_image image)
+{
+  memory_record_image (acc, group, name, image, 1);
+}
+
+static void
+memory_add_matrix (memory_accounting *acc, const char *group, const char *name, vx_matrix matrix)
+{
+  vx_size size = 0;
+  vx_size rows = 0;
+  vx_size columns = 0;
+  vxQueryMatrix (matrix, VX_MATRIX_SIZE, &size, sizeof (size));
+  vxQueryMatrix (matrix, VX_MATRIX_ROWS, &rows, sizeof (rows));
+  vxQueryMatrix (matrix, VX_MATRIX_COLUMNS, &columns, sizeof (columns));
+
+  memory_object *obj = memory_add (acc, group, name, "matrix", size);
+  if (NULL != obj) {
+    snprintf (obj->detail, sizeof (obj->detail), "%zux%zu", (size_t)columns, (size_t)rows);
+  }
+}
+
+/* Object arrays of images, accounted as a whole. Virtual arrays hold
+ * intermediates, like virtual images.
+ */
+static void
+memory_add_object_array (memory_accounting *acc, const char *group, const char *name,
+    vx_object_array array, int is_virtual)
+{
+  vx_size items = 0;
+  vxQueryObjectArray (array, VX_OBJECT_ARRAY_NUMITEMS, &items, sizeof (items));
+
+  size_t size = 0;
+  vx_uint32 width = 0;
+  vx_uint32 height = 0;
+  vx_df_image format = VX_DF_IMAGE_VIRT;
+  for (vx_uint32 i = 0; i < items; i++) {
+    vx_image item = (vx_image)vxGetObjectArrayItem (array, i);
+    if (VX_SUCCESS == vxGetStatus ((vx_reference)item)) {
+      size += memory_image_size (item, &width, &height, &format);
+      vxReleaseImage (&item);
+    }
+  }
+
+  memory_object *obj = memory_add (acc, group, name, "object array", size);
+  if (NULL != obj) {
+    snprintf (obj->detail, sizeof (obj->detail), "%zu x %ux%u %s", (size_t)items, width, height,
+        memory_format_name (format));
+    obj->is_virtual = is_virtual;
+  }
+}
+
+/* Marks the end of the setup, once every object is created */
+static void
+memory_setup_done (memory_accounting *acc)
+{
+  acc->setup_rss = memory_rss ();
+  acc->steady_rss = acc->setup_rss;
+}
+
+/* Samples the resident memory while processing, the last sample is
+ * reported as the steady state. Reads /proc, so call it every few
+ * frames rather than on every one.
+ */
+static void
+memory_sample (memory_accounting *acc)
+{
+  size_t rss = memory_rss ();
+  if (rss > 0) {
+    acc->steady_rss = rss;
+    acc->samples++;
+  }
+}
+
+static void
+memory_print_bytes (const char *label, size_t bytes)
+{
+  if (bytes >= 1024*1024) {
+    printf ("%s%.2f MiB\n", label, bytes/(1024.0*1024.0));
+  } else if (bytes >= 1024) {
+    printf ("%s%.1f KiB\n", label, bytes/1024.0);
+  } else {
+    printf ("%s%zu bytes\n", label, bytes);
+  }
+}
+
+static int
+memory_same_object (const memory_object *a, const memory_object *b)
+{
+  return 0 == strcmp (a->group, b->group) && 0 == strcmp (a->name, b->name) &&
+      0 == strcmp (a->kind, b->kind) && a->bytes == b->bytes && a->is_virtual == b->is_virtual &&
+      0 == strcmp (a->detail, b->detail);
+}
+
+static void
+memory_report (const memory_accounting *acc)
+{
+  char label[256];
+
+  /* Runs of identical objects, such as the buffers of a queue, are
+   * listed once with their count
+   */
+  printf ("Memory by object:\n");
+  for (int i = 0; i < acc->count;) {
+    const memory_object *obj = &acc->objects[i];
+    int same = 1;
+    while (i + same < acc->count && memory_same_object (obj, &acc->objects[i + same])) {
+      same++;
+    }
+
+    int len = snprintf (label, sizeof (label), "\t%s: %s (%s%s%s%s)", obj->group, obj->name,
+        obj->is_virtual ? "virtual " : "", obj->kind, obj->detail[0] ? " " : "", obj->detail);
+    if (same > 1 && len > 0 && (size_t)len < sizeof (label)) {
+      snprintf (label + len, sizeof (label) - len, " x%d", same);
+    }
+    strncat (label, ": ", sizeof (label) - strlen (label) - 1);
+    memory_print_bytes (label, obj->bytes*same);
+    i += same;
+  }
+  if (acc->unlisted > 0) {
+    snprintf (label, sizeof (label), "\t%d more objects: ", acc->unlisted);
+    memory_print_bytes (label, acc->unlisted_bytes);
+  }
+  printf ("\t---\n");
+
+  /* Groups in order of appearance */
+  size_t total = acc->unlisted_bytes;
+  size_t total_virtual = 0;
+  printf ("Memory by graph:\n");
+  for (int i = 0; i < acc->count; i++) {
+    int seen = 0;
+    for (int j = 0; j < i && !seen; j++) {
+      seen = 0 == strcmp (acc->objects[j].group, acc->objects[i].group);
+    }
+    if (seen) {
+      continue;
+    }
+
+    size_t bytes = 0;
+    size_t virtual_bytes = 0;
+    int objects = 0;
+    for (int j = i; j < acc->count; j++) {
+      if (0 == strcmp (acc->objects[j].group, acc->objects[i].group)) {
+        bytes += acc->objects[j].bytes;
+        virtual_bytes += acc->objects[j].is_virtual ? acc->objects[j].bytes : 0;
+        objects++;
+      }
+    }
+    total += bytes;
+    total_virtual += virtual_bytes;
+
+    snprintf (label, sizeof (label), "\t%s (%d objects): ", acc->objects[i].group, objects);
+    memory_print_bytes (label, bytes);
+    if (virtual_bytes > 0) {
+      snprintf (label, sizeof (label), "\t%s, of which virtual: ", acc->objects[i].group);
+      memory_print_bytes (label, virtual_bytes);
+    }
+  }
+  memory_print_bytes ("\tTotal: ", total);
+  memory_print_bytes ("\tTotal without virtual images: ", total - total_virtual);
+  printf ("\t---\n");
+
+  printf ("Resident memory:\n");
+  memory_print_bytes ("\tAt start: ", acc->start_rss);
+  memory_print_bytes ("\tAfter setup: ", acc->setup_rss);
+  if (acc->samples > 0) {
+    memory_print_bytes ("\tSteady state: ", acc->steady_rss);
+  }
+  memory_print_bytes ("\tPeak: ", memory_peak_rss ());
+  if (acc->setup_rss > acc->start_rss) {
+    memory_print_bytes ("\tGrowth during setup: ", acc->setup_rss - acc->start_rss);
+  }
+  printf ("\t---\n");
+}
+
+#endif // VX_TRAINING_MEMORY_H
@@ -0,0 +1,319 @@
+/* Copyright (C) 2022 RidgeRun, LLC (http://www.ridgerun.com)
+ * All Rights Reserved.
+ *
+ * The contents of this software are proprietary and confidential to RidgeRun,
+ * LLC.  No part of this program may be photocopied, reproduced or translated
+ * into another programming language without prior written consent of
+ * RidgeRun, LLC.  The user is free to modify the source code after obtaining
+ * a software license from RidgeRun.  All source code changes must be provided
+ * back to RidgeRun without any encumbrance.
+ */
+
+#ifndef VX_TRAINING_PERF_EXPORT_H
+#define VX_TRAINING_PERF_EXPORT_H
+
+/* Machine readable dump of the graph and node performance, so runs can
+ * be tracked over time and compared from scripts. A run is written
+ * either as a single JSON document, or appended as rows to a CSV file.
+ * All durations are in nanoseconds, as reported by vx_perf_t.
+ */
+
+#include <ctime>
+#include <fstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include <VX/vx.h>
+
+#include "vx_training_histogram.h"
+
+class perf_exporter
+{
+public:
+  explicit perf_exporter (const std::string &example) : example (example), timestamp (time (NULL)) {}
+
+  /* Describes the configuration of the run, e.g. image size. Numbers
+   * and booleans are written as such in JSON, only strings are quoted.
+   */
+  void
+  set (const std::string &key, const std::string &value)
+  {
+    config.push_back (setting {key, value, true});
+  }
+
+  void
+  set (const std::string &key, const char *value)
+  {
+    set (key, std::string (value));
+  }
+
+  void
+  set (const std::string &key, bool value)
+  {
+    config.push_back (setting {key, value ? "true" : "false", false});
+  }
+
+  template<typename T>
+  typename std::enable_if<std::is_arithmetic<T>::value>::type
+  set (const std::string &key, T value)
+  {
+    config.push_back (setting {key, std::to_string (value), false});
+  }
+
+  void
+  add_graph (vx_graph graph, const latency_stats *stats)
+  {
+    record rec;
+    rec.scope = "graph";
+    rec.index = 0;
+    rec.name = reference_name ((vx_reference)graph, "graph");
+    vxQueryGraph (graph, VX_GRAPH_PERFORMANCE, &rec.perf, sizeof (rec.perf));
+    rec.stats = stats;
+    records.push_back (rec);
+  }
+
+  /* Nodes don't expose the kernel they run, so the caller passes the
+   * kernel enumeration used to create them.
+   */
+  void
+  add_node (vx_node node, vx_enum kernel, const latency_stats *stats)
+  {
+    record rec;
+    rec.scope = "node";
+    rec.index = records.size () - graphs ();
+    rec.name = reference_name ((vx_reference)node, "node" + std::to_string (rec.index));
+    rec.kernel = kernel_name (vxGetContext ((vx_reference)node), kernel);
+    vxQueryNode (node, VX_NODE_PERFORMANCE, &rec.perf, sizeof (rec.perf));
+    rec.stats = stats;
+    records.push_back (rec);
+  }
+
+  bool
+  write_json (const std::string &path) const
+  {
+    std::ofstream out (path.c_str ());
+    if (!out) {
+      return false;
+    }
+
+    out << "{" << std::endl;
+    out << "  \"example\": \"" << escape (example) << "\"," << std::endl;
+    out << "  \"timestamp\": " << timestamp << "," << std::endl;
+    out << "  \"config\": {";
+    for (size_t i = 0; i < config.size (); i++) {
+      const setting &entry = config[i];
+      out << (i ? ", " : "") << "\"" << escape (entry.key) << "\": ";
+      if (entry.quoted) {
+        out << "\"" << escape (entry.value) << "\"";
+      } else {
+        out << entry.value;
+      }
+    }
+    out << "}," << std::endl;
+
+    out << "  \"results\": [" << std::endl;
+    for (size_t i = 0; i < records.size (); i++) {
+      const record &rec = records[i];
+      out << "    {\"scope\": \"" << rec.scope << "\", \"index\": " << rec.index
+          << ", \"name\": \"" << escape (rec.name) << "\", \"kernel\": \""
+          << escape (rec.kernel) << "\"";
+
+      std::vector<std::pair<std::string, vx_uint64>> values = fields (rec);
+      for (const auto &value: values) {
+        out << ", \"" << value.first << "\": " << value.second;
+      }
+      out << "}" << (i + 1 < records.size () ? "," : "") << std::endl;
+    }
+    out << "  ]" << std::endl;
+    out << "}" << std::endl;
+
+    return out.good ();
+  }
+
+  /* Appends a row per graph and node. The header is only written if
+   * the file is new, so successive runs accumulate in the same file.
+   */
+  bool
+  write_csv (const std::string &path) const
+  {
+    bool is_new = true;
+    {
+      std::ifstream in (path.c_str ());
+      is_new = !in || in.peek () == std::ifstream::traits_type::eof ();
+    }
+
+    std::ofstream out (path.c_str (), std::ios::app);
+    if (!out) {
+      return false;
+    }
+
+    if (records.empty ()) {
+      return true;
+    }
+
+    if (is_new) {
+      out << "example,timestamp,scope,index,name,kernel";
+      for (const auto &entry: config) {
+        out << "," << entry.key;
+      }
+      for (const auto &value: fields (records[0])) {
+        out << "," << value.first;
+      }
+      out << std::endl;
+    }
+
+    for (const auto &rec: records) {
+      out << csv (example) << "," << timestamp << "," << rec.scope << "," << rec.index
+          << "," << csv (rec.name) << "," << csv (rec.kernel);
+      for (const auto &entry: config) {
+        out << "," << csv (entry.value);
+      }
+      for (const auto &value: fields (rec)) {
+        out << "," << value.second;
+      }
+      out << std::endl;
+    }
+
+    return out.good ();
+  }
+
+  static std::string
+  format_name (vx_df_image format)
+  {
+    std::string name;
+    for (int i = 0; i < 4; i++) {
+      char c = (format >> (8*i)) & 0xff;
+      name += c ? c : ' ';
+    }
+    return name;
+  }
+
+  static std::string
+  interpolation_name (vx_enum interpolation)
+  {
+    switch (interpolation) {
+    case VX_INTERPOLATION_NEAREST_NEIGHBOR:
+      return "nearest_neighbor";
+    case VX_INTERPOLATION_BILINEAR:
+      return "bilinear";
+    case VX_INTERPOLATION_AREA:
+      return "area";
+    default:
+      return std::to_string (interpolation);
+    }
+  }
+
+private:
+  struct setting {
+    std::string key;
+    std::string value;
+    /* Strings, as opposed to numbers and booleans */
+    bool quoted;
+  };
+
+  struct record {
+    std::string scope;
+    size_t index;
+    std::string name;
+    std::string kernel;
+    vx_perf_t perf;
+    const latency_stats *stats;
+  };
+
+  size_t
+  graphs () const
+  {
+    size_t count = 0;
+    for (const auto &rec: records) {
+      count += "graph" == rec.scope;
+    }
+    return count;
+  }
+
+  static std::vector<std::pair<std::string, vx_uint64>>
+  fields (const record &rec)
+  {
+    std::vector<std::pair<std::string, vx_uint64>> values = {
+      {"num", rec.perf.num},
+      {"avg_ns", rec.perf.avg},
+      {"min_ns", rec.perf.min},
+      {"max_ns", rec.perf.max},
+      {"sum_ns", rec.perf.sum},
+      {"last_ns", rec.perf.tmp},
+    };
+
+    /* Keep the same columns for every row, percentiles are zero if
+     * no distribution was recorded.
+     */
+    latency_histogram empty;
+    const latency_histogram &histogram = rec.stats ? rec.stats->histogram : empty;
+    values.push_back ({"p50_ns", histogram.percentile (50)});
+    values.push_back ({"p90_ns", histogram.percentile (90)});
+    values.push_back ({"p99_ns", histogram.percentile (99)});
+    values.push_back ({"p999_ns", histogram.percentile (99.9)});
+
+    return values;
+  }
+
+  static std::string
+  reference_name (vx_reference ref, const std::string &fallback)
+  {
+    vx_char *name = NULL;
+    if (VX_SUCCESS != vxQueryReference (ref, VX_REFERENCE_NAME, &name, sizeof (name)) ||
+        NULL == name || '\0' == name[0]) {
+      return fallback;
+    }
+    return name;
+  }
+
+  static std::string
+  kernel_name (vx_context context, vx_enum kernel_enum)
+  {
+    vx_kernel kernel = vxGetKernelByEnum (context, kernel_enum);
+    if (VX_SUCCESS != vxGetStatus ((vx_reference)kernel)) {
+      return "";
+    }
+
+    vx_char name[VX_MAX_KERNEL_NAME] = { 0 };
+    vxQueryKernel (kernel, VX_KERNEL_NAME, name, sizeof (name));
+    vxReleaseKernel (&kernel);
+    return name;
+  }
+
+  static std::string
+  escape (const std::string &text)
+  {
+    std::string escaped;
+    for (char c: text) {
+      if ('"' == c || '\\' == c) {
+        escaped += '\\';
+      }
+      escaped += c;
+    }
+    return escaped;
+  }
+
+  static std::string
+  csv (const std::string &text)
+  {
+    if (std::string::npos == text.find_first_of (",\"\n")) {
+      return text;
+    }
+
+    std::string quoted = "\"";
+    for (char c: text) {
+      if ('"' == c) {
+        quoted += '"';
+      }
+      quoted += c;
+    }
+    return quoted + "\"";
+  }
+
+  std::string example;
+  time_t timestamp;
+  std::vector<setting> config;
+  std::vector<record> records;
+};
+
+#endif // VX_TRAINING_PERF_EXPORT_H
@@ -0,0 +1,470 @@
+/* Copyright (C) 2022 RidgeRun, LLC (http://www.ridgerun.com)
+ * All Rights Reserved.
+ *
+ * The contents of this software are proprietary and confidential to RidgeRun,
+ * LLC.  No part of this program may be photocopied, reproduced or translated
+ * into another programming language without prior written consent of
+ * RidgeRun, LLC.  The user is free to modify the source code after obtaining
+ * a software license from RidgeRun.  All source code changes must be provided
+ * back to RidgeRun without any encumbrance.
+ */
+
+#ifndef VX_TRAINING_PNG_WRITER_H
+#define VX_TRAINING_PNG_WRITER_H
+
+/* Writes PNG images from a pool of threads, so encoding never runs on
+ * the thread processing the graph. Images are copied into a bounded
+ * queue and the caller only waits when the queue is full.
+ *
+ * PNG compression is usually what makes dumping slow, so stb is given
+ * a zlib compressor that splits every image in chunks and deflates
+ * them in parallel. Each chunk but the last ends with a sync flush, so
+ * they can be concatenated into a single stream, and the checksums
+ * are combined. Matches across chunks are lost, which costs a few
+ * bytes per chunk.
+ *
+ * Include it instead of stb_image_write.h, with
+ * STB_IMAGE_WRITE_IMPLEMENTATION defined as usual. Link with -lz and
+ * -pthread.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+static unsigned char *png_writer_deflate (unsigned char *data, int data_len,
+    int *out_len, int quality);
+
+#define STBIW_ZLIB_COMPRESS png_writer_deflate
+#include "stb_image_write.h"
+
+/* Chunks smaller than this compress worse than they gain in speed */
+#define PNG_WRITER_MIN_CHUNK (64*1024)
+#define PNG_WRITER_MAX_CHUNKS 64
+
+/* Threads deflating a single image, shared by every writer thread */
+static int png_writer_deflate_threads = 1;
+
+typedef struct
+{
+  const unsigned char *data;
+  int len;
+  int level;
+  int last;
+  unsigned char *out;
+  int out_len;
+  uLong adler;
+  int ret;
+} png_writer_chunk;
+
+typedef struct
+{
+  char *path;
+  unsigned char *data;
+  int width;
+  int height;
+  int comp;
+} png_writer_job;
+
+typedef struct
+{
+  pthread_t *threads;
+  int num_threads;
+
+  pthread_mutex_t mutex;
+  pthread_cond_t not_empty;
+  pthread_cond_t not_full;
+  png_writer_job *queue;
+  int capacity;
+  int head;
+  int count;
+  int running;
+
+  int level;
+  int pushed;
+  int written;
+  int failed;
+  int max_queued;
+  int blocked;
+  double blocked_ms;
+  double raw_mb;
+  double png_mb;
+  struct timespec start;
+  double elapsed_ms;
+} png_writer;
+
+static double
+png_writer_ms (const struct timespec *start)
+{
+  struct timespec now;
+  clock_gettime (CLOCK_MONOTONIC, &now);
+
+  return (now.tv_sec - start->tv_sec)*1000.0 + (now.tv_nsec - start->tv_nsec)/1000000.0;
+}
+
+static void *
+png_writer_deflate_chunk (void *arg)
+{
+  png_writer_chunk *chunk = (png_writer_chunk *)arg;
+  z_stream stream;
+
+  memset (&stream, 0, sizeof (stream));
+  chunk->ret = -1;
+  chunk->adler = adler32 (adler32 (0, NULL, 0), chunk->data, chunk->len);
+
+  /* Raw deflate, the zlib header and checksum are added once for the
+   * whole stream
+   */
+  if (Z_OK != deflateInit2 (&stream, chunk->level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY)) {
+    return NULL;
+  }
+
+  /* The bound covers a finished stream, a sync flush needs a few more */
+  uLong bound = deflateBound (&stream, chunk->len) + 16;
+  chunk->out = (unsigned char *)malloc (bound);
+  if (NULL == chunk->out) {
+    goto end;
+  }
+
+  stream.next_in = (Bytef *)chunk->data;
+  stream.avail_in = chunk->len;
+  stream.next_out = chunk->out;
+  stream.avail_out = bound;
+
+  int status = deflate (&stream, chunk->last ? Z_FINISH : Z_SYNC_FLUSH);
+  if ((chunk->last && Z_STREAM_END != status) || (!chunk->last && Z_OK != status) ||
+      0 != stream.avail_in) {
+    goto end;
+  }
+
+  chunk->out_len = bound - stream.avail_out;
+  chunk->ret = 0;
+
+ end:
+  deflateEnd (&stream);
+  return NULL;
+}
+
+/* Same contract as stb's compressor: returns a zlib stream allocated
+ * with malloc, or NULL on error.
+ */
+static unsigned char *
+png_writer_deflate (unsigned char *data, int data_len, int *out_len, int quality)
+{
+  png_writer_chunk chunks[PNG_WRITER_MAX_CHUNKS];
+  pthread_t threads[PNG_WRITER_MAX_CHUNKS];
+  unsigned char *out = NULL;
+
+  int num_chunks = data_len / PNG_WRITER_MIN_CHUNK;
+  if (num_chunks > png_writer_deflate_threads) {
+    num_chunks = png_writer_deflate_threads;
+  }
+  if (num_chunks > PNG_WRITER_MAX_CHUNKS) {
+    num_chunks = PNG_WRITER_MAX_CHUNKS;
+  }
+  if (num_chunks < 1) {
+    num_chunks = 1;
+  }
+
+  int level = quality < 0 ? Z_DEFAULT_COMPRESSION : quality > 9 ? 9 : quality;
+  int chunk_len = data_len / num_chunks;
+  for (int i = 0; i < num_chunks; i++) {
+    chunks[i].data = data + i*chunk_len;
+    chunks[i].len = i == num_chunks - 1 ? data_len - i*chunk_len : chunk_len;
+    chunks[i].level = level;
+    chunks[i].last = i == num_chunks - 1;
+    chunks[i].out = NULL;
+    chunks[i].out_len = 0;
+  }
+
+  /* The calling thread takes the first chunk */
+  int started = 1;
+  for (; started < num_chunks; started++) {
+    if (0 != pthread_create (&threads[started], NULL, png_writer_deflate_chunk, &chunks[started])) {
+      break;
+    }
+  }
+  png_writer_deflate_chunk (&chunks[0]);
+  for (int i = started; i < num_chunks; i++) {
+    /* Out of threads, do the rest here */
+    png_writer_deflate_chunk (&chunks[i]);
+  }
+  for (int i = 1; i < started; i++) {
+    pthread_join (threads[i], NULL);
+  }
+
+  int total = 2 + 4;
+  for (int i = 0; i < num_chunks; i++) {
+    if (0 != chunks[i].ret) {
+      goto free_chunks;
+    }
+    total += chunks[i].out_len;
+  }
+
+  out = (unsigned char *)malloc (total);
+  if (NULL == out) {
+    goto free_chunks;
+  }
+
+  /* zlib header: deflate with a 32K window, the compression level as a
+   * hint and the check bits that make it a multiple of 31
+   */
+  int flevel = level == Z_DEFAULT_COMPRESSION ? 2 : level < 2 ? 0 : level < 6 ? 1 : level == 6 ? 2 : 3;
+  out[0] = 0x78;
+  out[1] = flevel << 6;
+  out[1] += (31 - ((out[0] << 8) + out[1]) % 31) % 31;
+
+  int pos = 2;
+  uLong adler = chunks[0].adler;
+  for (int i = 0; i < num_chunks; i++) {
+    memcpy (out + pos, chunks[i].out, chunks[i].out_len);
+    pos += chunks[i].out_len;
+    if (i > 0) {
+      adler = adler32_combine (adler, chunks[i].adler, chunks[i].len);
+    }
+  }
+
+  out[pos++] = adler >> 24;
+  out[pos++] = adler >> 16;
+  out[pos++] = adler >> 8;
+  out[pos++] = adler;
+  *out_len = pos;
+
+ free_chunks:
+  for (int i = 0; i < num_chunks; i++) {
+    free (chunks[i].out);
+  }
+
+  return out;
+}
+
+static void *
+png_writer_run (void *arg)
+{
+  png_writer *writer = (png_writer *)arg;
+
+  while (1) {
+    pthread_mutex_lock (&writer->mutex);
+    while (0 == writer->count && writer->running) {
+      pthread_cond_wait (&writer->not_empty, &writer->mutex);
+    }
+    if (0 == writer->count) {
+      pthread_mutex_unlock (&writer->mutex);
+      break;
+    }
+
+    png_writer_job job = writer->queue[writer->head];
+    writer->head = (writer->head + 1) % writer->capacity;
+    writer->count--;
+    pthread_cond_signal (&writer->not_full);
+    pthread_mutex_unlock (&writer->mutex);
+
+    int stride = job.width*job.comp;
+    int len = 0;
+    unsigned char *png = stbi_write_png_to_mem (job.data, stride, job.width, job.height,
+        job.comp, &len);
+
+    int ret = -1;
+    if (NULL != png) {
+      FILE *file = fopen (job.path, "wb");
+      if (NULL != file) {
+        ret = len == fwrite (png, 1, len, file) ? 0 : -1;
+        ret = 0 == fclose (file) ? ret : -1;
+      }
+    }
+    if (0 != ret) {
+      fprintf (stderr, "vx-training: Unable to write image to %s\n", job.path);
+    }
+
+    pthread_mutex_lock (&writer->mutex);
+    if (0 == ret) {
+      writer->written++;
+      writer->raw_mb += (double)job.height*stride/(1024*1024);
+      writer->png_mb += (double)len/(1024*1024);
+    } else {
+      writer->failed++;
+    }
+    pthread_mutex_unlock (&writer->mutex);
+
+    free (png);
+    free (job.data);
+    free (job.path);
+  }
+
+  return NULL;
+}
+
+/* Starts threads writer threads with room for capacity images in the
+ * queue. level is the zlib compression level, from 0 (store) to 9,
+ * where 1 is the fastest that still compresses. The cores are split
+ * among the writer threads, every image is deflated in as many chunks
+ * as its writer has cores. Returns NULL on error.
+ */
+static png_writer *
+png_writer_new (int threads, int capacity, int level)
+{
+  png_writer *writer = (png_writer *)calloc (1, sizeof (png_writer));
+  if (NULL == writer) {
+    return NULL;
+  }
+
+  writer->queue = (png_writer_job *)calloc (capacity, sizeof (png_writer_job));
+  writer->threads = (pthread_t *)calloc (threads, sizeof (pthread_t));
+  if (NULL == writer->queue || NULL == writer->threads) {
+    goto free_writer;
+  }
+
+  writer->capacity = capacity;
+  writer->level = level;
+  writer->running = 1;
+  pthread_mutex_init (&writer->mutex, NULL);
+  pthread_cond_init (&writer->not_empty, NULL);
+  pthread_cond_init (&writer->not_full, NULL);
+
+  stbi_write_png_compression_level = level;
+  /* Writers already run in parallel, so each one gets its share of the
+   * cores instead of all of them
+   */
+  png_writer_deflate_threads = sysconf (_SC_NPROCESSORS_ONLN) / threads;
+  if (png_writer_deflate_threads < 1) {
+    png_writer_deflate_threads = 1;
+  }
+
+  for (; writer->num_threads < threads; writer->num_threads++) {
+    if (0 != pthread_create (&writer->threads[writer->num_threads], NULL,
+            png_writer_run, writer)) {
+      fprintf (stderr, "vx-training: Unable to start PNG writer thread\n");
+      break;
+    }
+  }
+  if (0 == writer->num_threads) {
+    goto free_writer;
+  }
+
+  return writer;
+
+ free_writer:
+  free (writer->threads);
+  free (writer->queue);
+  free (writer);
+  return NULL;
+}
+
+/* Copies the image into the queue, with the same arguments as
+ * stbi_write_png(). Waits if the queue is full. Returns 0 on success,
+ * write errors are only known after png_writer_finish().
+ */
+static int
+png_writer_write (png_writer *writer, const char *path, int width, int height,
+    int comp, const void *data, int stride)
+{
+  png_writer_job job;
+  job.path = strdup (path);
+  job.data = (unsigned char *)malloc (width*height*comp);
+  job.width = width;
+  job.height = height;
+  job.comp = comp;
+  if (NULL == job.path || NULL == job.data) {
+    free (job.path);
+    free (job.data);
+    return -1;
+  }
+
+  /* Copy before taking the lock, writers may be waiting for it */
+  for (int y = 0; y < height; y++) {
+    memcpy (job.data + y*width*comp, (const unsigned char *)data + y*stride, width*comp);
+  }
+
+  pthread_mutex_lock (&writer->mutex);
+  if (0 == writer->pushed++) {
+    /* Throughput is measured from the first image on */
+    clock_gettime (CLOCK_MONOTONIC, &writer->start);
+  }
+  if (writer->count == writer->capacity) {
+    struct timespec start;
+    clock_gettime (CLOCK_MONOTONIC, &start);
+    writer->blocked++;
+    while (writer->count == writer->capacity) {
+      pthread_cond_wait (&writer->not_full, &writer->mutex);
+    }
+    writer->blocked_ms += png_writer_ms (&start);
+  }
+
+  writer->queue[(writer->head + writer->count) % writer->capacity] = job;
+  writer->count++;
+  if (writer->count > writer->max_queued) {
+    writer->max_queued = writer->count;
+  }
+  pthread_cond_signal (&writer->not_empty);
+  pthread_mutex_unlock (&writer->mutex);
+
+  return 0;
+}
+
+/* Waits for every queued image to be written and stops the threads.
+ * Returns the amount of images that couldn't be written.
+ */
+static int
+png_writer_finish (png_writer *writer)
+{
+  pthread_mutex_lock (&writer->mutex);
+  int running = writer->running;
+  writer->running = 0;
+  pthread_cond_broadcast (&writer->not_empty);
+  pthread_mutex_unlock (&writer->mutex);
+
+  if (running) {
+    for (int i = 0; i < writer->num_threads; i++) {
+      pthread_join (writer->threads[i], NULL);
+    }
+    if (writer->pushed > 0) {
+      writer->elapsed_ms = png_writer_ms (&writer->start);
+    }
+  }
+
+  return writer->failed;
+}
+
+static void
+png_writer_report (const png_writer *writer)
+{
+  double seconds = writer->elapsed_ms/1000.0;
+
+  printf ("PNG writer:\n");
+  printf ("\tThreads: %d\n", writer->num_threads);
+  printf ("\tDeflate threads per image: %d\n", png_writer_deflate_threads);
+  printf ("\tCompression level: %d\n", writer->level);
+  printf ("\tQueue capacity: %d images\n", writer->capacity);
+  printf ("\tMaximum queued: %d\n", writer->max_queued);
+  printf ("\tImages written: %d/%d\n", writer->written, writer->pushed);
+  printf ("\tWrites that waited: %d\n", writer->blocked);
+  printf ("\tTime waited: %gms\n", writer->blocked_ms);
+  if (seconds > 0) {
+    printf ("\tRaw throughput: %gMB/s\n", writer->raw_mb/seconds);
+    printf ("\tWrite throughput: %gMB/s\n", writer->png_mb/seconds);
+  }
+  printf ("\t---\n");
+}
+
+static void
+png_writer_free (png_writer *writer)
+{
+  if (NULL == writer) {
+    return;
+  }
+
+  png_writer_finish (writer);
+
+  pthread_cond_destroy (&writer->not_full);
+  pthread_cond_destroy (&writer->not_empty);
+  pthread_mutex_destroy (&writer->mutex);
+  free (writer->threads);
+  free (writer->queue);
+  free (writer);
+}
+
+#endif // VX_TRAINING_PNG_WRITER_H
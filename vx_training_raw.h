@@ -0,0 +1,314 @@
+/* Copyright (C) 2022 RidgeRun, LLC (http://www.ridgerun.com)
+ * All Rights Reserved.
+ *
+ * The contents of this software are proprietary and confidential to RidgeRun,
+ * LLC.  No part of this program may be photocopied, reproduced or translated
+ * into another programming language without prior written consent of
+ * RidgeRun, LLC.  The user is free to modify the source code after obtaining
+ * a software license from RidgeRun.  All source code changes must be provided
+ * back to RidgeRun without any encumbrance.
+ */
+
+#ifndef VX_TRAINING_RAW_H
+#define VX_TRAINING_RAW_H
+
+/* A raw image container meant to be mapped, not decoded. The file
+ * starts with a page holding the header, followed by the pixels:
+ *
+ *   offset 0:       raw_header
+ *   offset 4096:    height rows of stride_y bytes
+ *
+ * Rows are padded to 64 bytes and the pixels start at a page
+ * boundary, so the mapping can be handed to vxCreateImageFromHandle()
+ * as is. Opening a frame costs a mmap(), its pages are only read from
+ * disk, or the page cache, when the graph touches them. The mapping is
+ * private, so the graph may even write to it without changing the file.
+ *
+ * Only single plane formats are supported. Fields are stored in the
+ * byte order of the host.
+ */
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <VX/vx.h>
+
+#define RAW_MAGIC "VXRAW001"
+#define RAW_PAGE_SIZE 4096
+#define RAW_ROW_ALIGNMENT 64
+
+typedef struct
+{
+  char magic[8];
+  uint32_t width;
+  uint32_t height;
+  /* vx_df_image code */
+  uint32_t format;
+  int32_t stride_x;
+  int32_t stride_y;
+  uint32_t reserved;
+  uint64_t offset;
+  uint64_t size;
+} raw_header;
+
+typedef struct
+{
+  void *map;
+  size_t map_size;
+  vx_uint32 width;
+  vx_uint32 height;
+  vx_df_image format;
+  vx_int32 stride_x;
+  vx_int32 stride_y;
+  unsigned char *data;
+} raw_frame;
+
+/* Bytes per pixel, or 0 if the format can't be stored */
+static int
+raw_pixel_size (vx_df_image format)
+{
+  switch (format) {
+  case VX_DF_IMAGE_U8:
+    return 1;
+  case VX_DF_IMAGE_U16:
+  case VX_DF_IMAGE_S16:
+    return 2;
+  case VX_DF_IMAGE_RGB:
+    return 3;
+  case VX_DF_IMAGE_RGBX:
+  case VX_DF_IMAGE_U32:
+  case VX_DF_IMAGE_S32:
+    return 4;
+  default:
+    return 0;
+  }
+}
+
+/* Whether the path names a raw file, going by its extension */
+static int
+raw_path (const char *path)
+{
+  size_t len = strlen (path);
+
+  return len >= 4 && 0 == strcmp (path + len - 4, ".raw");
+}
+
+/* Whether the file starts with a raw header */
+static int
+raw_probe (const char *path)
+{
+  char magic[sizeof (((raw_header *)0)->magic)];
+  int ret = 0;
+
+  FILE *file = fopen (path, "rb");
+  if (NULL == file) {
+    return 0;
+  }
+
+  if (1 == fread (magic, sizeof (magic), 1, file)) {
+    ret = 0 == memcmp (magic, RAW_MAGIC, sizeof (magic));
+  }
+
+  fclose (file);
+  return ret;
+}
+
+/* Maps the frame in the file. Returns 0 on success and -1 on error. */
+static int
+raw_open (const char *path, raw_frame *frame)
+{
+  int ret = -1;
+  raw_header header;
+  struct stat info;
+  int pixel_size = 0;
+
+  memset (frame, 0, sizeof (*frame));
+
+  int fd = open (path, O_RDONLY);
+  if (-1 == fd) {
+    fprintf (stderr, "vx-training: Unable to open %s\n", path);
+    goto out;
+  }
+
+  if (sizeof (header) != read (fd, &header, sizeof (header)) ||
+      0 != memcmp (header.magic, RAW_MAGIC, sizeof (header.magic))) {
+    fprintf (stderr, "vx-training: %s is not a raw image\n", path);
+    goto close_fd;
+  }
+
+  pixel_size = raw_pixel_size (header.format);
+  if (0 != fstat (fd, &info) || 0 == pixel_size || header.stride_x != pixel_size ||
+      header.stride_y < (int64_t)header.width*pixel_size ||
+      header.size < (uint64_t)header.stride_y*header.height ||
+      0 != header.offset % RAW_PAGE_SIZE ||
+      /* Written so that neither side can wrap around */
+      header.offset > (uint64_t)info.st_size ||
+      header.size > (uint64_t)info.st_size - header.offset) {
+    fprintf (stderr, "vx-training: Corrupted raw image %s\n", path);
+    goto close_fd;
+  }
+
+  /* Private and writable, so writes from the graph stay in memory */
+  frame->map_size = info.st_size;
+  frame->map = mmap (NULL, frame->map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if (MAP_FAILED == frame->map) {
+    fprintf (stderr, "vx-training: Unable to map %s\n", path);
+    frame->map = NULL;
+    goto close_fd;
+  }
+
+  frame->width = header.width;
+  frame->height = header.height;
+  frame->format = header.format;
+  frame->stride_x = header.stride_x;
+  frame->stride_y = header.stride_y;
+  frame->data = (unsigned char *)frame->map + header.offset;
+
+  ret = 0;
+
+ close_fd:
+  /* The mapping holds its own reference to the file */
+  close (fd);
+
+ out:
+  return ret;
+}
+
+static void
+raw_close (raw_frame *frame)
+{
+  if (NULL != frame->map) {
+    munmap (frame->map, frame->map_size);
+  }
+  memset (frame, 0, sizeof (*frame));
+}
+
+/* Wraps the mapped pixels in an image, nothing is copied. The frame
+ * must stay open while the image is alive.
+ */
+static vx_image
+raw_create_image (vx_context context, const raw_frame *frame)
+{
+  vx_imagepatch_addressing_t layout = { frame->width, frame->height, frame->stride_x,
+    frame->stride_y, VX_SCALE_UNITY, VX_SCALE_UNITY, 1, 1 };
+  void *ptrs[] = { frame->data };
+
+  return vxCreateImageFromHandle (context, frame->format, &layout, ptrs, VX_MEMORY_TYPE_HOST);
+}
+
+/* Stores height rows of stride bytes apart. Returns 0 on success and
+ * -1 on error.
+ */
+static int
+raw_write (const char *path, vx_uint32 width, vx_uint32 height, vx_df_image format,
+    const void *data, vx_int32 stride)
+{
+  int ret = -1;
+  raw_header header;
+  unsigned char *page = NULL;
+  FILE *file = NULL;
+  size_t tail = 0;
+
+  int pixel_size = raw_pixel_size (format);
+  int row_size = width*pixel_size;
+  if (0 == pixel_size) {
+    fprintf (stderr, "vx-training: Format not supported by raw images\n");
+    goto out;
+  }
+
+  memset (&header, 0, sizeof (header));
+  memcpy (header.magic, RAW_MAGIC, sizeof (header.magic));
+  header.width = width;
+  header.height = height;
+  header.format = format;
+  header.stride_x = pixel_size;
+  header.stride_y = (width*pixel_size + RAW_ROW_ALIGNMENT - 1) / RAW_ROW_ALIGNMENT * RAW_ROW_ALIGNMENT;
+  header.offset = RAW_PAGE_SIZE;
+  header.size = ((uint64_t)header.stride_y*height + RAW_PAGE_SIZE - 1) / RAW_PAGE_SIZE * RAW_PAGE_SIZE;
+
+  /* Zeroes for the header page and the padding */
+  page = (unsigned char *)calloc (1, header.stride_y > RAW_PAGE_SIZE ? header.stride_y : RAW_PAGE_SIZE);
+  if (NULL == page) {
+    goto out;
+  }
+
+  file = fopen (path, "wb");
+  if (NULL == file) {
+    fprintf (stderr, "vx-training: Unable to open %s for writing\n", path);
+    goto free_page;
+  }
+
+  memcpy (page, &header, sizeof (header));
+  if (1 != fwrite (page, RAW_PAGE_SIZE, 1, file)) {
+    goto close_file;
+  }
+  memset (page, 0, sizeof (header));
+
+  for (vx_uint32 y = 0; y < height; y++) {
+    if (1 != fwrite ((const unsigned char *)data + (size_t)y*stride, row_size, 1, file) ||
+        (header.stride_y > row_size && 1 != fwrite (page, header.stride_y - row_size, 1, file))) {
+      goto close_file;
+    }
+  }
+
+  tail = header.size - (uint64_t)header.stride_y*height;
+  if (tail > 0 && 1 != fwrite (page, tail, 1, file)) {
+    goto close_file;
+  }
+
+  ret = 0;
+
+ close_file:
+  if (0 != fclose (file)) {
+    ret = -1;
+  }
+  if (0 != ret) {
+    fprintf (stderr, "vx-training: Unable to write raw image to %s\n", path);
+  }
+
+ free_page:
+  free (page);
+
+ out:
+  return ret;
+}
+
+/* Stores the contents of the image. Returns 0 on success and -1 on
+ * error.
+ */
+static int
+raw_write_image (vx_image image, const char *path)
+{
+  int ret = -1;
+
+  vx_uint32 width = 0;
+  vx_uint32 height = 0;
+  vx_df_image format = VX_DF_IMAGE_VIRT;
+  vxQueryImage (image, VX_IMAGE_WIDTH, &width, sizeof (width));
+  vxQueryImage (image, VX_IMAGE_HEIGHT, &height, sizeof (height));
+  vxQueryImage (image, VX_IMAGE_FORMAT, &format, sizeof (format));
+
+  const vx_rectangle_t rect = { 0, 0, width, height };
+  vx_map_id map_id = 0;
+  vx_imagepatch_addressing_t addr = { 0 };
+  unsigned char *ptr = NULL;
+  vx_status status = vxMapImagePatch (image, &rect, 0, &map_id, &addr, (void **)&ptr,
+      VX_READ_ONLY, VX_MEMORY_TYPE_HOST, VX_NOGAP_X);
+  if (VX_SUCCESS != status) {
+    fprintf (stderr, "vx-training: Unable to map image for reading: %d\n", status);
+    return ret;
+  }
+
+  ret = raw_write (path, width, height, format, ptr, addr.stride_y);
+
+  vxUnmapImagePatch (image, map_id);
+
+  return ret;
+}
+
+#endif // VX_TRAINING_RAW_H
@@ -0,0 +1,467 @@
+/* Copyright (C) 2022 RidgeRun, LLC (http://www.ridgerun.com)
+ * All Rights Reserved.
+ *
+ * The contents of this software are proprietary and confidential to RidgeRun,
+ * LLC.  No part of this program may be photocopied, reproduced or translated
+ * into another programming language without prior written consent of
+ * RidgeRun, LLC.  The user is free to modify the source code after obtaining
+ * a software license from RidgeRun.  All source code changes must be provided
+ * back to RidgeRun without any encumbrance.
+ */
+
+#ifndef VX_TRAINING_SOURCE_H
+#define VX_TRAINING_SOURCE_H
+
+/* Input frames for the streaming examples. The source may be:
+ *
+ *  - a single image, decoded once and fed over and over
+ *  - a numbered image sequence, given as a printf pattern such as
+ *    frames/%05d.png and starting at 0 or 1
+ *  - a video file, anything cv::VideoCapture can open
+ *
+ * Sequences and videos are decoded ahead of time into a ring of RGB
+ * buffers by a pool of decoder threads, so decoding overlaps with the
+ * graph. Frames are handed out in order. A frame stays owned by the
+ * caller until it is released, so zero-copy images may keep pointing
+ * to it while the graph reads it.
+ *
+ * If the graph only reads one channel, the decoders may keep just
+ * that one. Frames then take a third of the memory and the graph
+ * doesn't need a channel extract.
+ */
+
+#include <chrono>
+#include <climits>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <opencv2/opencv.hpp>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "stb_image.h"
+#include "vx_training_kernels.h"
+
+class frame_source
+{
+public:
+  /* depth is the amount of frames decoded ahead, decoders the amount
+   * of threads decoding them. Videos are decoded by a single thread,
+   * their frames depend on each other. With loop set, the source
+   * starts over at the end instead of finishing.
+   */
+  frame_source (int depth, int decoders, bool loop) : depth (depth), decoders (decoders),
+    loop (loop), kept (0), channel (-1), kind (SINGLE), frame_width (0), frame_height (0), sequence_start (0),
+    sequence_length (0), next_decode (0), next_deliver (0), end (LONG_MAX), stopping (false),
+    failed (false), decoded (0), stalls (0), stall_ms (0) {}
+
+  ~frame_source ()
+  {
+    {
+      std::lock_guard<std::mutex> lock (mutex);
+      stopping = true;
+    }
+    slot_free.notify_all ();
+    for (auto &worker: workers) {
+      worker.join ();
+    }
+  }
+
+  bool
+  open (const std::string &path)
+  {
+    this->path = path;
+
+    if (std::string::npos != path.find ('%')) {
+      kind = SEQUENCE;
+      if (!probe_sequence ()) {
+        std::cerr << "vx-training: No images match " << path << std::endl;
+        return false;
+      }
+    } else {
+      int channels = 0;
+      if (stbi_info (path.c_str (), &frame_width, &frame_height, &channels)) {
+        kind = SINGLE;
+      } else {
+        kind = VIDEO;
+        if (!capture.open (path)) {
+          std::cerr << "vx-training: Unable to open " << path << std::endl;
+          return false;
+        }
+        frame_width = capture.get (cv::CAP_PROP_FRAME_WIDTH);
+        frame_height = capture.get (cv::CAP_PROP_FRAME_HEIGHT);
+        decoders = 1;
+      }
+    }
+
+    if (SINGLE == kind) {
+      /* Nothing to decode ahead, every frame is the same buffer */
+      int channels = 0;
+      unsigned char *data = stbi_load (path.c_str (), &frame_width, &frame_height, &channels, 3);
+      if (NULL == data) {
+        std::cerr << "vx-training: Unable to load image " << path << std::endl;
+        return false;
+      }
+      single.resize (frame_size ());
+      store (cv::Mat (frame_height, frame_width, CV_8UC3, data), false, single.data ());
+      free (data);
+      return true;
+    }
+
+    slots.resize (depth + kept);
+    for (auto &slot: slots) {
+      slot.data.resize (frame_size ());
+    }
+
+    for (int i = 0; i < decoders; i++) {
+      workers.emplace_back (&frame_source::decode_loop, this);
+    }
+    return true;
+  }
+
+  /* The caller may keep up to this many frames while it acquires
+   * new ones, as zero-copy inputs do while the graph reads them. They
+   * are set aside on top of the frames decoded ahead, otherwise the
+   * decoders would starve. Must be called before open().
+   */
+  void
+  keep (int frames)
+  {
+    kept = frames;
+  }
+
+  /* Keep only the given channel, 0 for red, 1 for green and 2 for
+   * blue. Must be called before open().
+   */
+  void
+  extract (int channel)
+  {
+    this->channel = channel;
+  }
+
+  /* Bytes per pixel of the frames, 1 if a channel is extracted and 3
+   * otherwise
+   */
+  int
+  channels () const
+  {
+    return channel < 0 ? 3 : 1;
+  }
+
+  int
+  width () const
+  {
+    return frame_width;
+  }
+
+  int
+  height () const
+  {
+    return frame_height;
+  }
+
+  /* Buffer with a frame to be passed to the graph at startup. It is
+   * never reused for decoding.
+   */
+  unsigned char *
+  placeholder ()
+  {
+    if (single.empty ()) {
+      single.resize (frame_size ());
+    }
+    return single.data ();
+  }
+
+  /* Next frame in order, waits for it to be decoded if needed. Returns
+   * NULL at the end of the stream or if decoding failed.
+   */
+  unsigned char *
+  acquire ()
+  {
+    if (SINGLE == kind) {
+      return single.data ();
+    }
+
+    std::unique_lock<std::mutex> lock (mutex);
+    slot *next = find (next_deliver, READY);
+    if (NULL == next && next_deliver < end && !failed) {
+      /* The graph is about to wait on I/O */
+      auto start = std::chrono::steady_clock::now ();
+      stalls++;
+      frame_ready.wait (lock, [&] () {
+        next = find (next_deliver, READY);
+        return NULL != next || next_deliver >= end || failed;
+      });
+      stall_ms += std::chrono::duration<double, std::milli>(
+          std::chrono::steady_clock::now () - start).count ();
+    }
+
+    if (NULL == next) {
+      return NULL;
+    }
+
+    next->state = IN_USE;
+    next_deliver++;
+    return next->data.data ();
+  }
+
+  /* Gives the buffer back to be filled with a new frame */
+  void
+  release (unsigned char *data)
+  {
+    if (SINGLE == kind || NULL == data) {
+      return;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock (mutex);
+      for (auto &slot: slots) {
+        if (slot.data.data () == data) {
+          slot.state = FREE;
+        }
+      }
+    }
+    slot_free.notify_one ();
+  }
+
+  void
+  report () const
+  {
+    static const char *kinds[] = { "single image", "image sequence", "video" };
+    static const char *channel_names[] = { "R", "G", "B" };
+
+    std::cout << "Input source:" << std::endl;
+    std::cout << "\tType: " << kinds[kind] << std::endl;
+    std::cout << "\tResolution: " << frame_width << "x" << frame_height << std::endl;
+    std::cout << "\tChannels: " << (channel < 0 ? "RGB" : channel_names[channel]) << std::endl;
+    if (SINGLE != kind) {
+      std::cout << "\tDecode ahead: " << depth << " frames" << std::endl;
+      std::cout << "\tDecoder threads: " << decoders << std::endl;
+      std::cout << "\tFrames decoded: " << decoded << std::endl;
+      std::cout << "\tTimes the consumer waited: " << stalls << std::endl;
+      std::cout << "\tTime waited: " << stall_ms << "ms" << std::endl;
+    }
+    std::cout << "\t---" << std::endl;
+  }
+
+private:
+  enum source_kind {
+    SINGLE,
+    SEQUENCE,
+    VIDEO,
+  };
+
+  enum slot_state {
+    FREE,
+    DECODING,
+    READY,
+    IN_USE,
+  };
+
+  struct slot {
+    slot () : state (FREE), index (-1) {}
+
+    std::vector<unsigned char> data;
+    slot_state state;
+    long index;
+  };
+
+  std::string
+  sequence_path (long index) const
+  {
+    std::vector<char> name (path.size () + 32);
+    snprintf (name.data (), name.size (), path.c_str (), static_cast<int>(index));
+    return name.data ();
+  }
+
+  /* Finds where the sequence starts and how long it is. Only headers
+   * are read, the first image sets the size of the stream.
+   */
+  bool
+  probe_sequence ()
+  {
+    int w = 0;
+    int h = 0;
+    int channels = 0;
+    for (sequence_start = 0; sequence_start < 2; sequence_start++) {
+      if (stbi_info (sequence_path (sequence_start).c_str (), &frame_width, &frame_height, &channels)) {
+        break;
+      }
+    }
+    if (sequence_start == 2) {
+      return false;
+    }
+
+    sequence_length = 1;
+    while (stbi_info (sequence_path (sequence_start + sequence_length).c_str (), &w, &h, &channels)) {
+      sequence_length++;
+    }
+    return true;
+  }
+
+  slot *
+  find (long index, slot_state state)
+  {
+    for (auto &slot: slots) {
+      if (slot.index == index && slot.state == state) {
+        return &slot;
+      }
+    }
+    return NULL;
+  }
+
+  size_t
+  frame_size () const
+  {
+    return static_cast<size_t>(frame_width)*frame_height*channels ();
+  }
+
+  /* Frames that don't match the size of the stream are scaled. The
+   * channel is picked straight from the decoded pixels, BGR or RGB,
+   * with no conversion in between.
+   */
+  void
+  store (const cv::Mat &pixels, bool bgr, unsigned char *target)
+  {
+    cv::Mat scaled = pixels;
+    if (pixels.cols != frame_width || pixels.rows != frame_height) {
+      cv::resize (pixels, scaled, cv::Size (frame_width, frame_height));
+    }
+
+    if (channel >= 0) {
+      int index = bgr ? 2 - channel : channel;
+      for (int y = 0; y < frame_height; y++) {
+        extract_row (scaled.data + y*scaled.step, index, target + y*frame_width,
+            frame_width, kernels_simd ());
+      }
+    } else if (bgr) {
+      cv::Mat out (frame_height, frame_width, CV_8UC3, target);
+      cv::cvtColor (scaled, out, cv::COLOR_BGR2RGB);
+    } else {
+      for (int y = 0; y < frame_height; y++) {
+        memcpy (target + y*frame_width*3, scaled.data + y*scaled.step, frame_width*3);
+      }
+    }
+  }
+
+  bool
+  decode_image (long index, slot &target)
+  {
+    if (loop) {
+      index %= sequence_length;
+    } else if (index >= sequence_length) {
+      return false;
+    }
+
+    int w = 0;
+    int h = 0;
+    int channels = 0;
+    std::string name = sequence_path (sequence_start + index);
+    unsigned char *data = stbi_load (name.c_str (), &w, &h, &channels, 3);
+    if (NULL == data) {
+      std::cerr << "vx-training: Unable to load image " << name << std::endl;
+      return false;
+    }
+
+    store (cv::Mat (h, w, CV_8UC3, data), false, target.data.data ());
+    free (data);
+    return true;
+  }
+
+  bool
+  decode_video (slot &target)
+  {
+    cv::Mat bgr;
+    if (!capture.read (bgr) && loop) {
+      capture.set (cv::CAP_PROP_POS_FRAMES, 0);
+      capture.read (bgr);
+    }
+    if (bgr.empty ()) {
+      return false;
+    }
+
+    store (bgr, true, target.data.data ());
+    return true;
+  }
+
+  void
+  decode_loop ()
+  {
+    while (true) {
+      slot *target = NULL;
+      long index = 0;
+      {
+        std::unique_lock<std::mutex> lock (mutex);
+        slot_free.wait (lock, [&] () {
+          for (auto &slot: slots) {
+            if (FREE == slot.state) {
+              target = &slot;
+              break;
+            }
+          }
+          return stopping || failed || next_decode >= end || NULL != target;
+        });
+        if (stopping || failed || next_decode >= end) {
+          return;
+        }
+
+        index = next_decode++;
+        target->index = index;
+        target->state = DECODING;
+      }
+
+      bool ok = VIDEO == kind ? decode_video (*target) : decode_image (index, *target);
+
+      {
+        std::lock_guard<std::mutex> lock (mutex);
+        if (ok) {
+          target->state = READY;
+          decoded++;
+        } else {
+          /* End of the stream, later frames will never come */
+          target->state = FREE;
+          target->index = -1;
+          end = std::min (end, index);
+          failed = failed || (SEQUENCE == kind && index < sequence_length);
+        }
+      }
+      frame_ready.notify_all ();
+      slot_free.notify_all ();
+    }
+  }
+
+  const int depth;
+  int decoders;
+  const bool loop;
+  int kept;
+  int channel;
+  source_kind kind;
+  std::string path;
+  int frame_width;
+  int frame_height;
+  long sequence_start;
+  long sequence_length;
+  cv::VideoCapture capture;
+  std::vector<unsigned char> single;
+
+  std::vector<slot> slots;
+  std::vector<std::thread> workers;
+  std::mutex mutex;
+  std::condition_variable slot_free;
+  std::condition_variable frame_ready;
+  long next_decode;
+  long next_deliver;
+  long end;
+  bool stopping;
+  bool failed;
+
+  long decoded;
+  long stalls;
+  double stall_ms;
+};
+
+#endif // VX_TRAINING_SOURCE_H
@@ -0,0 +1,164 @@
+/* Copyright (C) 2022 RidgeRun, LLC (http://www.ridgerun.com)
+ * All Rights Reserved.
+ *
+ * The contents of this software are proprietary and confidential to RidgeRun,
+ * LLC.  No part of this program may be photocopied, reproduced or translated
+ * into another programming language without prior written consent of
+ * RidgeRun, LLC.  The user is free to modify the source code after obtaining
+ * a software license from RidgeRun.  All source code changes must be provided
+ * back to RidgeRun without any encumbrance.
+ */
+
+#ifndef VX_TRAINING_STARTUP_H
+#define VX_TRAINING_STARTUP_H
+
+/* Breakdown of the startup of an example, from the launch of the
+ * process to its first processed frame. main() begins the profiler
+ * first thing and marks the end of every phase:
+ *
+ *   startup_profiler startup;
+ *   startup_begin (&startup);
+ *   vx_context context = vxCreateContext ();
+ *   startup_mark (&startup, "Context creation");
+ *   ...
+ *   vxProcessGraph (graph);
+ *   startup_mark (&startup, "First frame");
+ *   startup_report (&startup, "Time to first frame");
+ *
+ * Each phase lasts from the previous mark to its own. The time the
+ * process took to reach main(), loading and relocating the shared
+ * libraries, is taken from the start time the kernel keeps for it, in
+ * clock ticks, so it is only accurate to 10ms or so.
+ *
+ * Usable from both C and C++.
+ */
+
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#define STARTUP_MAX_PHASES 16
+
+typedef struct
+{
+  const char *name;
+  double ms;
+} startup_phase;
+
+typedef struct
+{
+  struct timespec begin;
+  struct timespec last;
+  /* Negative when unknown */
+  double launch_ms;
+  int count;
+  startup_phase phases[STARTUP_MAX_PHASES];
+} startup_profiler;
+
+static double
+startup_elapsed_ms (const struct timespec *from, const struct timespec *to)
+{
+  return (to->tv_sec - from->tv_sec)*1000.0 + (to->tv_nsec - from->tv_nsec)/1000000.0;
+}
+
+/* Time from the start of the process until now, or -1 if unknown */
+static double
+startup_process_age_ms (void)
+{
+  FILE *file = fopen ("/proc/self/stat", "r");
+  if (NULL == file) {
+    return -1;
+  }
+
+  /* The command may hold spaces, fields are counted from its closing
+   * parenthesis. The start time is the 22nd field.
+   */
+  char line[1024];
+  size_t len = fread (line, 1, sizeof (line) - 1, file);
+  fclose (file);
+  line[len] = '\0';
+
+  const char *field = NULL;
+  for (size_t i = 0; i < len; i++) {
+    if (')' == line[i]) {
+      field = line + i + 1;
+    }
+  }
+
+  unsigned long long start_ticks = 0;
+  if (NULL == field || 1 != sscanf (field,
+      " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %*u %*u %*d %*d %*d %*d %*d %*d %llu",
+      &start_ticks)) {
+    return -1;
+  }
+
+  struct timespec now;
+  long ticks = sysconf (_SC_CLK_TCK);
+  if (ticks <= 0 || 0 != clock_gettime (CLOCK_BOOTTIME, &now)) {
+    return -1;
+  }
+
+  return now.tv_sec*1000.0 + now.tv_nsec/1000000.0 - start_ticks*1000.0/ticks;
+}
+
+static void
+startup_begin (startup_profiler *prof)
+{
+  clock_gettime (CLOCK_MONOTONIC, &prof->begin);
+  prof->last = prof->begin;
+  prof->launch_ms = startup_process_age_ms ();
+  prof->count = 0;
+}
+
+/* Ends the current phase. Phases past STARTUP_MAX_PHASES are folded
+ * into the last one.
+ */
+static void
+startup_mark (startup_profiler *prof, const char *name)
+{
+  struct timespec now;
+  clock_gettime (CLOCK_MONOTONIC, &now);
+
+  double ms = startup_elapsed_ms (&prof->last, &now);
+  prof->last = now;
+
+  if (prof->count < STARTUP_MAX_PHASES) {
+    prof->phases[prof->count].name = name;
+    prof->phases[prof->count].ms = ms;
+    prof->count++;
+  } else {
+    prof->phases[STARTUP_MAX_PHASES - 1].ms += ms;
+  }
+}
+
+/* Time from main() to the last mark */
+static double
+startup_total_ms (const startup_profiler *prof)
+{
+  return startup_elapsed_ms (&prof->begin, &prof->last);
+}
+
+/* Prints every phase and, under the given label, the time to the last
+ * mark
+ */
+static void
+startup_report (const startup_profiler *prof, const char *total_label)
+{
+  double total = startup_total_ms (prof);
+
+  printf ("Startup:\n");
+  if (prof->launch_ms >= 0) {
+    printf ("\tProcess launch (before main): %.1fms\n", prof->launch_ms);
+  }
+  for (int i = 0; i < prof->count; i++) {
+    printf ("\t%s: %.3fms (%.1f%%)\n", prof->phases[i].name, prof->phases[i].ms,
+        total > 0 ? 100.0*prof->phases[i].ms/total : 0);
+  }
+  printf ("\t%s: %.3fms\n", total_label, total);
+  if (prof->launch_ms >= 0) {
+    printf ("\t%s, including launch: %.1fms\n", total_label, prof->launch_ms + total);
+  }
+  printf ("\t---\n");
+}
+
+#endif // VX_TRAINING_STARTUP_H
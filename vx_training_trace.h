@@ -0,0 +1,283 @@
+/* Copyright (C) 2022 RidgeRun, LLC (http://www.ridgerun.com)
+ * All Rights Reserved.
+ *
+ * The contents of this software are proprietary and confidential to RidgeRun,
+ * LLC.  No part of this program may be photocopied, reproduced or translated
+ * into another programming language without prior written consent of
+ * RidgeRun, LLC.  The user is free to modify the source code after obtaining
+ * a software license from RidgeRun.  All source code changes must be provided
+ * back to RidgeRun without any encumbrance.
+ */
+
+#ifndef VX_TRAINING_TRACE_H
+#define VX_TRAINING_TRACE_H
+
+/* Timeline tracer in the Chrome trace event format. The resulting file
+ * can be opened in chrome://tracing or https://ui.perfetto.dev to see
+ * how host work, node executions and in-flight frames overlap.
+ *
+ * Tracing is off unless tracer::start() is called, in which case every
+ * trace point costs a NULL check.
+ */
+
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <VX/vx.h>
+
+class tracer
+{
+public:
+  /* The running tracer, or NULL if tracing is disabled */
+  static tracer *
+  get ()
+  {
+    return instance ();
+  }
+
+  static void
+  start ()
+  {
+    if (NULL == instance ()) {
+      instance () = new tracer ();
+    }
+  }
+
+  static void
+  stop ()
+  {
+    delete instance ();
+    instance () = NULL;
+  }
+
+  /* Microseconds since the tracer started, the trace time base */
+  double
+  now () const
+  {
+    return std::chrono::duration<double, std::micro>(
+        std::chrono::steady_clock::now () - origin).count ();
+  }
+
+  /* Names the lane of the calling thread */
+  void
+  set_thread_name (const std::string &name)
+  {
+    std::lock_guard<std::mutex> lock (mutex);
+    thread_names[thread_lane ()] = name;
+  }
+
+  /* A span of work on the calling thread */
+  void
+  span (const std::string &name, const char *category, double start, double end)
+  {
+    std::lock_guard<std::mutex> lock (mutex);
+    event ev = { name, category, 'X', start, end - start, thread_lane (), -1 };
+    events.push_back (ev);
+  }
+
+  /* Frames are drawn as async spans from the moment they enter the
+   * graph until their output is dequeued, so the ones in flight at the
+   * same time stack on top of each other.
+   */
+  void
+  frame_begin (long frame)
+  {
+    std::lock_guard<std::mutex> lock (mutex);
+    event ev = { "frame " + std::to_string (frame), "frame", 'b', now (), 0, thread_lane (), frame };
+    events.push_back (ev);
+  }
+
+  void
+  frame_end (long frame)
+  {
+    std::lock_guard<std::mutex> lock (mutex);
+    event ev = { "frame " + std::to_string (frame), "frame", 'e', now (), 0, thread_lane (), frame };
+    events.push_back (ev);
+  }
+
+  /* Records every execution of the node on a lane of its own. Node
+   * callbacks carry no user data, so the node is looked up by handle.
+   * Nodes must be registered in execution order: the graph lane spans
+   * from the start of the first node to the end of the last one.
+   */
+  vx_status
+  trace_node (vx_node node, const std::string &name)
+  {
+    {
+      std::lock_guard<std::mutex> lock (mutex);
+      int lane = node_lane_base + nodes.size () + 1;
+      for (auto &entry: nodes) {
+        entry.second.last = false;
+      }
+      node_info info = { name, lane, 0, nodes.empty (), true };
+      nodes[node] = info;
+      thread_names[lane] = "node: " + name;
+      thread_names[node_lane_base] = "graph";
+    }
+
+    return vxAssignNodeCallback (node, node_completed);
+  }
+
+  bool
+  write (const std::string &path)
+  {
+    std::lock_guard<std::mutex> lock (mutex);
+    std::ofstream out (path.c_str ());
+    if (!out) {
+      return false;
+    }
+
+    out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [" << std::endl;
+    bool first = true;
+    for (const auto &name: thread_names) {
+      out << (first ? "" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": "
+          << name.first << ", \"args\": {\"name\": \"" << name.second << "\"}}";
+      first = false;
+    }
+
+    for (const auto &ev: events) {
+      out << (first ? "" : ",\n") << "{\"name\": \"" << ev.name << "\", \"cat\": \"" << ev.category
+          << "\", \"ph\": \"" << ev.phase << "\", \"ts\": " << ev.ts << ", \"pid\": 1, \"tid\": " << ev.lane;
+      if ('X' == ev.phase) {
+        out << ", \"dur\": " << ev.dur;
+      }
+      if (ev.id >= 0) {
+        out << ", \"id\": " << ev.id;
+      }
+      out << "}";
+      first = false;
+    }
+    out << std::endl << "]}" << std::endl;
+
+    return out.good ();
+  }
+
+private:
+  struct event {
+    std::string name;
+    const char *category;
+    char phase;
+    double ts;
+    double dur;
+    int lane;
+    long id;
+  };
+
+  struct node_info {
+    std::string name;
+    int lane;
+    long executions;
+    bool first;
+    bool last;
+  };
+
+  enum { node_lane_base = 100 };
+
+  tracer () : origin (std::chrono::steady_clock::now ()) {}
+
+  static tracer *&
+  instance ()
+  {
+    static tracer *running = NULL;
+    return running;
+  }
+
+  /* Host threads get small sequential lane numbers. Must be called
+   * with the mutex held.
+   */
+  int
+  thread_lane ()
+  {
+    std::thread::id id = std::this_thread::get_id ();
+    auto it = threads.find (id);
+    if (threads.end () != it) {
+      return it->second;
+    }
+
+    int lane = threads.size () + 1;
+    threads[id] = lane;
+    return lane;
+  }
+
+  /* Called by the implementation once the node is done. The duration
+   * comes from the node performance, so performance measurement must be
+   * enabled in the context for the spans to have a width.
+   */
+  static vx_action VX_CALLBACK
+  node_completed (vx_node node)
+  {
+    tracer *self = get ();
+    if (NULL == self) {
+      return VX_ACTION_CONTINUE;
+    }
+
+    double end = self->now ();
+    vx_perf_t perf = { 0 };
+    vxQueryNode (node, VX_NODE_PERFORMANCE, &perf, sizeof (perf));
+    double start = end - perf.tmp/1000.0;
+
+    std::lock_guard<std::mutex> lock (self->mutex);
+    auto it = self->nodes.find (node);
+    if (self->nodes.end () == it) {
+      return VX_ACTION_CONTINUE;
+    }
+
+    /* Graph executions complete in order, so the n-th execution of a
+     * node belongs to the n-th frame.
+     */
+    node_info &info = it->second;
+    long execution = info.executions++;
+    event ev = { info.name + " #" + std::to_string (execution), "node", 'X', start,
+      end - start, info.lane, -1 };
+    self->events.push_back (ev);
+
+    if (info.first) {
+      self->graph_starts[execution] = start;
+    }
+
+    auto graph_start = self->graph_starts.find (execution);
+    if (info.last && self->graph_starts.end () != graph_start) {
+      event graph = { "graph #" + std::to_string (execution), "graph", 'X', graph_start->second,
+        end - graph_start->second, node_lane_base, -1 };
+      self->events.push_back (graph);
+      self->graph_starts.erase (graph_start);
+    }
+
+    return VX_ACTION_CONTINUE;
+  }
+
+  std::chrono::steady_clock::time_point origin;
+  std::mutex mutex;
+  std::vector<event> events;
+  std::map<std::thread::id, int> threads;
+  std::map<int, std::string> thread_names;
+  std::map<vx_node, node_info> nodes;
+  std::map<long, double> graph_starts;
+};
+
+/* Records a span for the enclosing scope if tracing is enabled */
+class trace_scope
+{
+public:
+  trace_scope (const char *name, const char *category = "host") :
+    name (name), category (category), start (tracer::get () ? tracer::get ()->now () : 0) {}
+
+  ~trace_scope ()
+  {
+    tracer *trace = tracer::get ();
+    if (trace) {
+      trace->span (name, category, start, trace->now ());
+    }
+  }
+
+private:
+  const char *name;
+  const char *category;
+  double start;
+};
+
+#endif // VX_TRAINING_TRACE_H
@@ -0,0 +1,216 @@
+/* Copyright (C) 2022 RidgeRun, LLC (http://www.ridgerun.com)
+ * All Rights Reserved.
+ *
+ * The contents of this software are proprietary and confidential to RidgeRun,
+ * LLC.  No part of this program may be photocopied, reproduced or translated
+ * into another programming language without prior written consent of
+ * RidgeRun, LLC.  The user is free to modify the source code after obtaining
+ * a software license from RidgeRun.  All source code changes must be provided
+ * back to RidgeRun without any encumbrance.
+ */
+
+#ifndef VX_TRAINING_VIDEO_SINK_H
+#define VX_TRAINING_VIDEO_SINK_H
+
+/* Writes output images to a video file from a thread of its own, so
+ * encoding never runs on the thread that feeds the graph. Frames are
+ * copied into a fixed pool and go through a bounded queue. When the
+ * encoder falls behind and the queue is full, new frames are either
+ * dropped or the producer waits for room, and both are accounted.
+ */
+
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <opencv2/opencv.hpp>
+#include <string>
+#include <thread>
+#include <vector>
+#include <VX/vx.h>
+
+class video_sink
+{
+public:
+  /* With block set, a full queue makes push() wait for the encoder
+   * instead of dropping the frame.
+   */
+  video_sink (size_t capacity, bool block) : capacity (capacity), block (block),
+    running (false), pushed (0), written (0), dropped (0), blocked (0),
+    blocked_ms (0), encode_ms (0), max_queued (0) {}
+
+  ~video_sink ()
+  {
+    close ();
+  }
+
+  bool
+  open (const std::string &path, int width, int height, double fps)
+  {
+    /* Outputs are single channel */
+    if (!writer.open (path, cv::VideoWriter::fourcc ('m', 'p', '4', 'v'), fps,
+            cv::Size (width, height), false)) {
+      return false;
+    }
+
+    for (size_t i = 0; i < capacity; i++) {
+      free_frames.push_back (cv::Mat (height, width, CV_8UC1));
+    }
+
+    running = true;
+    encoder = std::thread (&video_sink::run, this);
+    return true;
+  }
+
+  /* Copies the image into the queue. Returns 0 if it was queued, 1 if
+   * it was dropped and -1 on error.
+   */
+  int
+  push (vx_image image)
+  {
+    cv::Mat frame;
+    {
+      std::unique_lock<std::mutex> lock (mutex);
+      pushed++;
+      if (free_frames.empty () && block) {
+        auto start = std::chrono::steady_clock::now ();
+        blocked++;
+        has_room.wait (lock, [this] () { return !free_frames.empty () || !running; });
+        blocked_ms += std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now () - start).count ();
+      }
+
+      if (free_frames.empty () || !running) {
+        dropped++;
+        return 1;
+      }
+      frame = free_frames.back ();
+      free_frames.pop_back ();
+    }
+
+    /* Copy outside of the lock, the encoder may be waiting for it */
+    int ret = copy_image (image, frame);
+
+    std::lock_guard<std::mutex> lock (mutex);
+    if (0 != ret) {
+      free_frames.push_back (frame);
+      return -1;
+    }
+    queue.push_back (frame);
+    max_queued = std::max (max_queued, queue.size ());
+    has_frames.notify_one ();
+
+    return 0;
+  }
+
+  /* Writes whatever is queued and closes the file */
+  void
+  close ()
+  {
+    {
+      std::lock_guard<std::mutex> lock (mutex);
+      if (!running) {
+        return;
+      }
+      running = false;
+    }
+    has_frames.notify_all ();
+    has_room.notify_all ();
+    encoder.join ();
+    writer.release ();
+  }
+
+  void
+  report () const
+  {
+    std::cout << "Video sink:" << std::endl;
+    std::cout << "\tQueue capacity: " << capacity << " frames" << (block ? " (blocking)" : "") << std::endl;
+    std::cout << "\tFrames pushed: " << pushed << std::endl;
+    std::cout << "\tFrames written: " << written << std::endl;
+    std::cout << "\tFrames dropped: " << dropped << std::endl;
+    std::cout << "\tMaximum queued: " << max_queued << std::endl;
+    if (block) {
+      std::cout << "\tPushes that waited: " << blocked << std::endl;
+      std::cout << "\tTime waited: " << blocked_ms << "ms" << std::endl;
+    }
+    if (written > 0) {
+      std::cout << "\tAverage encode time: " << encode_ms/written << "ms" << std::endl;
+    }
+    std::cout << "\t---" << std::endl;
+  }
+
+private:
+  static int
+  copy_image (vx_image image, cv::Mat &frame)
+  {
+    const vx_rectangle_t rect = { 0, 0, static_cast<vx_uint32>(frame.cols),
+      static_cast<vx_uint32>(frame.rows) };
+    vx_map_id map_id = 0;
+    vx_imagepatch_addressing_t addr = VX_IMAGEPATCH_ADDR_INIT;
+    unsigned char *ptr = NULL;
+
+    vx_status status = vxMapImagePatch (image, &rect, 0, &map_id, &addr, (void **)&ptr,
+        VX_READ_ONLY, VX_MEMORY_TYPE_HOST, VX_NOGAP_X);
+    if (VX_SUCCESS != status) {
+      std::cerr << "vx-training: Unable to map image for reading: " << status << std::endl;
+      return -1;
+    }
+
+    for (int y = 0; y < frame.rows; y++) {
+      memcpy (frame.data + y*frame.step, ptr + y*addr.stride_y, frame.cols);
+    }
+
+    vxUnmapImagePatch (image, map_id);
+    return 0;
+  }
+
+  void
+  run ()
+  {
+    while (true) {
+      cv::Mat frame;
+      {
+        std::unique_lock<std::mutex> lock (mutex);
+        has_frames.wait (lock, [this] () { return !queue.empty () || !running; });
+        if (queue.empty ()) {
+          return;
+        }
+        frame = queue.front ();
+        queue.pop_front ();
+      }
+
+      auto start = std::chrono::steady_clock::now ();
+      writer.write (frame);
+      double ms = std::chrono::duration<double, std::milli>(
+          std::chrono::steady_clock::now () - start).count ();
+
+      std::lock_guard<std::mutex> lock (mutex);
+      encode_ms += ms;
+      written++;
+      free_frames.push_back (frame);
+      has_room.notify_one ();
+    }
+  }
+
+  const size_t capacity;
+  const bool block;
+  cv::VideoWriter writer;
+  std::thread encoder;
+  std::mutex mutex;
+  std::condition_variable has_frames;
+  std::condition_variable has_room;
+  std::deque<cv::Mat> queue;
+  std::vector<cv::Mat> free_frames;
+  bool running;
+  long pushed;
+  long written;
+  long dropped;
+  long blocked;
+  double blocked_ms;
+  double encode_ms;
+  size_t max_queued;
+};
+
+#endif // VX_TRAINING_VIDEO_SINK_H